@@ -432,6 +432,91 @@ void AnalogFilter::filterout(float *smp)
 }
 
 
+// Copies the coefficients and state of every stage into sect[],
+// returns the number of stages, or 0 if the filter is interpolating
+// between old and new coefficients and has to use filterout()
+int AnalogFilter::getsections(section *sect)
+{
+    if (needsinterpolation != 0)
+        return 0;
+    for (int i = 0; i < stages + 1; ++i)
+    {
+        sect[i].c0 = c[0];
+        sect[i].c1 = c[1];
+        sect[i].c2 = c[2];
+        sect[i].d1 = d[1];
+        sect[i].d2 = d[2];
+        sect[i].x1 = x[i].c1;
+        sect[i].x2 = x[i].c2;
+        sect[i].y1 = y[i].c1;
+        sect[i].y2 = y[i].c2;
+        sect[i].post = 1.0f;
+        sect[i].order = order;
+    }
+    sect[stages].post = outgain;
+    return stages + 1;
+}
+
+
+int AnalogFilter::putsections(const section *sect)
+{
+    for (int i = 0; i < stages + 1; ++i)
+    {
+        x[i].c1 = sect[i].x1;
+        y[i].c1 = sect[i].y1;
+        if (order == 2)
+        {
+            x[i].c2 = sect[i].x2;
+            y[i].c2 = sect[i].y2;
+        }
+    }
+    return stages + 1;
+}
+
+
+// Runs a whole cascade of stages on both channels in one pass over the
+// buffer. Each stage uses the same arithmetic as singlefilterout(), so
+// the result doesn't depend on how the work is split up.
+void AnalogFilter::cascadeout(const float *inl, const float *inr,
+                              float *outl, float *outr, section *sectl,
+                              section *sectr, int count, float volume, int n)
+{
+    for (int i = 0; i < n; ++i)
+    {
+        float l = inl[i] * volume;
+        float r = inr[i] * volume;
+        for (int k = 0; k < count; ++k)
+        {
+            section &sl = sectl[k];
+            section &sr = sectr[k];
+            float yl, yr;
+            if (sl.order == 1)
+            {
+                yl = l * sl.c0 + sl.x1 * sl.c1 + sl.y1 * sl.d1;
+                yr = r * sr.c0 + sr.x1 * sr.c1 + sr.y1 * sr.d1;
+            }
+            else
+            {
+                yl = l * sl.c0 + sl.x1 * sl.c1 + sl.x2 * sl.c2 + sl.y1 * sl.d1 + sl.y2 * sl.d2;
+                yr = r * sr.c0 + sr.x1 * sr.c1 + sr.x2 * sr.c2 + sr.y1 * sr.d1 + sr.y2 * sr.d2;
+                sl.y2 = sl.y1;
+                sl.x2 = sl.x1;
+                sr.y2 = sr.y1;
+                sr.x2 = sr.x1;
+            }
+            sl.y1 = yl;
+            sl.x1 = l;
+            sr.y1 = yr;
+            sr.x1 = r;
+            l = yl * sl.post;
+            r = yr * sr.post;
+        }
+        outl[i] = l;
+        outr[i] = r;
+    }
+}
+
+
 float AnalogFilter::H(float freq)
 {
     float fr = freq / synth->samplerate_f * PI * 2.0f;
@@ -48,6 +48,20 @@ class AnalogFilter : public Filter_, private MiscFuncs
 
         float H(float freq); // Obtains the response for a given frequency
 
+        // one stage of the cascade, copied out so several filters
+        // can be run together in a single pass (see EQ::out)
+        struct section {
+            float c0, c1, c2, d1, d2;
+            float x1, x2, y1, y2;
+            float post; // outgain after the last stage, otherwise 1
+            int order;
+        };
+        int getsections(section *sect);
+        int putsections(const section *sect);
+        static void cascadeout(const float *inl, const float *inr,
+                               float *outl, float *outr, section *sectl,
+                               section *sectr, int count, float volume, int n);
+
     private:
         struct fstage {
             float c1, c2;
@@ -23,6 +23,7 @@
 */
 
 #include <cstring>
+#include <pthread.h>
 #include <sys/sysinfo.h>
 
 using namespace std;
@@ -30,23 +31,33 @@ using namespace std;
 #include "Misc/Config.h"
 #include "DSP/FFTwrapper.h"
 
+// the fftw planner isn't thread safe, transforms are
+static pthread_mutex_t plannerLock = PTHREAD_MUTEX_INITIALIZER;
+
 FFTwrapper::FFTwrapper(int fftsize_) :
     fftsize(fftsize_),
     half_fftsize(fftsize_ / 2)
 {
-    data1 = (float*)fftwf_malloc(fftsize * sizeof(float));
-    data2 = (float*)fftwf_malloc(fftsize * sizeof(float));
-    planBasic = fftwf_plan_r2r_1d(fftsize, data1, data1, FFTW_R2HC, FFTW_ESTIMATE);
-    planInv = fftwf_plan_r2r_1d(fftsize, data2, data2, FFTW_HC2R, FFTW_ESTIMATE);
+    for (int i = 0; i < FFT_BUFFERS; ++i)
+    {
+        buffer[i] = (float*)fftwf_malloc(fftsize * sizeof(float));
+        busy[i] = 0;
+    }
+    pthread_mutex_lock(&plannerLock);
+    planBasic = fftwf_plan_r2r_1d(fftsize, buffer[0], buffer[0], FFTW_R2HC, FFTW_ESTIMATE);
+    planInv = fftwf_plan_r2r_1d(fftsize, buffer[0], buffer[0], FFTW_HC2R, FFTW_ESTIMATE);
+    pthread_mutex_unlock(&plannerLock);
 }
 
 
 FFTwrapper::~FFTwrapper()
 {
+    pthread_mutex_lock(&plannerLock);
     fftwf_destroy_plan(planBasic);
     fftwf_destroy_plan(planInv);
-    fftwf_free(data1);
-    fftwf_free(data2);
+    pthread_mutex_unlock(&plannerLock);
+    for (int i = 0; i < FFT_BUFFERS; ++i)
+        fftwf_free(buffer[i]);
 }
 
 
@@ -69,25 +80,50 @@ void FFTwrapper::deleteFFTFREQS(FFTFREQS *f)
 }
 
 
+// Only allocates if all the buffers are in use at the same time.
+float *FFTwrapper::claim(int &slot)
+{
+    for (slot = 0; slot < FFT_BUFFERS; ++slot)
+        if (!__sync_lock_test_and_set(&busy[slot], 1))
+            return buffer[slot];
+    slot = -1;
+    return (float*)fftwf_malloc(fftsize * sizeof(float));
+}
+
+
+void FFTwrapper::release(float *data, int slot)
+{
+    if (slot < 0)
+        fftwf_free(data);
+    else
+        __sync_lock_release(&busy[slot]);
+}
+
+
 // Fast Fourier Transform
 void FFTwrapper::smps2freqs(float *smps, FFTFREQS *freqs)
 {
-    memcpy(data1, smps, fftsize * sizeof(float));
-    fftwf_execute(planBasic);
-    memcpy(freqs->c, data1, half_fftsize * sizeof(float));
+    int slot;
+    float *data = claim(slot);
+    memcpy(data, smps, fftsize * sizeof(float));
+    fftwf_execute_r2r(planBasic, data, data);
+    memcpy(freqs->c, data, half_fftsize * sizeof(float));
     for (int i = 1; i < half_fftsize; ++i)
-        freqs->s[i] = data1[fftsize - i];
-    data2[half_fftsize] = 0.0f;
+        freqs->s[i] = data[fftsize - i];
+    release(data, slot);
 }
 
 
 // Inverse Fast Fourier Transform
 void FFTwrapper::freqs2smps(FFTFREQS *freqs, float *smps)
 {
-    memcpy(data2, freqs->c, half_fftsize * sizeof(float));
-    data2[half_fftsize] = 0.0;
+    int slot;
+    float *data = claim(slot);
+    memcpy(data, freqs->c, half_fftsize * sizeof(float));
+    data[half_fftsize] = 0.0;
     for (int i = 1; i < half_fftsize; ++i)
-        data2[fftsize - i] = freqs->s[i];
-    fftwf_execute(planInv);
-    memcpy(smps, data2, fftsize * sizeof(float));
+        data[fftsize - i] = freqs->s[i];
+    fftwf_execute_r2r(planInv, data, data);
+    memcpy(smps, data, fftsize * sizeof(float));
+    release(data, slot);
 }
@@ -27,12 +27,16 @@
 
 #include <fftw3.h>
 
+#define FFT_BUFFERS 4 // transforms that can run at once without allocating
+
 typedef struct {
     float *s;
     float *c;
 } FFTFREQS;
 
 
+// Transforms may be run from several threads at once,
+// each gets its own work buffer.
 class FFTwrapper
 {
     public:
@@ -46,10 +50,12 @@ class FFTwrapper
     private:
         int fftsize;
         int half_fftsize;
-        float *data1;
-        float *data2;
+        float *buffer[FFT_BUFFERS];
+        int busy[FFT_BUFFERS];
         fftwf_plan planBasic;
         fftwf_plan planInv;
+        float *claim(int &slot);
+        void release(float *data, int slot);
 };
 
 #endif
@@ -0,0 +1,71 @@
+/*
+    ModDelay.cpp - modulated delay line for chorus, flange and alienwah
+
+    Copyright 2016, Will Godfrey & others
+
+    This file is part of yoshimi, which is free software: you can redistribute
+    it and/or modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either version 2 of
+    the License, or (at your option) any later version.
+
+    yoshimi is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.   See the GNU General Public License (version 2 or
+    later) for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    yoshimi; if not, write to the Free Software Foundation, Inc., 51 Franklin
+    Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <cstring>
+
+#include "Misc/SynthEngine.h"
+#include "DSP/ModDelay.h"
+
+ModDelay::ModDelay(int maxdelay, SynthEngine *_synth) :
+    pos(0),
+    synth(_synth)
+{
+    unsigned int size = 1;
+    while (size < (unsigned int)maxdelay + 2) // room for the interpolation point
+        size <<= 1;
+    mask = size - 1;
+    line = new float[size];
+    cleanup();
+}
+
+
+ModDelay::~ModDelay()
+{
+    delete [] line;
+}
+
+
+void ModDelay::cleanup(void)
+{
+    memset(line, 0, (mask + 1) * sizeof(float));
+}
+
+
+void ModDelay::trajectory(float from, float to, float *dly)
+{
+    int n = synth->p_buffersize;
+    float nf = synth->p_buffersize_f;
+    for (int i = 0; i < n; ++i)
+        dly[i] = (from * (n - i) + to * i) / nf;
+}
+
+
+void ModDelay::mixread(const float *dly, float *out, float gain, int n) const
+{
+    unsigned int newest = pos - 1 - n;
+    for (int i = 0; i < n; ++i)
+    {
+        int whole = (int)dly[i];
+        float frac = dly[i] - whole;
+        unsigned int h = newest + i - whole;
+        out[i] += gain * (line[(h - 1) & mask] * frac
+                          + line[h & mask] * (1.0f - frac));
+    }
+}
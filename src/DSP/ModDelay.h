@@ -0,0 +1,63 @@
+/*
+    ModDelay.h - modulated delay line for chorus, flange and alienwah
+
+    Copyright 2016, Will Godfrey & others
+
+    This file is part of yoshimi, which is free software: you can redistribute
+    it and/or modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either version 2 of
+    the License, or (at your option) any later version.
+
+    yoshimi is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.   See the GNU General Public License (version 2 or
+    later) for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    yoshimi; if not, write to the Free Software Foundation, Inc., 51 Franklin
+    Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef MODDELAY_H
+#define MODDELAY_H
+
+class SynthEngine;
+
+// A power of two ring, so positions wrap with a mask rather than a test.
+// Delays are in samples behind the newest sample written, 0 being the
+// newest, and may be fractional (linear interpolation).
+class ModDelay
+{
+    public:
+        ModDelay(int maxdelay, SynthEngine *_synth);
+        ~ModDelay();
+        void cleanup(void);
+
+        // per sample delays for one buffer, gliding from -> to
+        void trajectory(float from, float to, float *dly);
+
+        float tap(float dly) const;
+        float at(int dly) const { return line[(pos - 1 - dly) & mask]; }
+        void put(float smp) { line[pos++ & mask] = smp; }
+
+        // adds gain * tap(dly[i]) as it would have been read just before
+        // each of the last n put()s, for taps with no feedback
+        void mixread(const float *dly, float *out, float gain, int n) const;
+
+    private:
+        float *line;
+        unsigned int mask;
+        unsigned int pos; // next slot to be written
+        SynthEngine *synth;
+};
+
+
+inline float ModDelay::tap(float dly) const
+{
+    int whole = (int)dly;
+    float frac = dly - whole;
+    unsigned int h = pos - 1 - whole;
+    return line[(h - 1) & mask] * frac + line[h & mask] * (1.0f - frac);
+}
+
+#endif
@@ -0,0 +1,276 @@
+/*
+    WaveShaper.cpp - table driven, oversampled waveshaping
+
+    Copyright 2016, Will Godfrey & others
+
+    This file is part of yoshimi, which is free software: you can redistribute
+    it and/or modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either version 2 of
+    the License, or (at your option) any later version.
+
+    yoshimi is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.   See the GNU General Public License (version 2 or
+    later) for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    yoshimi; if not, write to the Free Software Foundation, Inc., 51 Franklin
+    Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <cmath>
+#include <cstring>
+
+#include "Misc/SynthEngine.h"
+#include "DSP/WaveShaper.h"
+
+// The half-band filter has WS_HB_HALF taps either side of the centre.
+// Every even tap except the centre one is zero, so each polyphase
+// branch is either WS_HB_PHASE taps or a plain delay.
+#define WS_HB_HALF (WS_HB_PHASE - 1)
+#define WS_UP_HIST (WS_HB_PHASE - 1)
+#define WS_UP_DELAY (WS_HB_PHASE / 2 - 1)
+#define WS_DOWN_HIST (2 * WS_HB_HALF)
+
+WaveShaper::WaveShaper(SynthEngine *_synth) :
+    shapetype(0),
+    shapedrive(0),
+    usetable(false),
+    oversampling(0),
+    tablescale(WS_TABLE_SIZE / (2.0f * WS_TABLE_RANGE)),
+    finerange(0.0f),
+    finescale(0.0f),
+    synth(_synth)
+{
+    table = new float[WS_TABLE_SIZE + 2];
+    fine = new float[WS_TABLE_SIZE + 2];
+    midpoints = new float[WS_TABLE_SIZE];
+
+    // Blackman windowed sinc, cutoff at a quarter of the oversampled rate
+    float sum = 0.0f;
+    for (int j = 0; j < WS_HB_PHASE; ++j)
+    {
+        float k = 2 * j - WS_HB_HALF; // odd tap index
+        float w = 0.42f + 0.5f * cosf(PI * k / (WS_HB_HALF + 1))
+                  + 0.08f * cosf(TWOPI * k / (WS_HB_HALF + 1));
+        hbcoeff[j] = sinf(HALFPI * k) / (PI * k) * w;
+        sum += hbcoeff[j];
+    }
+    for (int j = 0; j < WS_HB_PHASE; ++j)
+        hbcoeff[j] *= 0.5f / sum; // odd taps sum to 0.5, the centre tap is 0.5
+
+    int size = synth->buffersize;
+    for (int stage = 0; stage < WS_MAX_STAGES; ++stage)
+    {
+        for (int chan = 0; chan < WS_MAX_CHANNELS; ++chan)
+        {
+            uphist[chan][stage] = new float[WS_UP_HIST + size];
+            downhist[chan][stage] = new float[WS_DOWN_HIST + size * 2];
+        }
+        size *= 2;
+        work[stage] = new float[size];
+    }
+    cleanup();
+}
+
+
+WaveShaper::~WaveShaper()
+{
+    delete [] table;
+    delete [] fine;
+    delete [] midpoints;
+    for (int stage = 0; stage < WS_MAX_STAGES; ++stage)
+    {
+        for (int chan = 0; chan < WS_MAX_CHANNELS; ++chan)
+        {
+            delete [] uphist[chan][stage];
+            delete [] downhist[chan][stage];
+        }
+        delete [] work[stage];
+    }
+}
+
+
+void WaveShaper::cleanup(void)
+{
+    for (int stage = 0; stage < WS_MAX_STAGES; ++stage)
+        for (int chan = 0; chan < WS_MAX_CHANNELS; ++chan)
+        {
+            memset(uphist[chan][stage], 0, WS_UP_HIST * sizeof(float));
+            memset(downhist[chan][stage], 0, WS_DOWN_HIST * sizeof(float));
+        }
+}
+
+
+// Only the shapes that need a transcendental function per sample are
+// tabled, the rest are cheaper to work out directly and some of them
+// (Quantisize, Clip) have steps that interpolation would smear.
+// At high drive most of the curve is squeezed into a tiny part of the
+// middle, which gets a table of its own. If even that can't follow it
+// closely enough it's worked out exactly.
+void WaveShaper::setshape(unsigned char type, unsigned char drive)
+{
+    if (type == shapetype && drive == shapedrive)
+        return;
+    shapetype = type;
+    shapedrive = drive;
+    switch (type)
+    {
+        case 1:  // Arctangent
+        case 2:  // Asymmetric
+        case 3:  // Pow
+        case 4:  // Sine
+        case 6:  // Zigzag
+        case 14: // Sigmoid
+            usetable = true;
+            break;
+        default:
+            usetable = false;
+            return;
+    }
+    filltable(table, WS_TABLE_RANGE);
+    finerange = checktable(table, WS_TABLE_RANGE);
+    finescale = 0.0f;
+    if (finerange == 0.0f)
+        return;
+    if (finerange > WS_TABLE_RANGE)
+        finerange = WS_TABLE_RANGE;
+    filltable(fine, finerange);
+    if (checktable(fine, finerange) > 0.0f)
+    {
+        usetable = false;
+        return;
+    }
+    finescale = WS_TABLE_SIZE / (2.0f * finerange);
+}
+
+
+void WaveShaper::filltable(float *tbl, float range)
+{
+    float scale = WS_TABLE_SIZE / (2.0f * range);
+    for (int i = 0; i <= WS_TABLE_SIZE; ++i)
+        tbl[i] = i / scale - range;
+    waveShapeSmps(WS_TABLE_SIZE + 1, tbl, shapetype, shapedrive);
+    tbl[WS_TABLE_SIZE + 1] = tbl[WS_TABLE_SIZE]; // guard point
+}
+
+
+// Compares the table with the curve half way between each pair of
+// points, where interpolation is furthest out. Returns how far from
+// the middle it has to go to be close enough everywhere, 0 if it is.
+float WaveShaper::checktable(const float *tbl, float range)
+{
+    float scale = WS_TABLE_SIZE / (2.0f * range);
+    for (int i = 0; i < WS_TABLE_SIZE; ++i)
+        midpoints[i] = (i + 0.5f) / scale - range;
+    waveShapeSmps(WS_TABLE_SIZE, midpoints, shapetype, shapedrive);
+    float furthest = 0.0f;
+    for (int i = 0; i < WS_TABLE_SIZE; ++i)
+    {
+        if (fabsf(midpoints[i] - 0.5f * (tbl[i] + tbl[i + 1])) <= WS_TABLE_ERROR)
+            continue;
+        float x = fabsf((i + 0.5f) / scale - range) + 1.0f / scale;
+        if (x > furthest)
+            furthest = x;
+    }
+    return furthest;
+}
+
+
+void WaveShaper::setoversampling(unsigned char stages)
+{
+    if (stages > WS_MAX_STAGES)
+        stages = WS_MAX_STAGES;
+    if (oversampling != stages)
+    {
+        oversampling = stages;
+        cleanup();
+    }
+}
+
+
+void WaveShaper::shapesmps(int n, float *smps)
+{
+    if (!usetable)
+    {
+        waveShapeSmps(n, smps, shapetype, shapedrive);
+        return;
+    }
+    for (int i = 0; i < n; ++i)
+    {
+        if (fabsf(smps[i]) < finerange)
+        {
+            float pos = (smps[i] + finerange) * finescale;
+            int idx = (int)pos;
+            float frac = pos - idx;
+            smps[i] = fine[idx] + (fine[idx + 1] - fine[idx]) * frac;
+            continue;
+        }
+        float pos = (smps[i] + WS_TABLE_RANGE) * tablescale;
+        if (pos >= 0.0f && pos < WS_TABLE_SIZE)
+        {
+            int idx = (int)pos;
+            float frac = pos - idx;
+            smps[i] = table[idx] + (table[idx + 1] - table[idx]) * frac;
+        }
+        else // rare, and no worse than before
+            waveShapeSmps(1, smps + i, shapetype, shapedrive);
+    }
+}
+
+
+// Double the rate of 'n' samples from 'in' into 'out'
+void WaveShaper::upsample(float *hist, int n, const float *in, float *out)
+{
+    memcpy(hist + WS_UP_HIST, in, n * sizeof(float));
+    for (int i = 0; i < n; ++i)
+    {
+        const float *x = hist + i; // oldest sample needed
+        float acc = 0.0f;
+        for (int j = 0; j < WS_HB_PHASE; ++j)
+            acc += hbcoeff[j] * x[WS_UP_HIST - j];
+        out[2 * i] = acc * 2.0f;
+        out[2 * i + 1] = x[WS_UP_HIST - WS_UP_DELAY];
+    }
+    memmove(hist, hist + n, WS_UP_HIST * sizeof(float));
+}
+
+
+// Halve the rate of '2n' samples from 'in' into 'n' samples of 'out'
+void WaveShaper::downsample(float *hist, int n, const float *in, float *out)
+{
+    memcpy(hist + WS_DOWN_HIST, in, 2 * n * sizeof(float));
+    for (int i = 0; i < n; ++i)
+    {
+        const float *v = hist + 2 * i + 1; // oldest sample needed
+        float acc = 0.5f * v[WS_DOWN_HIST - WS_HB_HALF];
+        for (int j = 0; j < WS_HB_PHASE; ++j)
+            acc += hbcoeff[j] * v[WS_DOWN_HIST - 2 * j];
+        out[i] = acc;
+    }
+    memmove(hist, hist + 2 * n, WS_DOWN_HIST * sizeof(float));
+}
+
+
+void WaveShaper::process(int chan, int n, float *smps)
+{
+    if (!oversampling)
+    {
+        shapesmps(n, smps);
+        return;
+    }
+    const float *in = smps;
+    int len = n;
+    for (int stage = 0; stage < oversampling; ++stage)
+    {
+        upsample(uphist[chan][stage], len, in, work[stage]);
+        in = work[stage];
+        len *= 2;
+    }
+    shapesmps(len, work[oversampling - 1]);
+    for (int stage = oversampling - 1; stage >= 0; --stage)
+    {
+        len /= 2;
+        downsample(downhist[chan][stage], len, work[stage], (stage > 0) ? work[stage - 1] : smps);
+    }
+}
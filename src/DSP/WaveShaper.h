@@ -0,0 +1,71 @@
+/*
+    WaveShaper.h - table driven, oversampled waveshaping
+
+    Copyright 2016, Will Godfrey & others
+
+    This file is part of yoshimi, which is free software: you can redistribute
+    it and/or modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either version 2 of
+    the License, or (at your option) any later version.
+
+    yoshimi is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.   See the GNU General Public License (version 2 or
+    later) for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    yoshimi; if not, write to the Free Software Foundation, Inc., 51 Franklin
+    Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef WAVESHAPER_H
+#define WAVESHAPER_H
+
+#include "Misc/WaveShapeSamples.h"
+
+#define WS_TABLE_SIZE 8192 // intervals across the table range
+#define WS_TABLE_RANGE 4.0f // table covers -range .. +range, exact outside
+#define WS_TABLE_ERROR 1e-4f // most interpolation may be out by, else it's exact
+#define WS_HB_PHASE 16 // taps in the filtering phase of the half-band filters
+#define WS_MAX_CHANNELS 2
+#define WS_MAX_STAGES 2 // 4x
+
+class SynthEngine;
+
+class WaveShaper : private WaveShapeSamples
+{
+    public:
+        WaveShaper(SynthEngine *_synth);
+        ~WaveShaper();
+        void setshape(unsigned char type, unsigned char drive);
+        void setoversampling(unsigned char stages); // 0 = off, 1 = 2x, 2 = 4x
+        void process(int chan, int n, float *smps);
+        void cleanup(void);
+
+    private:
+        void shapesmps(int n, float *smps);
+        void filltable(float *tbl, float range);
+        float checktable(const float *tbl, float range);
+        void upsample(float *hist, int n, const float *in, float *out);
+        void downsample(float *hist, int n, const float *in, float *out);
+
+        unsigned char shapetype;
+        unsigned char shapedrive;
+        bool usetable;
+        int oversampling;
+        float *table;
+        float tablescale;
+        float *fine; // just as many points over the steep part in the middle
+        float finerange;
+        float finescale;
+        float *midpoints; // the exact curve, for checking the tables
+
+        float hbcoeff[WS_HB_PHASE]; // odd taps of the half-band filter
+        float *uphist[WS_MAX_CHANNELS][WS_MAX_STAGES];
+        float *downhist[WS_MAX_CHANNELS][WS_MAX_STAGES];
+        float *work[WS_MAX_STAGES];
+
+        SynthEngine *synth;
+};
+
+#endif
@@ -30,10 +30,12 @@ using namespace std;
 Alienwah::Alienwah(bool insertion_, float *efxoutl_, float *efxoutr_, SynthEngine *_synth) :
     Effect(insertion_, efxoutl_, efxoutr_, NULL, 0),
     lfo(_synth),
-    oldl(NULL),
-    oldr(NULL),
     synth(_synth)
 {
+    oldlre = new ModDelay(MAX_ALIENWAH_DELAY, synth);
+    oldlim = new ModDelay(MAX_ALIENWAH_DELAY, synth);
+    oldrre = new ModDelay(MAX_ALIENWAH_DELAY, synth);
+    oldrim = new ModDelay(MAX_ALIENWAH_DELAY, synth);
     setpreset(Ppreset);
     cleanup();
     oldclfol = complex<float>(fb, 0.0);
@@ -43,10 +45,10 @@ Alienwah::Alienwah(bool insertion_, float *efxoutl_, float *efxoutr_, SynthEngin
 
 Alienwah::~Alienwah()
 {
-    if (oldl != NULL)
-        delete [] oldl;
-    if (oldr != NULL)
-        delete [] oldr ;
+    delete oldlre;
+    delete oldlim;
+    delete oldrre;
+    delete oldrim;
 }
 
 
@@ -55,55 +57,61 @@ void Alienwah::out(float *smpsl, float *smpsr)
 {
     float lfol;
     float lfor; // Left/Right LFOs
-    complex<float> clfol, clfor, out, tmp;
     lfo.effectlfoout(&lfol, &lfor);
     lfol *= depth * TWOPI;
     lfor *= depth * TWOPI;
-    clfol = complex<float>(cosf(lfol + phase) * fb, sinf(lfol + phase) * fb); //rework
-    clfor = complex<float>(cosf(lfor + phase) * fb, sinf(lfor + phase) * fb); //rework
+    float clfolre = cosf(lfol + phase) * fb;
+    float clfolim = sinf(lfol + phase) * fb;
+    float clforre = cosf(lfor + phase) * fb;
+    float clforim = sinf(lfor + phase) * fb;
 
+    float dry = 1.0f - fabsf(fb);
+    float wet = 10.0f * (fb + 0.1f);
+    int back = (Pdelay > 0) ? Pdelay - 1 : 0; // read what went in Pdelay samples ago
+
+    // the complex multiplies are written out so they stay inline
     for (int i = 0; i < synth->p_buffersize; ++i)
     {
         float x = (float)i / synth->p_buffersize_f;
         float x1 = 1.0f - x;
         // left
-        tmp = clfol * x + oldclfol * x1;
-
-        out = tmp * oldl[oldk];
-        out += (1 - abs(fb)) * smpsl[i] * pangainL;
-
-        oldl[oldk] = out;
-        float l = out.real() * 10.0f * (fb + 0.1f);
+        float tre = clfolre * x + oldclfol.real() * x1;
+        float tim = clfolim * x + oldclfol.imag() * x1;
+        float ore = oldlre->at(back);
+        float oim = oldlim->at(back);
+        float outre = tre * ore - tim * oim + dry * smpsl[i] * pangainL;
+        float outim = tre * oim + tim * ore;
+        oldlre->put(outre);
+        oldlim->put(outim);
+        float l = outre * wet;
 
         // right
-        tmp = clfor * x + oldclfor * x1;
-
-        out = tmp * oldr[oldk];
-        out += (1 - abs(fb)) * smpsr[i] * pangainR;
+        tre = clforre * x + oldclfor.real() * x1;
+        tim = clforim * x + oldclfor.imag() * x1;
+        ore = oldrre->at(back);
+        oim = oldrim->at(back);
+        outre = tre * ore - tim * oim + dry * smpsr[i] * pangainR;
+        outim = tre * oim + tim * ore;
+        oldrre->put(outre);
+        oldrim->put(outim);
+        float r = outre * wet;
 
-        oldr[oldk] = out;
-        float r = out.real() * 10.0f * (fb + 0.1f);
-
-        if (++oldk >= Pdelay)
-            oldk = 0;
         // LRcross
         efxoutl[i] = l * (1.0f - lrcross) + r * lrcross;
         efxoutr[i] = r * (1.0f - lrcross) + l * lrcross;
     }
-    oldclfol = clfol;
-    oldclfor = clfor;
+    oldclfol = complex<float>(clfolre, clfolim);
+    oldclfor = complex<float>(clforre, clforim);
 }
 
 
 // Cleanup the effect
 void Alienwah::cleanup(void)
 {
-    for (int i = 0; i < Pdelay; ++i)
-    {
-        oldl[i] = complex<float>(0.0f, 0.0f);
-        oldr[i] = complex<float>(0.0f, 0.0f);
-    }
-    oldk = 0;
+    oldlre->cleanup();
+    oldlim->cleanup();
+    oldrre->cleanup();
+    oldrim->cleanup();
 }
 
 
@@ -146,13 +154,7 @@ void Alienwah::setphase(unsigned char _phase)
 
 void Alienwah::setdelay(unsigned char _delay)
 {
-    if (oldl != NULL)
-        delete [] oldl;
-    if (oldr != NULL)
-        delete [] oldr;
     Pdelay = (_delay >= MAX_ALIENWAH_DELAY) ? MAX_ALIENWAH_DELAY : _delay;
-    oldl = new complex<float>[Pdelay];
-    oldr = new complex<float>[Pdelay];
     cleanup();
 }
 
@@ -31,6 +31,7 @@ using namespace std;
 
 #include "Effects/Effect.h"
 #include "Effects/EffectLFO.h"
+#include "DSP/ModDelay.h"
 
 #define MAX_ALIENWAH_DELAY 100
 
@@ -67,9 +68,9 @@ class Alienwah : public Effect
 
         // Internal Values
         float fb, depth, phase;
-        complex<float> *oldl, *oldr;
+        ModDelay *oldlre, *oldlim; // complex feedback lines, real and imaginary
+        ModDelay *oldrre, *oldrim;
         complex<float> oldclfol, oldclfor;
-        int oldk;
 
         SynthEngine *synth;
 
@@ -30,22 +30,36 @@
 
 Chorus::Chorus(bool insertion_, float *const efxoutl_, float *efxoutr_, SynthEngine *_synth) :
     Effect(insertion_, efxoutl_, efxoutr_, NULL, 0),
+    Pvoices(0),
     lfo(_synth),
+    dl2(0.0f),
+    dr2(0.0f),
     synth(_synth)
 {
-    dlk = drk = 0;
     maxdelay = (int)(MAX_CHORUS_DELAY / 1000.0f * synth->samplerate_f);
-    delayl = new float[maxdelay];
-    delayr = new float[maxdelay];
+    delayl = new ModDelay(maxdelay, synth);
+    delayr = new ModDelay(maxdelay, synth);
+    dlyl = new float[synth->buffersize];
+    dlyr = new float[synth->buffersize];
     setpreset(Ppreset);
     changepar(1, 64);
     lfo.effectlfoout(&lfol, &lfor);
     dl2 = getdelay(lfol);
     dr2 = getdelay(lfor);
+    setvoices(Pvoices);
     cleanup();
 }
 
 
+Chorus::~Chorus()
+{
+    delete delayl;
+    delete delayr;
+    delete [] dlyl;
+    delete [] dlyr;
+}
+
+
 // get the delay value in samples; xlfo is the current lfo value
 float Chorus::getdelay(float xlfo)
 {
@@ -64,15 +78,20 @@ float Chorus::getdelay(float xlfo)
 // Apply the effect
 void Chorus::out(float *smpsl, float *smpsr)
 {
-    const float one = 1.0f;
+    float lfovl[MAX_CHORUS_VOICES], lfovr[MAX_CHORUS_VOICES];
+    for (int k = 1; k < Pvoices; ++k) // extra voices spread evenly round the lfo
+        lfo.effectlfophase((float)k / Pvoices, &lfovl[k], &lfovr[k]);
+
     dl1 = dl2;
     dr1 = dr2;
     lfo.effectlfoout(&lfol, &lfor);
 
     dl2 = getdelay(lfol);
     dr2 = getdelay(lfor);
+    delayl->trajectory(dl1, dl2, dlyl);
+    delayr->trajectory(dr1, dr2, dlyr);
 
-    float inL, inR, tmpL, tmpR, tmp;
+    float inL, inR, tmpL, tmpR;
     for (int i = 0; i < synth->p_buffersize; ++i)
     {
         tmpL = smpsl[i];
@@ -81,49 +100,43 @@ void Chorus::out(float *smpsl, float *smpsr)
         inL = tmpL * (1.0f - lrcross) + tmpR * lrcross;
         inR = tmpR * (1.0f - lrcross) + tmpL * lrcross;
 
-        // Left channel
-
-        // compute the delay in samples using linear interpolation between the lfo delays
-        mdel = (dl1 * (synth->p_buffersize - i) + dl2 * i) / synth->p_buffersize_f;
-        if (++dlk >= maxdelay)
-            dlk = 0;
-        tmp = dlk - mdel + maxdelay * 2.0f; // where should I get the sample from
-        // F2I(tmp, dlhi);
-        dlhi = (tmp > 0.0f) ? (int)truncf(tmp) : (int)truncf(tmp - 1.0f);
-        dlhi %= maxdelay;
-
-        dlhi2 = (dlhi - 1 + maxdelay) % maxdelay;
-        dllo = 1.0f - fmodf(tmp, one);
-        efxoutl[i] = delayl[dlhi2] * dllo + delayl[dlhi] * (1.0f - dllo);
-        delayl[dlk] = inL + efxoutl[i] * fb;
-
-        // Right channel
-
-        // compute the delay in samples using linear interpolation between the lfo delays
-        mdel = (dr1 * (synth->p_buffersize - i) + dr2 * i) / synth->p_buffersize_f;
-        if (++drk >= maxdelay)
-            drk = 0;
-        tmp = drk * 1.0f - mdel + maxdelay * 2.0f; // where should I get the sample from
-        // F2I(tmp, dlhi);
-        dlhi = (tmp > 0.0f) ? (int)truncf(tmp) : (int)truncf(tmp - 1.0f);
-        dlhi %= maxdelay;
-        dlhi2 = (dlhi - 1 + maxdelay) % maxdelay;
-        dllo = 1.0f - fmodf(tmp, one);
-        efxoutr[i] = delayr[dlhi2] * dllo + delayr[dlhi] * (1.0f - dllo);
-        delayr[dlk] = inR + efxoutr[i] * fb;
+        efxoutl[i] = delayl->tap(dlyl[i]);
+        delayl->put(inL + efxoutl[i] * fb);
+
+        efxoutr[i] = delayr->tap(dlyr[i]);
+        delayr->put(inR + efxoutr[i] * fb);
     }
 
-    if (Poutsub)
-        for (int i = 0; i < synth->p_buffersize; ++i)
-        {
-            efxoutl[i] *= -1.0f;
-            efxoutr[i] *= -1.0f;
-        }
+    // the extra voices only read the lines, so they can be done a buffer at a time
+    for (int k = 1; k < Pvoices; ++k)
+    {
+        float vdl = getdelay(lfovl[k]);
+        float vdr = getdelay(lfovr[k]);
+        delayl->trajectory(voicedl[k], vdl, dlyl);
+        delayr->trajectory(voicedr[k], vdr, dlyr);
+        delayl->mixread(dlyl, efxoutl, 1.0f, synth->p_buffersize);
+        delayr->mixread(dlyr, efxoutr, 1.0f, synth->p_buffersize);
+        voicedl[k] = vdl;
+        voicedr[k] = vdr;
+    }
 
+    float gainL = pangainL;
+    float gainR = pangainR;
+    if (Pvoices)
+    {
+        float voicegain = 1.0f / sqrtf(Pvoices);
+        gainL *= voicegain;
+        gainR *= voicegain;
+    }
+    if (Poutsub)
+    {
+        gainL = -gainL;
+        gainR = -gainR;
+    }
     for (int i = 0; i < synth->p_buffersize; ++i)
     {
-        efxoutl[i] *= pangainL;
-        efxoutr[i] *= pangainR;
+        efxoutl[i] *= gainL;
+        efxoutr[i] *= gainR;
     }
 }
 
@@ -131,8 +144,8 @@ void Chorus::out(float *smpsl, float *smpsr)
 // Cleanup the effect
 void Chorus::cleanup(void)
 {
-    for (int i = 0; i < maxdelay; ++i)
-        delayl[i] = delayr[i] = 0.0f;
+    delayl->cleanup();
+    delayr->cleanup();
 }
 
 
@@ -158,6 +171,21 @@ void Chorus::setfb(unsigned char Pfb_)
 }
 
 
+// extra voices start from the main delay and glide out to their own
+void Chorus::setvoices(unsigned char Pvoices_)
+{
+    if (Pvoices_ == 0)
+        Pvoices = 0;
+    else
+        Pvoices = (Pvoices_ < 3) ? 3 : (Pvoices_ > MAX_CHORUS_VOICES) ? MAX_CHORUS_VOICES : Pvoices_;
+    for (int k = 0; k < MAX_CHORUS_VOICES; ++k)
+    {
+        voicedl[k] = dl2;
+        voicedr[k] = dr2;
+    }
+}
+
+
 void Chorus::setvolume(unsigned char Pvolume_)
 {
     Pvolume = Pvolume_;
@@ -168,29 +196,29 @@ void Chorus::setvolume(unsigned char Pvolume_)
 
 void Chorus::setpreset(unsigned char npreset)
 {
-    const int PRESET_SIZE = 12;
+    const int PRESET_SIZE = 13;
     const int NUM_PRESETS = 10;
     unsigned char presets[NUM_PRESETS][PRESET_SIZE] = {
         // Chorus1
-        { 64, 64, 50, 0, 0, 90, 40, 85, 64, 119, 0, 0 },
+        { 64, 64, 50, 0, 0, 90, 40, 85, 64, 119, 0, 0, 0 },
         // Chorus2
-        {64, 64, 45, 0, 0, 98, 56, 90, 64, 19, 0, 0 },
+        {64, 64, 45, 0, 0, 98, 56, 90, 64, 19, 0, 0, 0 },
         // Chorus3
-        {64, 64, 29, 0, 1, 42, 97, 95, 90, 127, 0, 0 },
+        {64, 64, 29, 0, 1, 42, 97, 95, 90, 127, 0, 0, 0 },
         // Celeste1
-        {64, 64, 26, 0, 0, 42, 115, 18, 90, 127, 0, 0 },
+        {64, 64, 26, 0, 0, 42, 115, 18, 90, 127, 0, 0, 0 },
         // Celeste2
-        {64, 64, 29, 117, 0, 50, 115, 9, 31, 127, 0, 1 },
+        {64, 64, 29, 117, 0, 50, 115, 9, 31, 127, 0, 1, 0 },
         // Flange1
-        {64, 64, 57, 0, 0, 60, 23, 3, 62, 0, 0, 0 },
+        {64, 64, 57, 0, 0, 60, 23, 3, 62, 0, 0, 0, 0 },
         // Flange2
-        {64, 64, 33, 34, 1, 40, 35, 3, 109, 0, 0, 0 },
+        {64, 64, 33, 34, 1, 40, 35, 3, 109, 0, 0, 0, 0 },
         // Flange3
-        {64, 64, 53, 34, 1, 94, 35, 3, 54, 0, 0, 1 },
+        {64, 64, 53, 34, 1, 94, 35, 3, 54, 0, 0, 1, 0 },
         // Flange4
-        {64, 64, 40, 0, 1, 62, 12, 19, 97, 0, 0, 0 },
+        {64, 64, 40, 0, 1, 62, 12, 19, 97, 0, 0, 0, 0 },
         // Flange5
-        {64, 64, 55, 105, 0, 24, 39, 19, 17, 0, 0, 1 }
+        {64, 64, 55, 105, 0, 24, 39, 19, 17, 0, 0, 1, 0 }
     };
 
     if (npreset < 0xf)
@@ -258,6 +286,9 @@ void Chorus::changepar(int npar, unsigned char value)
         case 11:
             Poutsub = (value > 1) ? 1 : value;
             break;
+        case 12:
+            setvoices(value);
+            break;
     }
 }
 
@@ -278,6 +309,7 @@ unsigned char Chorus::getpar(int npar)
         case 9:  return Plrcross;
         case 10: return Pflangemode;
         case 11: return Poutsub;
+        case 12: return Pvoices;
         default: return 0;
     }
 }
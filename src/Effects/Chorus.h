@@ -27,6 +27,9 @@
 
 #include "Effects/Effect.h"
 #include "Effects/EffectLFO.h"
+#include "DSP/ModDelay.h"
+
+#define MAX_CHORUS_VOICES 8
 
 class SynthEngine;
 
@@ -34,7 +37,7 @@ class Chorus : public Effect
 {
     public:
         Chorus(bool insertion_, float *efxoutl_, float *efxoutr_, SynthEngine *_synth);
-        ~Chorus() { }
+        ~Chorus();
 
         void out(float *smpsl, float *smpsr);
         void setpreset(unsigned char npreset);
@@ -50,6 +53,7 @@ class Chorus : public Effect
         unsigned char Pfb;         // feedback
         unsigned char Pflangemode; // how the LFO is scaled, to result chorus or flange
         unsigned char Poutsub;     // if I wish to substract the output instead of the adding it
+        unsigned char Pvoices;     // 0 = single voice, 3 - 8 = multi-voice chorus
         EffectLFO lfo;             // lfo-ul chorus
 
 
@@ -58,6 +62,7 @@ class Chorus : public Effect
         void setdepth(unsigned char Pdepth_);
         void setdelay(unsigned char Pdelay_);
         void setfb(unsigned char Pfb_);
+        void setvoices(unsigned char Pvoices_);
         float getdelay(float xlfo);
 
         // Internal Values
@@ -71,15 +76,13 @@ class Chorus : public Effect
         float lfol;
         float lfor;
 
-        float *delayl;
-        float *delayr;
+        ModDelay *delayl;
+        ModDelay *delayr;
         int maxdelay;
-        int dlk;
-        int drk;
-        int dlhi;
-        int dlhi2;
-        float dllo;
-        float mdel;
+        float *dlyl; // delay trajectories for the current buffer
+        float *dlyr;
+        float voicedl[MAX_CHORUS_VOICES]; // extra voices, delay at end of last buffer
+        float voicedr[MAX_CHORUS_VOICES];
 
         SynthEngine *synth;
 };
@@ -36,8 +36,10 @@ Distorsion::Distorsion(bool insertion_, float *efxoutl_, float *efxoutr_, SynthE
     Phpf(0),
     Pstereo(1),
     Pprefiltering(0),
+    Poversample(0),
     synth(_synth)
 {
+    shaper = new WaveShaper(synth);
     lpfl = new AnalogFilter(2, 22000, 1, 0, synth);
     lpfr = new AnalogFilter(2, 22000, 1, 0, synth);
     hpfl = new AnalogFilter(3, 20, 1, 0, synth);
@@ -54,6 +56,7 @@ Distorsion::~Distorsion()
     delete lpfr;
     delete hpfl;
     delete hpfr;
+    delete shaper;
 }
 
 
@@ -64,6 +67,7 @@ void Distorsion::cleanup(void)
     hpfl->cleanup();
     lpfr->cleanup();
     hpfr->cleanup();
+    shaper->cleanup();
 }
 
 
@@ -99,9 +103,9 @@ void Distorsion::out(float *smpsl, float *smpsr)
     if (Pprefiltering)
         applyfilters(efxoutl, efxoutr);
 
-    waveShapeSmps(synth->p_buffersize, efxoutl, Ptype + 1, Pdrive);
+    shaper->process(0, synth->p_buffersize, efxoutl);
     if (Pstereo)
-        waveShapeSmps(synth->p_buffersize, efxoutr, Ptype + 1, Pdrive);
+        shaper->process(1, synth->p_buffersize, efxoutr);
 
     if (!Pprefiltering)
         applyfilters(efxoutl, efxoutr);
@@ -218,6 +222,7 @@ void Distorsion::changepar(int npar, unsigned char value)
 
         case 3:
             Pdrive = value;
+            shaper->setshape(Ptype + 1, Pdrive);
             break;
 
         case 4:
@@ -229,6 +234,7 @@ void Distorsion::changepar(int npar, unsigned char value)
                 Ptype = 13; // this must be increased if more distorsion types are added
             else
                 Ptype = value;
+            shaper->setshape(Ptype + 1, Pdrive);
             break;
 
         case 6:
@@ -253,6 +259,11 @@ void Distorsion::changepar(int npar, unsigned char value)
         case 10:
             Pprefiltering = value;
             break;
+
+        case 11:
+            Poversample = (value > 2) ? 2 : value;
+            shaper->setoversampling(Poversample);
+            break;
     }
 }
 
@@ -272,6 +283,7 @@ unsigned char Distorsion::getpar(int npar)
         case 8:  return Phpf;
         case 9:  return Pstereo;
         case 10: return Pprefiltering;
+        case 11: return Poversample;
         default: break;
     }
     return 0; // in case of bogus parameter number
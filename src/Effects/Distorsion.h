@@ -25,14 +25,14 @@
 #ifndef DISTORSION_H
 #define DISTORSION_H
 
-#include "Misc/WaveShapeSamples.h"
+#include "DSP/WaveShaper.h"
 #include "Misc/MiscFuncs.h"
 #include "DSP/AnalogFilter.h"
 #include "Effects/Effect.h"
 
 class SynthEngine;
 
-class Distorsion : public Effect, private MiscFuncs, WaveShapeSamples
+class Distorsion : public Effect, private MiscFuncs
 {
     public:
         Distorsion(bool insertion, float *efxoutl_, float *efxoutr_, SynthEngine *_synth);
@@ -55,6 +55,7 @@ class Distorsion : public Effect, private MiscFuncs, WaveShapeSamples
         unsigned char Phpf;          // highpass filter
         unsigned char Pstereo;       // 0 = mono, 1 = stereo
         unsigned char Pprefiltering; // if you want to do the filtering before the distorsion
+        unsigned char Poversample;   // 0 = off, 1 = 2x, 2 = 4x
 
         void setvolume(unsigned char Pvolume_);
         void setlpf(unsigned char Plpf_);
@@ -65,6 +66,7 @@ class Distorsion : public Effect, private MiscFuncs, WaveShapeSamples
         AnalogFilter *lpfr;
         AnalogFilter *hpfl;
         AnalogFilter *hpfr;
+        WaveShaper *shaper;
 
         SynthEngine *synth;
 };
@@ -60,6 +60,35 @@ void EQ::cleanup(void)
 // Effect output
 void EQ::out(float *smpsl, float *smpsr)
 {
+    // gather every active stage of both channels and run them together,
+    // unless a band is gliding between coefficient sets
+    int count = 0;
+    bool fused = true;
+    for (int i = 0; i < MAX_EQ_BANDS && fused; ++i)
+    {
+        if (filter[i].Ptype == 0)
+            continue;
+        int nl = filter[i].l->getsections(sectl + count);
+        int nr = filter[i].r->getsections(sectr + count);
+        if (nl == 0 || nl != nr)
+            fused = false;
+        count += nl;
+    }
+    if (fused)
+    {
+        AnalogFilter::cascadeout(smpsl, smpsr, efxoutl, efxoutr, sectl, sectr,
+                                 count, volume, synth->p_buffersize);
+        count = 0;
+        for (int i = 0; i < MAX_EQ_BANDS; ++i)
+        {
+            if (filter[i].Ptype == 0)
+                continue;
+            filter[i].l->putsections(sectl + count);
+            count += filter[i].r->putsections(sectr + count);
+        }
+        return;
+    }
+
     memcpy(efxoutl, smpsl, synth->p_bufferbytes);
     memcpy(efxoutr, smpsr, synth->p_bufferbytes);
     for (int i = 0; i < synth->p_buffersize; ++i)
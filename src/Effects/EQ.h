@@ -51,6 +51,8 @@ class EQ : public Effect, private MiscFuncs
             unsigned char Ptype, Pfreq, Pgain, Pq, Pstages; // parameters
             AnalogFilter *l, *r; // internal values
         } filter[MAX_EQ_BANDS];
+        AnalogFilter::section sectl[MAX_EQ_BANDS * (MAX_FILTER_STAGES + 1)];
+        AnalogFilter::section sectr[MAX_EQ_BANDS * (MAX_FILTER_STAGES + 1)];
 
         SynthEngine *synth;
 };
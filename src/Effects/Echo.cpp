@@ -27,6 +27,10 @@
 #include "Misc/SynthEngine.h"
 #include "Effects/Echo.h"
 
+#define MAX_ECHO_DELAY 1.5f   // seconds, top of the Pdelay range
+#define MAX_ECHO_LRDELAY 0.512f // seconds, top of the Plrdelay range
+#define ECHO_GLIDE_TIME 0.05f // seconds, time constant of delay time changes
+
 Echo::Echo(bool insertion_, float* efxoutl_, float* efxoutr_, SynthEngine *_synth) :
     Effect(insertion_, efxoutl_, efxoutr_, NULL, 0),
     Pvolume(50),
@@ -34,11 +38,18 @@ Echo::Echo(bool insertion_, float* efxoutl_, float* efxoutr_, SynthEngine *_synt
     Plrdelay(100),
     Pfb(40),
     Phidamp(60),
+    delay(1),
     lrdelay(0),
-    ldelay(NULL),
-    rdelay(NULL),
+    dl(1.0f),
+    dr(1.0f),
     synth(_synth)
 {
+    // the lines are sized once for the longest possible delay, so
+    // changing delay times never has to touch the heap
+    maxdelay = (int)((MAX_ECHO_DELAY + MAX_ECHO_LRDELAY) * synth->samplerate_f) + 4;
+    ldelay = new float[maxdelay];
+    rdelay = new float[maxdelay];
+    glide = 1.0f - expf(-1.0f / (ECHO_GLIDE_TIME * synth->samplerate_f));
     setpreset(Ppreset);
     changepar(4, 30); // lrcross
     cleanup();
@@ -55,31 +66,46 @@ Echo::~Echo()
 // Cleanup the effect
 void Echo::cleanup(void)
 {
-    memset(ldelay, 0, dl * sizeof(float));
-    memset(rdelay, 0, dr * sizeof(float));
+    memset(ldelay, 0, maxdelay * sizeof(float));
+    memset(rdelay, 0, maxdelay * sizeof(float));
+    kpos = 0;
+    tapl = dl; // nothing left to glide through
+    tapr = dr;
     oldl = oldr = 0.0f;
 }
 
 
-// Initialize the delays
+// Set the target delay times, the taps glide towards them in out()
 void Echo::initdelays(void)
 {
-    // todo: make this adjust insted of destroy old delays
-    kl = kr = 0;
     dl = delay - lrdelay;
     if (dl < 1)
         dl = 1;
+    else if (dl > maxdelay - 2)
+        dl = maxdelay - 2;
     dr = delay + lrdelay;
     if (dr < 1)
         dr = 1;
+    else if (dr > maxdelay - 2)
+        dr = maxdelay - 2;
+}
 
-    if (ldelay != NULL)
-        delete [] ldelay;
-    if (rdelay != NULL)
-        delete [] rdelay;
-    ldelay = new float[dl];
-    rdelay = new float[dr];
-    cleanup();
+
+// Read a delay line 'tap' samples behind the write position, linearly
+// interpolated so the delay time can change smoothly
+inline float Echo::readdelay(const float *line, float tap) const
+{
+    float rpos = kpos - tap;
+    if (rpos < 0.0f)
+        rpos += maxdelay;
+    int k0 = (int)rpos;
+    float frac = rpos - k0;
+    if (k0 >= maxdelay)
+        k0 -= maxdelay;
+    int k1 = k0 + 1;
+    if (k1 >= maxdelay)
+        k1 = 0;
+    return line[k0] + (line[k1] - line[k0]) * frac;
 }
 
 
@@ -87,12 +113,14 @@ void Echo::initdelays(void)
 void Echo::out(float* smpsl, float* smpsr)
 {
     float l, r;
-    float ldl = ldelay[kl];
-    float rdl = rdelay[kr];
+    float ldl;
+    float rdl;
     for (int i = 0; i < synth->p_buffersize; ++i)
     {
-        ldl = ldelay[kl];
-        rdl = rdelay[kr];
+        tapl += (dl - tapl) * glide;
+        tapr += (dr - tapr) * glide;
+        ldl = readdelay(ldelay, tapl);
+        rdl = readdelay(rdelay, tapr);
         l = ldl * (1.0 - lrcross) + rdl * lrcross;
         r = rdl * (1.0 - lrcross) + ldl * lrcross;
         ldl = l;
@@ -105,15 +133,13 @@ void Echo::out(float* smpsl, float* smpsr)
         rdl = smpsr[i] * pangainR - rdl * fb;
 
         // LowPass Filter
-        ldelay[kl] = ldl = ldl * hidamp + oldl * (1.0f - hidamp);
-        rdelay[kr] = rdl = rdl * hidamp + oldr * (1.0f - hidamp);
+        ldelay[kpos] = ldl = ldl * hidamp + oldl * (1.0f - hidamp);
+        rdelay[kpos] = rdl = rdl * hidamp + oldr * (1.0f - hidamp);
         oldl = ldl;
         oldr = rdl;
 
-        if (++kl >= dl)
-            kl = 0;
-        if (++kr >= dr)
-            kr = 0;
+        if (++kpos >= maxdelay)
+            kpos = 0;
     }
 }
 
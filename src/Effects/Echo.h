@@ -59,15 +59,19 @@ class Echo : public Effect
 
         // Real Parameters
         float fb, hidamp;
-        int dl, dr, delay, lrdelay;
+        int delay, lrdelay;
+        float dl, dr;     // target delay times in samples
+        float tapl, tapr; // current (gliding) delay times in samples
+        float glide;
 
         void initdelays(void);
+        float readdelay(const float *line, float tap) const;
         float *ldelay;
         float *rdelay;
+        int maxdelay;
+        int kpos;
         float  oldl, oldr; // pt. lpf
 
-        int kl, kr;
-
         SynthEngine *synth;
 };
 
@@ -26,8 +26,9 @@
 #define EFFECT_H
 
 #include "Params/FilterParams.h"
+#include "Synth/Carcass.h"
 
-class Effect
+class Effect : public Carcass
 {
     public:
         Effect(bool insertion_, float *efxoutl_, float *efxoutr_,
@@ -121,3 +121,20 @@ void EffectLFO::effectlfoout(float *outl, float *outr)
     }
     *outr = (out + 1.0f) * 0.5f;
 }
+
+
+// LFO output at a phase offset from the current position, without moving on
+void EffectLFO::effectlfophase(float offset, float *outl, float *outr)
+{
+    float x = fmodf(xl + offset, 1.0f);
+    float out = getlfoshape(x);
+    if (lfotype == 0 || lfotype == 1)
+        out *= (ampl1 + x * (ampl2 - ampl1));
+    *outl = (out + 1.0f) * 0.5f;
+
+    x = fmodf(xr + offset, 1.0f);
+    out = getlfoshape(x);
+    if (lfotype == 0 || lfotype == 1)
+        out *= (ampr1 + x * (ampr2 - ampr1));
+    *outr = (out + 1.0f) * 0.5f;
+}
@@ -33,6 +33,7 @@ class EffectLFO
         EffectLFO(SynthEngine *_synth);
         ~EffectLFO();
         void effectlfoout(float *outl, float *outr);
+        void effectlfophase(float offset, float *outl, float *outr);
         void updateparams(void);
         unsigned char Pfreq;
         unsigned char Prandomness;
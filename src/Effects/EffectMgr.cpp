@@ -25,6 +25,7 @@
 #include <fftw3.h>
 
 #include "Misc/SynthEngine.h"
+#include "Synth/BodyDisposal.h"
 #include "Effects/EffectMgr.h"
 
 EffectMgr::EffectMgr(const bool insertion_, SynthEngine *_synth) :
@@ -33,9 +34,17 @@ EffectMgr::EffectMgr(const bool insertion_, SynthEngine *_synth) :
     filterpars(NULL),
     nefx(0),
     efx(NULL),
-    dryonly(false)
+    dryonly(false),
+    wantedefx(0),
+    pendingnefx(0),
+    pendingefx(NULL),
+    swapped(0),
+    queuedfor(0),
+    queuedpreset(-1)
 {
     setpresettype("Peffect");
+    for (int n = 0; n < EFFECT_PARS; ++n)
+        queuedpar[n] = -1;
     efxoutl = (float*)fftwf_malloc(synth->bufferbytes);
     efxoutr = (float*)fftwf_malloc(synth->bufferbytes);
     memset(efxoutl, 0, synth->bufferbytes);
@@ -48,6 +57,8 @@ EffectMgr::~EffectMgr()
 {
     if (efx)
         delete efx;
+    if (pendingefx)
+        delete pendingefx;
     fftwf_free(efxoutl);
     fftwf_free(efxoutr);
 }
@@ -60,65 +71,195 @@ void EffectMgr::defaults(void)
 }
 
 
-// Change the effect
-void EffectMgr::changeeffect(int _nefx)
+// Build a new effect instance, with its default preset applied.
+// It only refers to our output buffers so can be done on any thread.
+Effect *EffectMgr::makeeffect(int type)
 {
-    cleanup();
-    if (nefx == _nefx)
-        return;
-    nefx = _nefx;
-    memset(efxoutl, 0, synth->bufferbytes);
-    memset(efxoutr, 0, synth->bufferbytes);
-    if (efx)
-        delete efx;
-    switch (nefx)
+    switch (type)
     {
         case 1:
-            efx = new Reverb(insertion, efxoutl, efxoutr, synth);
-            break;
+            return new Reverb(insertion, efxoutl, efxoutr, synth);
 
         case 2:
-            efx = new Echo(insertion, efxoutl, efxoutr, synth);
-            break;
+            return new Echo(insertion, efxoutl, efxoutr, synth);
 
         case 3:
-            efx = new Chorus(insertion, efxoutl, efxoutr, synth);
-            break;
+            return new Chorus(insertion, efxoutl, efxoutr, synth);
 
         case 4:
-            efx = new Phaser(insertion, efxoutl, efxoutr, synth);
-            break;
+            return new Phaser(insertion, efxoutl, efxoutr, synth);
 
         case 5:
-            efx = new Alienwah(insertion, efxoutl, efxoutr, synth);
-            break;
+            return new Alienwah(insertion, efxoutl, efxoutr, synth);
 
         case 6:
-            efx = new Distorsion(insertion, efxoutl, efxoutr, synth);
-            break;
+            return new Distorsion(insertion, efxoutl, efxoutr, synth);
 
         case 7:
-            efx = new EQ(insertion, efxoutl, efxoutr, synth);
-            break;
+            return new EQ(insertion, efxoutl, efxoutr, synth);
 
         case 8:
-            efx = new DynamicFilter(insertion, efxoutl, efxoutr, synth);
-            break;
+            return new DynamicFilter(insertion, efxoutl, efxoutr, synth);
 
             // put more effect here
         default:
-            efx = NULL;
             break; // no effect (thru)
     }
+    return NULL;
+}
+
+
+// Change the effect immediately.
+// Only for use with the engine locked and muted (loading, defaults, GUI)
+void EffectMgr::changeeffect(int _nefx)
+{
+    cleanup();
+    Effect *stale = __sync_lock_test_and_set(&pendingefx, (Effect*)NULL);
+    if (stale)
+        delete stale;
+    wantedefx = _nefx;
+    queuedfor = 0;
+    if (nefx == _nefx)
+        return;
+    nefx = _nefx;
+    memset(efxoutl, 0, synth->bufferbytes);
+    memset(efxoutr, 0, synth->bufferbytes);
+    if (efx)
+        delete efx;
+    efx = makeeffect(nefx);
     if (efx)
         filterpars = efx->filterpars;
 }
 
 
-// Obtain the effect number
+// Change the effect without stalling the audio thread.
+// The new instance is built by the RBP thread in prepareeffect() and
+// swapped in by the engine at the start of a buffer, whether or not
+// this slot is in use. Safe to call from the audio and MIDI threads.
+void EffectMgr::requesteffect(int _nefx)
+{
+    wantedefx = _nefx;
+    __sync_synchronize();
+    if (_nefx != nefx)
+    {
+        if (_nefx != 0)
+            synth->writeRBP(6, 0, 0);
+        else
+            synth->effectsWaiting(); // nothing to build
+    }
+}
+
+
+// Called from the RBP thread
+void EffectMgr::prepareeffect(void)
+{
+    int wanted = wantedefx;
+    if (wanted == 0 || wanted == nefx || pendingefx != NULL)
+        return;
+    Effect *fresh = makeeffect(wanted);
+    if (!fresh)
+        return;
+    pendingnefx = wanted;
+    if (!__sync_bool_compare_and_swap(&pendingefx, (Effect*)NULL, fresh))
+        delete fresh; // can't happen with only one builder
+    else
+        synth->effectsWaiting();
+}
+
+
+// Pass a finished effect to the disposal thread
+void EffectMgr::retireeffect(Effect *old)
+{
+    if (old)
+        synth->getRuntime().deadObjects->addBody(old);
+}
+
+
+// Block boundary, from SynthEngine::swapEffects() with the engine locked:
+// put in place whatever requesteffect() asked for
+void EffectMgr::swapeffect(void)
+{
+    if (wantedefx == nefx)
+        return;
+    if (pendingefx)
+    {   // the type can't change while the slot is full
+        int type = pendingnefx;
+        Effect *fresh = __sync_lock_test_and_set(&pendingefx, (Effect*)NULL);
+        if (type != wantedefx)
+        {   // overtaken by a later request
+            retireeffect(fresh);
+            if (wantedefx != 0)
+                synth->writeRBP(6, 0, 0);
+            return;
+        }
+        retireeffect(efx);
+        efx = fresh;
+        nefx = type;
+        filterpars = efx->filterpars;
+        memset(efxoutl, 0, synth->bufferbytes);
+        memset(efxoutr, 0, synth->bufferbytes);
+        applyqueued();
+    }
+    else if (wantedefx == 0)
+    {
+        retireeffect(efx);
+        efx = NULL;
+        nefx = 0;
+        filterpars = NULL;
+        queuedfor = 0;
+    }
+    else
+        return;
+    __sync_or_and_fetch(&swapped, 1);
+    synth->writeRBP(8, 0, 0); // the GUI is told from there
+}
+
+
+// True if a change now is for a type that isn't running yet,
+// which must then be queued. Always with the engine locked.
+bool EffectMgr::queuechange(void)
+{
+    int wanted = wantedefx;
+    if (wanted == nefx)
+        return false;
+    if (queuedfor != wanted)
+    {
+        queuedfor = wanted;
+        queuedpreset = -1;
+        for (int n = 0; n < EFFECT_PARS; ++n)
+            queuedpar[n] = -1;
+    }
+    return true;
+}
+
+
+void EffectMgr::applyqueued(void)
+{
+    if (queuedfor != nefx)
+    {
+        queuedfor = 0;
+        return;
+    }
+    queuedfor = 0;
+    if (queuedpreset >= 0)
+        efx->setpreset(queuedpreset);
+    for (int n = 0; n < EFFECT_PARS; ++n)
+        if (queuedpar[n] >= 0)
+            efx->changepar(n, queuedpar[n]);
+}
+
+
+// Obtain the effect number, including one waiting to be swapped in
 int EffectMgr::geteffect(void)
 {
-    return (nefx);
+    return (wantedefx);
+}
+
+
+// The type asked for that isn't running yet, or -1
+int EffectMgr::requestedeffect(void)
+{
+    return (wantedefx != nefx) ? wantedefx : -1;
 }
 
 
@@ -133,6 +274,8 @@ void EffectMgr::cleanup(void)
 // Get the preset of the current effect
 unsigned char EffectMgr::getpreset(void)
 {
+    if (queuedfor != 0 && queuedfor == wantedefx && queuedpreset >= 0)
+        return queuedpreset;
     if (efx)
         return efx->Ppreset;
     else
@@ -143,6 +286,13 @@ unsigned char EffectMgr::getpreset(void)
 // Change the preset of the current effect
 void EffectMgr::changepreset_nolock(unsigned char npreset)
 {
+    if (queuechange())
+    {   // a preset replaces any parameters set before it
+        queuedpreset = npreset;
+        for (int n = 0; n < EFFECT_PARS; ++n)
+            queuedpar[n] = -1;
+        return;
+    }
     if (efx)
         efx->setpreset(npreset);
 }
@@ -160,6 +310,12 @@ void EffectMgr::changepreset(unsigned char npreset)
 // Change a parameter of the current effect
 void EffectMgr::seteffectpar_nolock(int npar, unsigned char value)
 {
+    if (queuechange())
+    {
+        if (npar >= 0 && npar < EFFECT_PARS)
+            queuedpar[npar] = value;
+        return;
+    }
     if (!efx)
         return;
     efx->changepar(npar, value);
@@ -178,6 +334,9 @@ void EffectMgr::seteffectpar(int npar, unsigned char value)
 // Get a parameter of the current effect
 unsigned char EffectMgr::geteffectpar(int npar)
 {
+    if (queuedfor != 0 && queuedfor == wantedefx && npar >= 0 && npar < EFFECT_PARS
+        && queuedpar[npar] >= 0)
+        return queuedpar[npar];
     if (!efx)
         return 0;
     return efx->getpar(npar);
@@ -277,9 +436,9 @@ void EffectMgr::setdryonly(bool value)
 
 void EffectMgr::add2XML(XMLwrapper *xml)
 {
-    xml->addpar("type", geteffect());
+    xml->addpar("type", nefx);
 
-    if (!efx || !geteffect())
+    if (!efx || !nefx)
         return;
     xml->addpar("preset", efx->Ppreset);
 
@@ -38,6 +38,8 @@
 #include "Params/FilterParams.h"
 #include "Params/Presets.h"
 
+#define EFFECT_PARS 128
+
 class SynthEngine;
 
 class EffectMgr : public Presets
@@ -59,7 +61,12 @@ class EffectMgr : public Presets
         void cleanup(void);
 
         void changeeffect(int nefx_);
+        void requesteffect(int nefx_);
+        void prepareeffect(void);
         int geteffect(void);
+        int requestedeffect(void);
+        bool takeswapped(void) { return __sync_fetch_and_and(&swapped, 0); }
+        void swapeffect(void);
         void changepreset(unsigned char npreset);
         void changepreset_nolock(unsigned char npreset);
         unsigned char getpreset(void);
@@ -78,9 +85,26 @@ class EffectMgr : public Presets
         FilterParams *filterpars;
 
     private:
-        int nefx;
+        Effect *makeeffect(int type);
+        void retireeffect(Effect *old);
+
+        int nefx;       // type of the running effect
         Effect *efx;
         bool dryonly;
+
+        // hot-swap hand over, see requesteffect()
+        int wantedefx;
+        int pendingnefx;
+        Effect *volatile pendingefx;
+        int swapped; // the GUI hasn't been told yet
+
+        // preset and parameter changes made before the wanted
+        // type is running, put on it as it's swapped in
+        int queuedfor; // type they are for, 0 if none
+        int queuedpreset; // -1 if none
+        int queuedpar[EFFECT_PARS]; // -1 if none
+        bool queuechange(void);
+        void applyqueued(void);
 };
 
 #endif
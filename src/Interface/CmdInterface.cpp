@@ -80,6 +80,10 @@ string basics[] = {
     "  SCale <s>",                  "current scale settings to named file",
     "  VEctor <{Channel}n> <s>",    "vector on channel n to named file",
     "  Setup",                      "dynamic settings",
+    "CONVert",                      "rewrite instrument files in place",
+    "  Binary <s>",                 "all instruments in directory s to binary",
+    "  Xml <s>",                    "all instruments in directory s back to xml",
+    "RESCan",                       "check every bank root again, ignoring the index",
     "ADD",                          "add paths and files",
     "  Root <s>",                   "root path to list",
     "  Bank <s>",                   "bank to current root",
@@ -170,7 +174,8 @@ string replies [] = {
     "Unrecognised",
     "Parameter?",
     "Not at this level",
-    "Not available"
+    "Not available",
+    "Failed"
 };
 
 string fx_list [] = {
@@ -891,6 +896,7 @@ int CmdInterface::commandPart(bool justSet)
         return tmp;
     if (matchnMove(2, point, "enable"))
     {
+        synth->part[npart]->materialise();
         synth->partonoffLock(npart, 1);
         Runtime.Log("Part enabled");
         GuiThreadMsg::sendMessage(synth, GuiThreadMsg::UpdatePanelItem, npart);
@@ -975,6 +981,7 @@ int CmdInterface::commandPart(bool justSet)
             dest = 3;
         if (dest > 0)
         {
+            synth->part[npart]->materialise();
             synth->partonoffWrite(npart, 1);
             synth->SetPartDestination(npart, dest);
             reply = done_msg;
@@ -1998,6 +2005,7 @@ bool CmdInterface::cmdIfaceProcessCommand()
             else
             {
                 synth->microtonal.loadXML((string) point);
+                synth->xmlMicrotonal.touch();
                 reply = done_msg;
             }
         }
@@ -2109,6 +2117,38 @@ bool CmdInterface::cmdIfaceProcessCommand()
             replyString = "save";
             reply = what_msg;
         }
+    else if (matchnMove(4, point, "convert"))
+    {
+        int toBinary = -1;
+        if (matchnMove(1, point, "binary"))
+            toBinary = 1;
+        else if (matchnMove(1, point, "xml"))
+            toBinary = 0;
+        if (toBinary < 0)
+        {
+            replyString = "convert";
+            reply = what_msg;
+        }
+        else if (point[0] == 0)
+            reply = name_msg;
+        else
+        {
+            int count = synth->getBankRef().convertBankDir((string) point, toBinary == 1);
+            if (count >= 0)
+            {
+                Runtime.Log("Converted " + asString(count) + " instruments in " + (string) point);
+                reply = done_msg;
+            }
+            else
+                reply = failed_msg;
+        }
+    }
+    else if (matchnMove(4, point, "rescan"))
+    {
+        synth->getBankRef().rescanforbanks(true);
+        Runtime.Log("Rescanned all bank roots");
+        reply = done_msg;
+    }
     else if (matchnMove(6, point, "direct"))
     {
         float value;
@@ -2169,6 +2209,8 @@ bool CmdInterface::cmdIfaceProcessCommand()
         putData.data.insert = insert;
         putData.data.parameter = param;
         putData.data.par2 = par2;
+        if (part < NUM_MIDI_PARTS && kit < 0x20)
+            synth->part[part]->materialise(); // here, rather than on the worker
         if (jack_ringbuffer_write_space(synth->interchange.fromCLI) >= commandSize)
             jack_ringbuffer_write(synth->interchange.fromCLI, (char*) putData.bytes, commandSize);
 
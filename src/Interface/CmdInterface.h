@@ -33,7 +33,7 @@ extern map<SynthEngine *, MusicClient *> synthInstances;
 // all_fx and ins_fx MUST be the first two
 typedef enum { all_fx = 0, ins_fx, vect_lev, part_lev, } level_bits;
 
-typedef enum { todo_msg = 0, done_msg, value_msg, name_msg, opp_msg, what_msg, range_msg, low_msg, high_msg, unrecognised_msg, parameter_msg, level_msg, available_msg,} error_messages;
+typedef enum { todo_msg = 0, done_msg, value_msg, name_msg, opp_msg, what_msg, range_msg, low_msg, high_msg, unrecognised_msg, parameter_msg, level_msg, available_msg, failed_msg,} error_messages;
 
 class CmdInterface : private MiscFuncs
 {
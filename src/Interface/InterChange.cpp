@@ -23,6 +23,7 @@
 #include <cfloat>
 #include <bitset>
 #include <unistd.h>
+#include <time.h>
 
 using namespace std;
 
@@ -41,8 +42,17 @@ using namespace std;
 #include "Synth/OscilGen.h"
 
 InterChange::InterChange(SynthEngine *_synth) :
+    commandWorkerHandle(0),
+    CLIresolvethreadHandle(0),
+    guiDropped(0),
+    cliDropped(0),
     synth(_synth)
 {
+    for (int src = 0; src < MEDIATE_SOURCES; ++src)
+    {
+        batch[src].count = batch[src].next = 0;
+        workerSent[src] = workerDone[src] = 0;
+    }
     if (!(fromCLI = jack_ringbuffer_create(sizeof(commandSize) * 256)))
     {
         fromCLI = NULL;
@@ -82,10 +92,31 @@ InterChange::InterChange(SynthEngine *_synth) :
     else
          jack_ringbuffer_reset(fromMIDI);
 
+    if (!(toWorker = jack_ringbuffer_create(sizeof(workerJob) * 256)))
+    {
+        toWorker = NULL;
+        synth->getRuntime().Log("InterChange failed to create 'toWorker' ringbuffer");
+    }
+    else
+         jack_ringbuffer_reset(toWorker);
+
+    if (!(fromWorker = jack_ringbuffer_create(sizeof(commandSize) * 256)))
+    {
+        fromWorker = NULL;
+        synth->getRuntime().Log("InterChange failed to create 'fromWorker' ringbuffer");
+    }
+    else
+         jack_ringbuffer_reset(fromWorker);
+
     if (!synth->getRuntime().startThread(&CLIresolvethreadHandle, _CLIresolvethread, this, false, 0, false, "CLI"))
     {
         synth->getRuntime().Log("Failed to start CLI resolve thread");
     }
+
+    if (!synth->getRuntime().startThread(&commandWorkerHandle, _commandWorker, this, false, 0, false, "Worker"))
+    {
+        synth->getRuntime().Log("Failed to start command worker thread");
+    }
 }
 
 
@@ -102,6 +133,9 @@ void *InterChange::CLIresolvethread(void)
     char *point;
     while(synth->getRuntime().runSynth)
     {
+        // the snapshot first, anything in the ringbuffer is newer
+        while (cliSnapshot.fetch(&getData))
+            resolveReplies(&getData);
         while (jack_ringbuffer_read_space(synth->interchange.toCLI)  >= synth->interchange.commandSize)
         {
             toread = commandSize;
@@ -109,12 +143,122 @@ void *InterChange::CLIresolvethread(void)
             jack_ringbuffer_read(toCLI, point, toread);
             resolveReplies(&getData);
         }
-        usleep(10000);
+        unsigned int lost = __sync_fetch_and_and(&guiDropped, 0);
+        if (lost)
+            synth->getRuntime().Log("GUI update buffer full, " + asString(lost) + " updates lost");
+        lost = __sync_fetch_and_and(&cliDropped, 0);
+        if (lost)
+            synth->getRuntime().Log("CLI reply buffer full, " + asString(lost) + " replies lost");
+        CLIwake.wait(-1);
     }
     return NULL;
 }
 
 
+void *InterChange::_commandWorker(void *arg)
+{
+    return static_cast<InterChange*>(arg)->commandWorker();
+}
+
+
+// Runs the commands mediate() passes on, then hands each one back so
+// the replies still go out from the audio thread. Anything slow is made
+// without the lock, which is only held to store or swap the result.
+void *InterChange::commandWorker(void)
+{
+    workerJob job;
+    CommandBlock &getData = job.block;
+    FFTwrapper *fft = NULL; // our own, made once the sizes are known
+    OscilGen *spare = NULL;
+    while(synth->getRuntime().runSynth)
+    {
+        while (jack_ringbuffer_read_space(toWorker) >= sizeof(workerJob))
+        {
+            jack_ringbuffer_read(toWorker, (char*) &job, sizeof(workerJob));
+            unsigned char npart = getData.data.part;
+            if (npart == 0xd8) // midi-learn list
+            {   // midi only sees the index, the list has its own lock
+                synth->midilearn.changeLine(getData.data.value, getData.data.type, getData.data.control, getData.data.part, getData.data.kit, getData.data.engine, getData.data.insert, getData.data.parameter, getData.data.par2);
+                __sync_add_and_fetch(&workerDone[job.source], 1);
+                continue; // nothing to return
+            }
+            if (npart < NUM_MIDI_PARTS && getData.data.kit < 0x20)
+                synth->part[npart]->materialise();
+            if (getData.data.engine == 2 && getData.data.insert == 0xff && getData.data.control == 104)
+                setpadparams(npart | (getData.data.kit << 8)); // takes its own locks
+            else
+            {
+                synth->actionLock(lock);
+                commandSend(&getData);
+                synth->actionLock(unlock);
+                OscilGen *oscil = findOscil(&getData);
+                if (oscil)
+                {
+                    if (!spare)
+                    {
+                        fft = new FFTwrapper(synth->oscilsize);
+                        spare = new OscilGen(fft, NULL, synth);
+                    }
+                    oscil->prepareinto(spare);
+                    synth->actionLock(lock);
+                    oscil->takeprepared(spare);
+                    synth->actionLock(unlock);
+                }
+            }
+            while (jack_ringbuffer_write_space(fromWorker) < commandSize && synth->getRuntime().runSynth)
+                usleep(1000); // only if the audio thread has stopped taking them
+            jack_ringbuffer_write(fromWorker, (char*) getData.bytes, commandSize);
+            __sync_add_and_fetch(&workerDone[job.source], 1);
+        }
+        workerWake.wait(-1);
+    }
+    if (spare)
+        delete spare;
+    if (fft)
+        delete fft;
+    return NULL;
+}
+
+
+// The oscillator a worker command has just changed, if any
+OscilGen *InterChange::findOscil(CommandBlock *getData)
+{
+    unsigned char npart = getData->data.part;
+    unsigned char kititem = getData->data.kit;
+    unsigned char engine = getData->data.engine;
+    unsigned char insert = getData->data.insert;
+
+    if (!(getData->data.type & 0x40) || npart >= NUM_MIDI_PARTS || kititem >= NUM_KIT_ITEMS)
+        return NULL;
+    if (insert < 5 || insert > 7)
+        return NULL;
+    Part *part = synth->part[npart];
+    if (kititem != 0 && !part->kit[kititem].Penabled)
+        return NULL;
+    if (engine == 2)
+        return part->kit[kititem].padpars->oscilgen;
+    if (engine >= 0xC0)
+        return part->kit[kititem].adpars->VoicePar[engine & 0x1f].FMSmp;
+    if (engine >= 0x80)
+        return part->kit[kititem].adpars->VoicePar[engine & 0x1f].OscilSmp;
+    return NULL;
+}
+
+
+// runSynth must already be false
+void InterChange::stopThreads(void)
+{
+    CLIwake.post();
+    workerWake.post();
+    if (CLIresolvethreadHandle)
+        pthread_join(CLIresolvethreadHandle, NULL);
+    if (commandWorkerHandle)
+        pthread_join(commandWorkerHandle, NULL);
+    CLIresolvethreadHandle = 0;
+    commandWorkerHandle = 0;
+}
+
+
 InterChange::~InterChange()
 {
     if (fromCLI)
@@ -142,6 +286,16 @@ InterChange::~InterChange()
         jack_ringbuffer_free(fromMIDI);
         fromGUI = NULL;
     }
+    if (toWorker)
+    {
+        jack_ringbuffer_free(toWorker);
+        toWorker = NULL;
+    }
+    if (fromWorker)
+    {
+        jack_ringbuffer_free(fromWorker);
+        fromWorker = NULL;
+    }
 }
 
 
@@ -1937,67 +2091,201 @@ string InterChange::resolveEffects(CommandBlock *getData)
 
 void InterChange::mediate()
 {
+    jack_ringbuffer_t *source[MEDIATE_SOURCES] = { fromCLI, fromGUI, fromMIDI };
+
+    // about a quarter of a period, anything left waits for the next one
+    long budget = 250000000L / synth->samplerate * synth->buffersize; // ns
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // finished by the worker, only the replies are left to do
     CommandBlock getData;
-    size_t commandSize = sizeof(getData);
+    while (jack_ringbuffer_read_space(fromWorker) >= commandSize)
+    {
+        jack_ringbuffer_read(fromWorker, (char*) getData.bytes, commandSize);
+        returns(&getData);
+    }
+
+    int done = 0;
+    int rounds = 0;
     bool more;
-    size_t size;
-    int toread;
-    char *point;
     do
     {
         more = false;
-        size = jack_ringbuffer_read_space(fromCLI);
-        if (size >= commandSize)
+        for (int src = 0; src < MEDIATE_SOURCES; ++src)
         {
-            if (size > commandSize)
-                more = true;
-            toread = commandSize;
-            point = (char*) &getData.bytes;
-            jack_ringbuffer_read(fromCLI, point, toread);
-            if(getData.data.part != 0xd8) // special midi-learn message
-            {
-                commandSend(&getData);
-                returns(&getData);
-            }
-            else
-                synth->midilearn.changeLine(getData.data.value, getData.data.type, getData.data.control, getData.data.part, getData.data.kit, getData.data.engine, getData.data.insert, getData.data.parameter, getData.data.par2);
+            mediateBatch *pending = &batch[src];
+            if (pending->next >= pending->count && !fetchBatch(source[src], pending, src == 1))
+                continue;
+            if (!runCommand(&pending->block[pending->next], src))
+                continue; // worker queue full, try again next period
+            ++pending->next;
+            ++done;
+            more = true;
         }
-
-        size = jack_ringbuffer_read_space(fromGUI);
-        if (size >= commandSize)
+        if (more && (++rounds & 7) == 0)
         {
-            if (size > commandSize)
-                more = true;
-            toread = commandSize;
-            point = (char*) &getData.bytes;
-            jack_ringbuffer_read(fromGUI, point, toread);
-            #warning gui writes changed to reads
-            getData.data.type = getData.data.type & 0xbf;
-            if(getData.data.part != 0xd8) // special midi-learn message
-            {
-                commandSend(&getData);
-                returns(&getData);
-            }
-            else
-                synth->midilearn.changeLine(getData.data.value, getData.data.type, getData.data.control, getData.data.part, getData.data.kit, getData.data.engine, getData.data.insert, getData.data.parameter, getData.data.par2);
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            if ((now.tv_sec - start.tv_sec) * 1000000000L + (now.tv_nsec - start.tv_nsec) > budget)
+                break;
         }
+    }
+    while (more && done < MEDIATE_MAX_COMMANDS);
 
-        size = jack_ringbuffer_read_space(fromMIDI);
-        if (size >= commandSize)
+    guiSnapshot.flip();
+    if (cliSnapshot.flip())
+        CLIwake.post();
+}
+
+
+// Take whatever is waiting (up to a batch) and drop any command
+// that a later one in the same batch makes redundant.
+bool InterChange::fetchBatch(jack_ringbuffer_t *source, mediateBatch *pending, bool fromGui)
+{
+    pending->count = 0;
+    pending->next = 0;
+    int count = jack_ringbuffer_read_space(source) / commandSize;
+    if (count == 0)
+        return false;
+    if (count > MEDIATE_BATCH)
+        count = MEDIATE_BATCH;
+    jack_ringbuffer_read(source, (char*) pending->block, count * commandSize);
+
+    bool superseded[MEDIATE_BATCH];
+    int kept = count;
+    for (int i = 0; i < count; ++i)
+    {
+        superseded[i] = false;
+        CommandBlock *getData = &pending->block[i];
+        if (!coalescable(getData))
+            continue;
+        for (int j = i + 1; j < count; ++j)
         {
-            if (size > commandSize)
-                more = true;
-            toread = commandSize;
-            point = (char*) &getData.bytes;
-            jack_ringbuffer_read(fromMIDI, point, toread);
-            if(getData.data.part != 0xd8) // special midi-learn message
+            CommandBlock *later = &pending->block[j];
+            if (later->data.type == getData->data.type
+                && later->data.control == getData->data.control
+                && later->data.part == getData->data.part
+                && later->data.kit == getData->data.kit
+                && later->data.engine == getData->data.engine
+                && later->data.insert == getData->data.insert
+                && later->data.parameter == getData->data.parameter
+                && later->data.par2 == getData->data.par2
+                && coalescable(later))
             {
-                commandSend(&getData);
-                returns(&getData);
+                superseded[i] = true;
+                --kept;
+                break;
             }
         }
     }
-    while (more);
+    if (kept < count)
+    {
+        int to = 0;
+        for (int from = 0; from < count; ++from)
+            if (!superseded[from])
+                pending->block[to++] = pending->block[from];
+    }
+    pending->count = kept;
+
+    // after, as coalescable() needs to see they were writes
+    #warning gui writes changed to reads
+    if (fromGui)
+        for (int i = 0; i < kept; ++i)
+            pending->block[i].data.type = pending->block[i].data.type & 0xbf;
+    return true;
+}
+
+
+/*
+ * Only plain value writes, where the last value is all that matters.
+ * Reads each need their reply, and buttons, presets, type changes and
+ * enables do something every time, which later commands may rely on.
+ */
+bool InterChange::coalescable(CommandBlock *getData)
+{
+    if (getData->data.value == FLT_MAX || !(getData->data.type & 0x40))
+        return false; // limits and reads
+    unsigned char control = getData->data.control;
+    unsigned char npart = getData->data.part;
+    unsigned char kititem = getData->data.kit;
+    unsigned char engine = getData->data.engine;
+    unsigned char insert = getData->data.insert;
+
+    if (npart == 0xf1 || npart == 0xf2)
+    {
+        if (kititem == 0xff)
+            return !(insert == 0xff && control == 1); // effect type
+    }
+    else if (npart >= NUM_MIDI_PARTS)
+        return false;
+    if (kititem >= 0x80 && kititem != 0xff)
+        return control != 16; // effect preset
+    if (kititem == 0xff || (kititem & 0x20))
+        return control != 8 && control != 65 && control != 224; // enables, effect type, reset controllers
+    if (engine != 1 && (insert == 5 || insert == 8))
+        return control < 96; // oscillator and resonance buttons
+    if (engine == 2 && insert == 0xff)
+        return control != 104; // PAD apply
+    return true;
+}
+
+
+bool InterChange::runCommand(CommandBlock *getData, int src)
+{
+    if (getData->data.part == 0xd8 && src == 2 && getData->data.control != 21)
+        return true; // special midi-learn message, only 'learned' taken from MIDI
+    // while the worker has any of this source's commands the rest
+    // follow them there, so nothing overtakes what went before
+    if (workerSent[src] != __sync_add_and_fetch(&workerDone[src], 0) || needsWorker(getData))
+    {
+        if (jack_ringbuffer_write_space(toWorker) < sizeof(workerJob))
+            return false;
+        workerJob job;
+        job.block = *getData;
+        job.source = src;
+        jack_ringbuffer_write(toWorker, (char*) &job, sizeof(workerJob));
+        ++ workerSent[src];
+        workerWake.post();
+        return true;
+    }
+    commandSend(getData);
+    returns(getData);
+    return true;
+}
+
+
+/*
+ * Plain parameter stores, reads and limits are safe here. Effect type,
+ * file and bank changes are already passed on to the RBP thread by the
+ * commands themselves. What's left that can allocate, walk lists or do
+ * big sums is picked out below.
+ */
+bool InterChange::needsWorker(CommandBlock *getData)
+{
+    unsigned char type = getData->data.type;
+    unsigned char control = getData->data.control;
+    unsigned char npart = getData->data.part;
+    unsigned char kititem = getData->data.kit;
+    unsigned char engine = getData->data.engine;
+    unsigned char insert = getData->data.insert;
+
+    if (npart == 0xd8)
+        return true; // midi-learn list editing
+    if (getData->data.value == FLT_MAX || !(type & 0x40))
+        return false; // limits and reads, sources that read make the part first
+    if (npart < NUM_MIDI_PARTS && kititem < 0x20 && !synth->part[npart]->materialised())
+        return true; // its kit parameters have to be made first
+    if (type & 0x20)
+        return false; // the GUI has already done it
+    if (npart >= NUM_MIDI_PARTS)
+        return false;
+    if (kititem == 0xff || (kititem & 0xa0))
+        return false; // part and part effect controls
+    if (engine != 1 && insert >= 5 && insert <= 7)
+        return true; // oscillator, prepare() does FFTs
+    if (engine == 2 && insert == 0xff && control == 104)
+        return true; // PAD apply, builds all the samples
+    return false;
 }
 
 
@@ -2014,17 +2302,25 @@ void InterChange::returns(CommandBlock *getData)
     bool write = (type & 0x40) > 0;
     if (synth->guiMaster)
     {
-        if (!isGui && (isMidi || (isCli && write)))
+        if (!isGui && (isMidi || (isCli && write)) && !guiSnapshot.store(getData))
         {
             if (jack_ringbuffer_write_space(toGUI) >= commandSize)
                 jack_ringbuffer_write(toGUI, (char*) getData->bytes, commandSize);
+            else
+            {
+                __sync_add_and_fetch(&guiDropped, 1);
+                CLIwake.post(); // to report it
+            }
         }
     }
 
+    if (cliSnapshot.store(getData))
+        return; // goes out at the end of the period
     if (jack_ringbuffer_write_space(toCLI) >= commandSize)
-    {
         jack_ringbuffer_write(toCLI, (char*) getData->bytes, commandSize);
-    }
+    else
+        __sync_add_and_fetch(&cliDropped, 1);
+    CLIwake.post();
 }
 
 
@@ -2039,6 +2335,35 @@ void InterChange::setpadparams(int point)
 
 
 void InterChange::commandSend(CommandBlock *getData)
+{
+    commandDispatch(getData);
+    // the GUI's writes arrive here as reads, it has already done them
+    if (getData->data.value != FLT_MAX && (getData->data.type & 0x60))
+        markChanged(getData); // only after, in case a save is under way
+}
+
+
+/*
+ * Kit items are the only part of a part that's kept, everything else
+ * there is always saved again. Main controls are too.
+ */
+void InterChange::markChanged(CommandBlock *getData)
+{
+    unsigned char npart = getData->data.part;
+    unsigned char kititem = getData->data.kit;
+
+    if (npart >= 0xc0 && npart < 0xd0)
+        synth->xmlVector[npart & 0xf].touch();
+    else if (npart == 0xf1)
+        synth->xmlSysEffects.touch();
+    else if (npart == 0xf2)
+        synth->xmlInsEffects.touch();
+    else if (npart < NUM_MIDI_PARTS && kititem < 0x80)
+        synth->part[npart]->changed(kititem & 0x1f);
+}
+
+
+void InterChange::commandDispatch(CommandBlock *getData)
 {
     float value = getData->data.value;
     if (value == FLT_MAX)
@@ -2395,13 +2720,19 @@ void InterChange::commandMain(CommandBlock *getData)
 
         case 14:
             if (write)
+            {
+                synth->part[synth->getRuntime().currentPart]->changed(); // the GUI may have been editing it
                 synth->getRuntime().currentPart = value;
+            }
             else
                 value = synth->getRuntime().currentPart;
             break;
         case 15:
             if ((write) && (value == 16 || value == 32 || value == 64))
+            {
                 synth->getRuntime().NumAvailableParts = value;
+                synth->routingChanged();
+            }
             else
                 value = synth->getRuntime().NumAvailableParts;
             break;
@@ -2501,7 +2832,10 @@ void InterChange::commandPart(CommandBlock *getData)
             break;
         case 5:
             if (write)
+            {
                 part->Prcvchn = (char) value;
+                synth->routingChanged();
+            }
             else
                 value = part->Prcvchn;
             break;
@@ -2756,7 +3090,7 @@ void InterChange::commandPart(CommandBlock *getData)
             break;
         case 65:
             if (write)
-                part->partefx[effNum]->changeeffect((int)value);
+                part->partefx[effNum]->requesteffect((int)value);
             else
                 value = part->partefx[effNum]->geteffect();
             break;
@@ -3905,9 +4239,7 @@ void InterChange::commandPad(CommandBlock *getData)
                 value = pars->Pquality.samplesize;
             break;
 
-        case 104:
-            if (write)
-                synth->getRuntime().padApply = npart | (kititem << 8);
+        case 104: // applied by the worker thread, see needsWorker()
             break;
 
         case 112:
@@ -3972,7 +4304,7 @@ void InterChange::commandOscillator(CommandBlock *getData, OscilGen *oscil)
             oscil->Phmag[control] = value;
             if (value == 64)
                 oscil->Phphase[control] = 64;
-            oscil->prepare();
+            oscil->unprepare(); // the worker prepares it
         }
         else
             getData->data.value = oscil->Phmag[control];
@@ -3983,7 +4315,7 @@ void InterChange::commandOscillator(CommandBlock *getData, OscilGen *oscil)
         if (write)
         {
             oscil->Phphase[control] = value;
-            oscil->prepare();
+            oscil->unprepare(); // the worker prepares it
         }
         else
             getData->data.value = oscil->Phphase[control];
@@ -4073,7 +4405,7 @@ void InterChange::commandOscillator(CommandBlock *getData, OscilGen *oscil)
                     oscil->Pfiltertype = 0;
                     oscil->Psatype = 0;
                 }
-                oscil->prepare();
+                oscil->unprepare();
             }
             break;
 
@@ -4204,7 +4536,7 @@ void InterChange::commandOscillator(CommandBlock *getData, OscilGen *oscil)
                     oscil->Phphase[i]=64;
                 }
                 oscil->Phmag[0]=127;
-                oscil->prepare();
+                oscil->unprepare();
             }
             break;
         case 97:
@@ -4992,9 +5324,9 @@ void InterChange::commandSysIns(CommandBlock *getData)
                 if (write)
                 {
                     if (isSysEff)
-                        synth->sysefx[effnum]->changeeffect((int)value);
+                        synth->sysefx[effnum]->requesteffect((int)value);
                     else
-                        synth->insefx[effnum]->changeeffect((int)value);
+                        synth->insefx[effnum]->requesteffect((int)value);
                 }
                 else
                 {
@@ -27,12 +27,18 @@
 using namespace std;
 
 #include "Misc/MiscFuncs.h"
+#include "Misc/Notifier.h"
+#include "Interface/ParamSnapshot.h"
 #include "Params/LFOParams.h"
 #include "Params/FilterParams.h"
 #include "Params/EnvelopeParams.h"
 #include "Synth/OscilGen.h"
 #include "Synth/Resonance.h"
 
+#define MEDIATE_SOURCES 3 // CLI, GUI, MIDI
+#define MEDIATE_BATCH 64 // most commands taken from one source at a time
+#define MEDIATE_MAX_COMMANDS 256 // most commands run in one period
+
 class SynthEngine;
 
 class InterChange : private MiscFuncs
@@ -50,17 +56,54 @@ class InterChange : private MiscFuncs
         jack_ringbuffer_t *toGUI;
         jack_ringbuffer_t *fromMIDI;
 
+        // parameter changes, collapsed to the latest values
+        ParamSnapshot guiSnapshot;
+        ParamSnapshot cliSnapshot;
+
         void mediate();
         void returns(CommandBlock *getData);
         void setpadparams(int point);
         void commandSend(CommandBlock *getData);
         void resolveReplies(CommandBlock *getData);
         void returnLimits(CommandBlock *getData);
+        void stopThreads(void);
 
     private:
+        // commands waiting to run, already coalesced
+        struct mediateBatch {
+            CommandBlock block[MEDIATE_BATCH];
+            int count;
+            int next;
+        } batch[MEDIATE_SOURCES];
+        bool fetchBatch(jack_ringbuffer_t *source, mediateBatch *pending, bool fromGui);
+        bool coalescable(CommandBlock *getData);
+        bool runCommand(CommandBlock *getData, int src);
+        void commandDispatch(CommandBlock *getData);
+        void markChanged(CommandBlock *getData); // for the next state save
+
+        // commands that can't be trusted to finish quickly
+        // are passed to the worker and come back done
+        bool needsWorker(CommandBlock *getData);
+        struct workerJob {
+            CommandBlock block;
+            int source; // index into batch[]
+        };
+        unsigned int workerSent[MEDIATE_SOURCES]; // audio thread only
+        unsigned int workerDone[MEDIATE_SOURCES]; // worker only
+        jack_ringbuffer_t *toWorker;
+        jack_ringbuffer_t *fromWorker;
+        Notifier workerWake;
+        void *commandWorker(void);
+        static void *_commandWorker(void *arg);
+        OscilGen *findOscil(CommandBlock *getData);
+        pthread_t commandWorkerHandle;
+
         void *CLIresolvethread(void);
         static void *_CLIresolvethread(void *arg);
         pthread_t  CLIresolvethreadHandle;
+        Notifier CLIwake;
+        unsigned int guiDropped; // replies lost to a full ringbuffer,
+        unsigned int cliDropped; // counted here and logged by the CLI thread
 
         string resolveVector(CommandBlock *getData);
         string resolveMain(CommandBlock *getData);
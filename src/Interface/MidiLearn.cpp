@@ -24,7 +24,7 @@
 #include <unistd.h>
 #include <list>
 #include <string>
-#include <unistd.h>
+#include <string.h>
 
 using namespace std;
 
@@ -34,18 +34,52 @@ using namespace std;
 #include "Misc/XMLwrapper.h"
 #include "Misc/SynthEngine.h"
 
+#define LEARN_SKIP 1
+#define LEARN_BLOCK 2
+#define LEARN_LIMIT 4
+#define LEARN_INVERT 8
+#define LEARN_RANGE 16
+#define LEARN_SHIFT 32
+
+/*
+ * Every use of midi_list, from whichever thread, is made holding
+ * listLock. Incoming midi only uses the index so never takes it.
+ */
+class ListGuard
+{
+    public:
+        ListGuard(pthread_mutex_t *_lock) : lock(_lock) { pthread_mutex_lock(lock); }
+        ~ListGuard() { pthread_mutex_unlock(lock); }
+    private:
+        pthread_mutex_t *lock;
+};
+
+
 MidiLearn::MidiLearn(SynthEngine *_synth) :
     learning(false),
+    activeIndex(NULL),
+    indexReaders(0),
     synth(_synth)
 {
- //init
-
+    // recursive, as the public calls use each other
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&listLock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    rebuildIndex();
 }
 
 
 MidiLearn::~MidiLearn()
 {
-    //close
+    delete activeIndex;
+    while (!retiredIndex.empty())
+    {
+        delete retiredIndex.front();
+        retiredIndex.pop_front();
+    }
+    pthread_mutex_destroy(&listLock);
 }
 
 
@@ -75,72 +109,78 @@ bool MidiLearn::runMidiLearn(float _value, unsigned char CC, unsigned char chan,
 {
     if (learning)
     {
-        insert(CC, chan);
+        if (in_place)
+            insert(CC, chan);
+        else
+        {   // the list isn't touched from here, the worker adds it
+            learning = false;
+            CommandBlock putData;
+            memset(&putData, 0, sizeof(putData));
+            putData.data.type = 0x48;
+            putData.data.part = 0xd8;
+            putData.data.control = 21; // learned
+            putData.data.kit = CC;
+            putData.data.engine = chan;
+            if (jack_ringbuffer_write_space(synth->interchange.fromMIDI) >= sizeof(putData))
+                jack_ringbuffer_write(synth->interchange.fromMIDI, (char*)&putData, sizeof(putData));
+            else
+                synth->getRuntime().Log("fromMidi buffer full!", 2);
+        }
         return true; // block while learning
     }
 
-    int lastpos = -1;
-    LearnBlock foundEntry;
-    while (lastpos != -2)
+    if (chan >= NUM_MIDI_CHANNELS)
+        return false;
+
+    // announce ourselves before picking up the index so rebuildIndex
+    // won't free it under us
+    __sync_add_and_fetch(&indexReaders, 1);
+    LearnIndex *index = __sync_fetch_and_add(&activeIndex, 0);
+    const LearnMap *map = &index->map[index->first[chan][CC]];
+    const LearnMap *last = map + index->count[chan][CC];
+    bool blocked = false;
+
+    for (; map < last; ++map)
     {
-        lastpos = findEntry(midi_list, lastpos, CC, chan, &foundEntry, false);
-        if (lastpos == -3)
-            return false;
-        float value = _value;
-        int status = foundEntry.status;
-        if (status == 4)
+        unsigned char flags = map->flags;
+        if (flags & LEARN_SKIP)
             continue;
 
-        int minIn = foundEntry.min_in;
-        int maxIn = foundEntry.max_in;
-        // cout << "min " << minIn << "  max " << maxIn << endl;
-        if (minIn > maxIn)
-        {
+        float value = _value;
+        if (flags & LEARN_INVERT)
             value = 127 - value;
-            swap(minIn, maxIn);
-        }
 
-        if (status & 2) // limit
+        if (flags & LEARN_LIMIT)
         {
-            if (value < minIn)
-                value = minIn;
-            else if (value > maxIn)
-                value = maxIn;
+            if (value < map->min_in)
+                value = map->min_in;
+            else if (value > map->max_in)
+                value = map->max_in;
         }
         else // compress
-        {
-            int range = maxIn - minIn;
-            value = (value * range / 127) + minIn;
-        }
+            value = (value * map->range / 127) + map->min_in;
 
-        int minOut = foundEntry.min_out;
-        int maxOut = foundEntry.max_out;
-        if (maxOut - minOut != 127) // its a range change
+        if (flags & LEARN_RANGE)
         {
             value = value / 127;
-            value = minOut +((maxOut - minOut) * value);
+            value = map->min_out + (map->out_range * value);
         }
-        else if (minOut != 0) // it's just a shift
-        {
-            value += minOut;
-        }
-
-        //cout << "Min " << minOut << "  Max " << maxOut << endl;
+        else if (flags & LEARN_SHIFT)
+            value += map->min_out;
 
         CommandBlock putData;
         unsigned int writesize = sizeof(putData);
         putData.data.value = value;
         putData.data.type = 0x48; // write command from midi
-        putData.data.control = foundEntry.data.control;
-        putData.data.part = foundEntry.data.part;
-        putData.data.kit = foundEntry.data.kit;
-        putData.data.engine = foundEntry.data.engine;
-        putData.data.insert = foundEntry.data.insert;
-        putData.data.parameter = foundEntry.data.parameter;
-        putData.data.par2 = foundEntry.data.par2;
+        putData.data.control = map->data.control;
+        putData.data.part = map->data.part;
+        putData.data.kit = map->data.kit;
+        putData.data.engine = map->data.engine;
+        putData.data.insert = map->data.insert;
+        putData.data.parameter = map->data.parameter;
+        putData.data.par2 = map->data.par2;
         char *point = (char*)&putData;
         unsigned int towrite = writesize;
-        unsigned int wrote = 0;
         unsigned int found;
         unsigned int tries = 0;
 
@@ -156,7 +196,6 @@ bool MidiLearn::runMidiLearn(float _value, unsigned char CC, unsigned char chan,
                 while (towrite && tries < 3)
                 {
                     found = jack_ringbuffer_write(synth->interchange.fromMIDI, point, towrite);
-                    wrote += found;
                     point += found;
                     towrite -= found;
                     ++tries;
@@ -167,15 +206,112 @@ bool MidiLearn::runMidiLearn(float _value, unsigned char CC, unsigned char chan,
             else
                 synth->getRuntime().Log("fromMidi buffer full!", 2);
         }
-        if (lastpos == -1)
-            return true;
+        if (flags & LEARN_BLOCK)
+        {
+            blocked = true;
+            break;
+        }
+    }
+    __sync_sub_and_fetch(&indexReaders, 1);
+    return blocked;
+}
+
+
+/*
+ * Compile midi_list into a fresh index then swap it in. Entries set
+ * to all channels are copied into every channel's runs, keeping list
+ * order. Only the first MIDI_LEARN_BLOCK lines are taken so the map
+ * can't overflow. Replaced indexes are kept until a rebuild finds
+ * nobody reading, then freed, so the MIDI thread never waits.
+ */
+void MidiLearn::rebuildIndex()
+{
+    ListGuard guard(&listLock);
+    LearnIndex *index = new LearnIndex;
+    memset(index->count, 0, sizeof(index->count));
+
+    // first pass sizes each run
+    list<LearnBlock>::iterator it;
+    list<LearnBlock>::iterator end = midi_list.begin();
+    advance(end, min(midi_list.size(), (size_t)MIDI_LEARN_BLOCK));
+    for (it = midi_list.begin(); it != end; ++it)
+    {
+        for (int chan = 0; chan < NUM_MIDI_CHANNELS; ++chan)
+        {
+            if (it->chan >= NUM_MIDI_CHANNELS || it->chan == chan)
+                ++ index->count[chan][it->CC];
+        }
+    }
+    int pos = 0;
+    for (int chan = 0; chan < NUM_MIDI_CHANNELS; ++chan)
+    {
+        for (int CC = 0; CC < 256; ++CC)
+        {
+            index->first[chan][CC] = pos;
+            pos += index->count[chan][CC];
+            index->count[chan][CC] = 0;
+        }
+    }
+
+    for (it = midi_list.begin(); it != end; ++it)
+    {
+        LearnMap entry;
+        int status = it->status;
+        entry.flags = 0;
+        if (status == 4)
+            entry.flags |= LEARN_SKIP;
+        if (status & 1)
+            entry.flags |= LEARN_BLOCK;
+        if (status & 2)
+            entry.flags |= LEARN_LIMIT;
+
+        int minIn = it->min_in;
+        int maxIn = it->max_in;
+        if (minIn > maxIn)
+        {
+            entry.flags |= LEARN_INVERT;
+            swap(minIn, maxIn);
+        }
+        entry.min_in = minIn;
+        entry.max_in = maxIn;
+        entry.range = maxIn - minIn;
+
+        entry.min_out = it->min_out;
+        entry.out_range = it->max_out - it->min_out;
+        if (entry.out_range != 127) // its a range change
+            entry.flags |= LEARN_RANGE;
+        else if (entry.min_out != 0) // it's just a shift
+            entry.flags |= LEARN_SHIFT;
+        entry.data = it->data;
+
+        for (int chan = 0; chan < NUM_MIDI_CHANNELS; ++chan)
+        {
+            if (it->chan >= NUM_MIDI_CHANNELS || it->chan == chan)
+            {
+                unsigned short &count = index->count[chan][it->CC];
+                index->map[index->first[chan][it->CC] + count] = entry;
+                ++ count;
+            }
+        }
+    }
+
+    LearnIndex *old = __sync_lock_test_and_set(&activeIndex, index);
+    if (old)
+        retiredIndex.push_back(old);
+    // anyone starting from here on only sees the new one
+    if (__sync_add_and_fetch(&indexReaders, 0) == 0)
+    {
+        while (!retiredIndex.empty())
+        {
+            delete retiredIndex.front();
+            retiredIndex.pop_front();
+        }
     }
-    return false;
 }
 
+
 /*
- * This will only be called by incoming midi. It is the only function that
- * needs to be quick
+ * Walks the list itself, so incoming midi uses the index instead.
  */
 int MidiLearn::findEntry(list<LearnBlock> &midi_list, int lastpos, unsigned char CC, unsigned char chan, LearnBlock *block, bool show)
 {
@@ -225,6 +361,7 @@ int MidiLearn::findEntry(list<LearnBlock> &midi_list, int lastpos, unsigned char
 
 void MidiLearn::listAll()
 {
+    ListGuard guard(&listLock);
     list<LearnBlock>::iterator it = midi_list.begin();
     int lineNo = 0;
     synth->getRuntime().Log("Midi learned:");
@@ -239,6 +376,7 @@ void MidiLearn::listAll()
 
 bool MidiLearn::remove(int itemNumber)
 {
+    ListGuard guard(&listLock);
     list<LearnBlock>::iterator it = midi_list.begin();
     int found = 0;
     while (found < itemNumber && it != midi_list.end())
@@ -249,6 +387,7 @@ bool MidiLearn::remove(int itemNumber)
     if (it != midi_list.end())
     {
         midi_list.erase(it);
+        rebuildIndex();
         return true;
     }
     return false;
@@ -257,9 +396,16 @@ bool MidiLearn::remove(int itemNumber)
 
 void MidiLearn::changeLine(int value, unsigned char type, unsigned char control, unsigned char part, unsigned char kit, unsigned char engine, unsigned char insert, unsigned char parameter, unsigned char par2)
 {
+    ListGuard guard(&listLock);
+    if (control == 21) // learned, passed on from the MIDI thread
+    {
+        this->insert(kit, engine);
+        return;
+    }
     if (control == 96)
     {
         midi_list.clear();
+        rebuildIndex();
         updateGui();
         return;
     }
@@ -330,6 +476,7 @@ void MidiLearn::changeLine(int value, unsigned char type, unsigned char control,
             midi_list.push_back(entry);
         else
             midi_list.insert(it, entry);
+        rebuildIndex();
         updateGui();
         return;
     }
@@ -337,11 +484,13 @@ void MidiLearn::changeLine(int value, unsigned char type, unsigned char control,
     it->min_in = insert;
     it->max_in = parameter;
     it->status = type & 0x1f;
+    rebuildIndex();
 }
 
 
 void MidiLearn::insert(unsigned char CC, unsigned char chan)
 {
+    ListGuard guard(&listLock);
     /*
      * This will eventually be part of a paging system of
      * 128 lines for the Gui.
@@ -400,6 +549,7 @@ void MidiLearn::insert(unsigned char CC, unsigned char chan)
         midi_list.push_back(entry);
     else
         midi_list.insert(it, entry);
+    rebuildIndex();
 
     synth->getRuntime().Log("Learned ");
     synth->getRuntime().Log("CC " + to_string((int)entry.CC) + "  Chan " + to_string((int)entry.chan) + "  " + entry.name);
@@ -485,6 +635,7 @@ void MidiLearn::updateGui()
 
 bool MidiLearn::saveList(string name)
 {
+    ListGuard guard(&listLock);
     if (name.empty())
     {
         synth->getRuntime().Log("No filename");
@@ -554,6 +705,7 @@ bool MidiLearn::saveList(string name)
 
 bool MidiLearn::loadList(string name)
 {
+    ListGuard guard(&listLock);
     if (name.empty())
     {
         synth->getRuntime().Log("No filename");
@@ -587,6 +739,11 @@ bool MidiLearn::loadList(string name)
     while (true)
     {
         status = 0;
+        if (ID >= MIDI_LEARN_BLOCK)
+        {
+            synth->getRuntime().Log("Midi Learn full! Remaining lines ignored");
+            break;
+        }
         if (!xml->enterbranch("LINE", ID))
             break;
         else
@@ -630,6 +787,7 @@ bool MidiLearn::loadList(string name)
     }
 
     xml->endbranch(); // MIDILEARN
+    rebuildIndex();
     synth->addHistory(file, 6);
     delete xml;
     return true;
@@ -25,6 +25,7 @@
 #include <jack/ringbuffer.h>
 #include <list>
 #include <string>
+#include <pthread.h>
 
 using namespace std;
 
@@ -69,6 +70,26 @@ class MidiLearn : private MiscFuncs
             Control data; // controller to learn
             string name; // optional derived from controller text?
         };
+
+        /*
+         * Flat copy of midi_list used by runMidiLearn. Each channel/CC
+         * slot points to a run of ready-to-use records in list order, so
+         * incoming controllers never walk the list.
+         */
+        struct LearnMap{
+            unsigned char flags; // LEARN_SKIP, LEARN_BLOCK, etc.
+            unsigned char min_in; // already swapped if inverted
+            unsigned char max_in;
+            int range;
+            int min_out;
+            int out_range;
+            Control data;
+        };
+        struct LearnIndex{
+            unsigned short first[NUM_MIDI_CHANNELS][256];
+            unsigned short count[NUM_MIDI_CHANNELS][256];
+            LearnMap map[NUM_MIDI_CHANNELS * MIDI_LEARN_BLOCK];
+        };
         bool learning;
         string learnedName;
 
@@ -88,6 +109,12 @@ class MidiLearn : private MiscFuncs
         //Control learnTransferBlock;
         CommandBlock learnTransferBlock;
 
+        LearnIndex *activeIndex;
+        int indexReaders;
+        list<LearnIndex*> retiredIndex; // swapped out, may still be read
+        pthread_mutex_t listLock;
+        void rebuildIndex(void);
+
         void insert(unsigned char CC, unsigned char chan);
         SynthEngine *synth;
         void updateGui(void);
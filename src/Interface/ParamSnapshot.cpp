@@ -0,0 +1,161 @@
+/*
+    ParamSnapshot.cpp - latest value of each changed control, collected
+                        by the audio thread and read back in bulk
+
+    Copyright 2016, Will Godfrey & others
+
+    This file is part of yoshimi, which is free software: you can redistribute
+    it and/or modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either version 2 of
+    the License, or (at your option) any later version.
+
+    yoshimi is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.   See the GNU General Public License (version 2 or
+    later) for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    yoshimi; if not, write to the Free Software Foundation, Inc., 51 Franklin
+    Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <cstring>
+#include <cfloat>
+
+#include "Interface/ParamSnapshot.h"
+
+#define SECTION_MAIN 0
+#define SECTION_PARTS 1
+#define SECTION_KITS 2
+#define SECTION_EFFECTS 3
+
+ParamSnapshot::ParamSnapshot() :
+    back(0),
+    published(0),
+    writing(0),
+    readSection(0),
+    readWord(0)
+{
+    memset(buf, 0, sizeof(buf));
+}
+
+
+/*
+ * Only writes to plain controls go in here. Reads, limits, midi-learn
+ * and vectors need every message delivered in order.
+ */
+int ParamSnapshot::sectionOf(CommandBlock *getData)
+{
+    if (getData->data.value == FLT_MAX || !(getData->data.type & 0x40))
+        return -1;
+    unsigned char npart = getData->data.part;
+    unsigned char kititem = getData->data.kit;
+    if (npart >= NUM_MIDI_PARTS && npart != 0xf0 && npart != 0xf1 && npart != 0xf2)
+        return -1;
+    if (kititem >= 0x80 && kititem != 0xff)
+        return SECTION_EFFECTS;
+    if (npart >= 0xf0)
+        return SECTION_MAIN;
+    if (kititem == 0xff || (kititem & 0x20))
+        return SECTION_PARTS;
+    return SECTION_KITS;
+}
+
+
+bool ParamSnapshot::store(CommandBlock *getData)
+{
+    int sect = sectionOf(getData);
+    if (sect < 0)
+        return false;
+    // Refusing here would put a newer value in the ringbuffer behind an
+    // older one already stored, and both hold this only very briefly.
+    while (__sync_lock_test_and_set(&writing, 1))
+        ;
+
+    section &list = buf[back].sect[sect];
+    const unsigned char *key = (const unsigned char*) &getData->data.type;
+    unsigned int hash = 0;
+    for (int i = 0; i < 8; ++i)
+        hash = hash * 31 + key[i];
+
+    bool ok = false;
+    unsigned int slot = hash & (SNAPSHOT_SLOTS - 1);
+    for (int tries = 0; tries < SNAPSHOT_SLOTS; ++tries)
+    {
+        unsigned int bit = 1u << (slot & 31);
+        if (!(list.dirty[slot >> 5] & bit))
+        {
+            if (list.count >= SNAPSHOT_SLOTS * 3 / 4)
+                break; // too crowded, let the ringbuffer have it
+            list.block[slot] = *getData;
+            list.dirty[slot >> 5] |= bit;
+            ++list.count;
+            buf[back].changed |= (1 << sect);
+            ok = true;
+            break;
+        }
+        if (memcmp(&list.block[slot].data.type, key, 8) == 0)
+        {
+            list.block[slot].data.value = getData->data.value;
+            ok = true;
+            break;
+        }
+        slot = (slot + 1) & (SNAPSHOT_SLOTS - 1);
+    }
+    __sync_lock_release(&writing);
+    return ok;
+}
+
+
+bool ParamSnapshot::flip(void)
+{
+    if (__sync_add_and_fetch(&published, 0))
+        return false; // reader hasn't finished with the last one
+    if (__sync_lock_test_and_set(&writing, 1))
+        return false; // try again next period
+    bool flipped = false;
+    if (buf[back].changed)
+    {
+        back ^= 1;
+        flipped = true;
+    }
+    __sync_lock_release(&writing);
+    if (flipped)
+        __sync_or_and_fetch(&published, 1);
+    return flipped;
+}
+
+
+// Each set bit is one changed control. Once all are read
+// the buffer is left empty, ready to be filled again.
+bool ParamSnapshot::fetch(CommandBlock *getData)
+{
+    if (!__sync_add_and_fetch(&published, 0))
+        return false;
+    buffer &front = buf[back ^ 1];
+    while (readSection < SNAPSHOT_SECTIONS)
+    {
+        if (front.changed & (1 << readSection))
+        {
+            section &list = front.sect[readSection];
+            while (readWord < SNAPSHOT_SLOTS / 32)
+            {
+                unsigned int bits = list.dirty[readWord];
+                if (bits)
+                {
+                    list.dirty[readWord] = bits & (bits - 1);
+                    *getData = list.block[(readWord << 5) + __builtin_ctz(bits)];
+                    return true;
+                }
+                ++readWord;
+            }
+            list.count = 0;
+        }
+        ++readSection;
+        readWord = 0;
+    }
+    front.changed = 0;
+    readSection = 0;
+    __sync_and_and_fetch(&published, 0);
+    return false;
+}
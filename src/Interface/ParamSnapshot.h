@@ -0,0 +1,68 @@
+/*
+    ParamSnapshot.h - latest value of each changed control, collected
+                      by the audio thread and read back in bulk
+
+    Copyright 2016, Will Godfrey & others
+
+    This file is part of yoshimi, which is free software: you can redistribute
+    it and/or modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either version 2 of
+    the License, or (at your option) any later version.
+
+    yoshimi is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.   See the GNU General Public License (version 2 or
+    later) for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    yoshimi; if not, write to the Free Software Foundation, Inc., 51 Franklin
+    Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef PARAMSNAPSHOT_H
+#define PARAMSNAPSHOT_H
+
+#include "Misc/MiscFuncs.h"
+
+#define SNAPSHOT_SECTIONS 4 // main, parts, kits, effects
+#define SNAPSHOT_SLOTS 512 // different controls per section between reads
+
+/*
+ * Two buffers, one filled by the audio thread while the other is read.
+ * A control changed many times before the reader gets to it only keeps
+ * its last value, and the reader skips whole sections nothing touched.
+ * flip() doesn't wait for anything. store() refuses anything it can't
+ * take and the caller falls back to its ringbuffer. Once a section is
+ * full a control not already in it stays out until the next flip, so
+ * anything in the ringbuffer is newer than what's here and the reader
+ * should fetch() everything before emptying the ringbuffer.
+ */
+class ParamSnapshot
+{
+    public:
+        ParamSnapshot();
+        ~ParamSnapshot() { }
+        bool store(CommandBlock *getData);
+        bool flip(void); // audio side, once per period; true if there is something to read
+        bool fetch(CommandBlock *getData); // reader side, false when all read
+
+    private:
+        struct section {
+            CommandBlock block[SNAPSHOT_SLOTS];
+            unsigned int dirty[SNAPSHOT_SLOTS / 32];
+            int count;
+        };
+        struct buffer {
+            section sect[SNAPSHOT_SECTIONS];
+            unsigned int changed; // one bit per section
+        } buf[2];
+        int back; // the one being filled
+        int published; // the other one is waiting for the reader
+        int writing;
+        int readSection;
+        int readWord;
+
+        int sectionOf(CommandBlock *getData);
+};
+
+#endif
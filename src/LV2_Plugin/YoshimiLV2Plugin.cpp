@@ -342,7 +342,7 @@ void *YoshimiLV2Plugin::idleThread()
 //        if (_synth->getRuntime().showGui)
 //            Fl::wait(0.033333);
 //        else
-            usleep(33333);
+            _synth->getRuntime().deadObjects->waitForBodies(-1);
     }
     return NULL;
 }
@@ -419,6 +419,7 @@ YoshimiLV2Plugin::~YoshimiLV2Plugin()
         }
         _synth->getRuntime().runSynth = false;
         sem_post(&_midiSem);
+        _synth->getRuntime().deadObjects->wakeUp();
         pthread_join(_pMidiThread, NULL);
         pthread_join(_pIdleThread, NULL);
         sem_destroy(&_midiSem);
@@ -33,13 +33,16 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
+#include <time.h>
 
 #include <vector>
 #include <algorithm>
+#include <climits>
 
 using namespace std;
 
 #include "Misc/XMLwrapper.h"
+#include "Misc/JobPool.h"
 #include "Misc/Config.h"
 #include "Misc/Bank.h"
 #include "Misc/MiscFuncs.h"
@@ -53,7 +56,10 @@ Bank::Bank(SynthEngine *_synth) :
                                     // it doesn't contain an instrument file
     synth(_synth),
     currentRootID(0),
-    currentBankID(0)
+    currentBankID(0),
+    indexLoaded(false),
+    indexChanged(false),
+    deferEngines(false)
 {
     roots.clear();
     //addDefaultRootDirs();
@@ -267,13 +273,95 @@ bool Bank::loadbank(size_t rootID, size_t banknum)
     {
         return false;
     }
-    DIR *dir = opendir(bankdirname.c_str());
-    if (dir == NULL)
+    vector<string> found;
+    if (!listBankDir(bankdirname, found))
+        return false;
+    roots [rootID].banks [banknum].instruments.clear();
+
+    string candidate;
+    for (size_t i = 0; i < found.size(); ++i)
+    {
+        candidate = found [i];
+        // just NNNN-<name>.xiz files please
+        // sa verific daca e si extensia dorita
+
+        // sorry Cal. They insisted :(
+
+        int chk = findSplitPoint(candidate);
+        if (chk > 0)
+        {
+            int instnum = string2int(candidate.substr(0, chk));
+            // remove "NNNN-" and .xiz extension for instrument name
+            // modified for numbered instruments with < 4 digits
+            string instname = candidate.substr(chk + 1, candidate.size() - xizext.size() - chk - 1);
+            addtobank(rootID, banknum, instnum - 1, candidate, instname);
+        }
+        else
+        {
+            string instname = candidate.substr(0, candidate.size() -  xizext.size());
+            addtobank(rootID, banknum, -1, candidate, instname);
+        }
+    }
+    return true;
+}
+
+
+/*
+ * Modification times only go to the second, so something looked at in
+ * the same second it was changed could change again without its time
+ * moving. Those are stored as 0 so they get looked at next time too.
+ * Must be called after reading whatever the time belongs to.
+ */
+static int settledTime(time_t mtime)
+{
+    return (mtime >= time(NULL)) ? 0 : (int)mtime;
+}
+
+
+/*
+ * The instrument files in a bank directory, in the order readdir
+ * gives them. If the directory hasn't changed since the index was
+ * made, no file can have been added, removed or renamed, so the
+ * list is taken from the index without reading the directory.
+ */
+bool Bank::listBankDir(const string& bankdirname, vector<string>& found)
+{
+    struct stat st;
+    if (stat(bankdirname.c_str(), &st) != 0)
     {
         synth->getRuntime().Log("Failed to open bank directory " + bankdirname);
         return false;
     }
-    roots [rootID].banks [banknum].instruments.clear();
+    IndexDir &cached = bankIndex [bankdirname];
+    cached.seen = true;
+    if (cached.listed && cached.mtime == (int)st.st_mtime)
+    {
+        found = cached.order;
+        return true;
+    }
+    bool isBank;
+    if (!readBankDir(bankdirname, isBank, found))
+    {
+        synth->getRuntime().Log("Failed to open bank directory " + bankdirname);
+        return false;
+    }
+    relistIndex(cached, settledTime(st.st_mtime), true, found);
+    return true;
+}
+
+
+/*
+ * Whether a directory would be taken as a bank, and the instrument
+ * files in it, from one pass through it. Touches nothing else so it
+ * is safe on the scanning threads.
+ */
+bool Bank::readBankDir(const string& dirname, bool &isBank, vector<string>& files)
+{
+    DIR *dir = opendir(dirname.c_str());
+    if (dir == NULL)
+        return false;
+    isBank = false;
+    files.clear();
 
     struct dirent *fn;
     struct stat st;
@@ -283,46 +371,85 @@ bool Bank::loadbank(size_t rootID, size_t banknum)
     while ((fn = readdir(dir)))
     {
         candidate = string(fn->d_name);
-        if (candidate == "."
-            || candidate == ".."
-            || candidate.size() <= (xizext.size() + 2)) // actually a 3 char filename!
+        if (candidate == "." || candidate == "..")
             continue;
-        chkpath = bankdirname;
+        if (candidate == force_bank_dir_file)
+        {   // .bankdir file exists, so it's a bank
+            isBank = true;
+            continue;
+        }
+        // check for .xiz extension
+        if ((xizpos = candidate.rfind(xizext)) == string::npos
+            || xizext.size() != (candidate.size() - xizpos))
+            continue;
+        chkpath = dirname;
         if (chkpath.at(chkpath.size() - 1) != '/')
             chkpath += "/";
         chkpath += candidate;
         lstat(chkpath.c_str(), &st);
-        if (S_ISREG(st.st_mode))
-        {
-            if ((xizpos = candidate.rfind(xizext)) != string::npos)
-            {
-                if (xizext.size() == (candidate.size() - xizpos))
-                {
-                    // just NNNN-<name>.xiz files please
-                    // sa verific daca e si extensia dorita
+        if (st.st_mode & (S_IFREG | S_IRGRP))
+            isBank = true; // is an instrument, so it's a bank
+        if (S_ISREG(st.st_mode) && candidate.size() > (xizext.size() + 2)) // not a 3 char filename!
+            files.push_back(candidate);
+    }
+    closedir(dir);
+    return true;
+}
 
-                    // sorry Cal. They insisted :(
 
-                    int chk = findSplitPoint(candidate);
-                    if (chk > 0)
-                    {
-                        int instnum = string2int(candidate.substr(0, chk));
-                        // remove "NNNN-" and .xiz extension for instrument name
-                        // modified for numbered instruments with < 4 digits
-                        string instname = candidate.substr(chk + 1, candidate.size() - xizext.size() - chk - 1);
-                        addtobank(rootID, banknum, instnum - 1, candidate, instname);
-                    }
-                    else
-                    {
-                        string instname = candidate.substr(0, candidate.size() -  xizext.size());
-                        addtobank(rootID, banknum, -1, candidate, instname);
-                    }
-                }
-            }
-        }
+// Entries for files that are still there are kept as they were.
+void Bank::relistIndex(IndexDir &cached, int mtime, bool isBank, const vector<string>& files)
+{
+    IndexEntryMap previous;
+    previous.swap(cached.instruments);
+    cached.order = files;
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        IndexEntryMap::iterator it = previous.find(files [i]);
+        if (it != previous.end())
+            cached.instruments [files [i]] = it->second;
+        else
+            cached.instruments [files [i]] = IndexEntry();
+    }
+    cached.mtime = mtime;
+    cached.isBank = isBank;
+    cached.listed = true;
+    indexChanged = true;
+}
+
+
+// Rewrites every instrument in a directory as binary or as xml.
+// Both load the same, so this can be undone at any time.
+int Bank::convertBankDir(string dirname, bool toBinary)
+{
+    DIR *dir = opendir(dirname.c_str());
+    if (dir == NULL)
+    {
+        synth->getRuntime().Log("Failed to open bank directory " + dirname);
+        return -1;
+    }
+    if (dirname.at(dirname.size() - 1) != '/')
+        dirname += "/";
+    int count = 0;
+    struct dirent *fn;
+    struct stat st;
+    while ((fn = readdir(dir)))
+    {
+        string candidate = string(fn->d_name);
+        if (candidate.size() <= xizext.size()
+            || candidate.substr(candidate.size() - xizext.size()) != xizext)
+            continue;
+        string chkpath = dirname + candidate;
+        lstat(chkpath.c_str(), &st);
+        if (!S_ISREG(st.st_mode))
+            continue;
+        XMLwrapper *xml = new XMLwrapper(synth);
+        if (xml->convertfile(chkpath, toBinary))
+            ++count;
+        delete xml;
     }
     closedir(dir);
-    return true;
+    return count;
 }
 
 
@@ -517,85 +644,199 @@ void Bank::swapbanks(unsigned int firstID, unsigned int secondID)
 
 
 // Re-scan for directories containing instrument banks
-void Bank::rescanforbanks(void)
+void Bank::rescanforbanks(bool full)
 {
-    RootEntryMap::const_iterator it;
+    if (!indexLoaded)
+        loadIndex();
+    if (full)
+    {
+        bankIndex.clear();
+        indexChanged = true;
+    }
+    IndexDirMap::iterator dit;
+    for (dit = bankIndex.begin(); dit != bankIndex.end(); ++dit)
+        dit->second.seen = false;
 
+    vector<size_t> rootIDs;
+    RootEntryMap::const_iterator it;
     for (it = roots.begin(); it != roots.end(); ++it)
+        rootIDs.push_back(it->first);
+    scanRoots(rootIDs);
+
+    // forget directories that have gone or are no longer under a root
+    dit = bankIndex.begin();
+    while (dit != bankIndex.end())
     {
-        scanrootdir(it->first);
+        if (dit->second.seen)
+            ++dit;
+        else
+        {
+            bankIndex.erase(dit++);
+            indexChanged = true;
+        }
     }
+    if (indexChanged)
+        saveIndex();
 }
 
 // private affairs
 
 void Bank::scanrootdir(int root_idx)
 {
-    map<string, string> bankDirsMap;
-    string rootdir = roots [root_idx].path;
+    if (!indexLoaded)
+        loadIndex();
+    scanRoots(vector<size_t>(1, root_idx));
+    if (indexChanged)
+        saveIndex();
+}
 
-    if (rootdir.empty() || !isDirectory(rootdir))
-        return;
-    DIR *dir = opendir(rootdir.c_str());
+
+/*
+ * Network mounted libraries spend most of their time waiting on
+ * directory reads and file opens, so the threads are not limited
+ * to the number of processors.
+ */
+#define BANK_SCAN_THREADS 16
+
+void Bank::scanRoots(const vector<size_t>& rootIDs)
+{
+    scanning.clear();
+    for (size_t i = 0; i < rootIDs.size(); ++i)
+    {
+        string rootdir = roots [rootIDs [i]].path;
+        if (rootdir.empty() || !isDirectory(rootdir))
+            continue;
+        scanRoot root;
+        root.rootID = rootIDs [i];
+        root.path = rootdir;
+        scanning.push_back(root);
+    }
+    JobPool::run(_listRoot, this, scanning.size(), BANK_SCAN_THREADS);
+
+    scanDirs.clear();
+    for (size_t i = 0; i < scanning.size(); ++i)
+    {
+        for (size_t j = 0; j < scanning [i].dirs.size(); ++j)
+            scanDirs.push_back(&scanning [i].dirs [j]);
+    }
+    JobPool::run(_examineDir, this, scanDirs.size(), BANK_SCAN_THREADS);
+
+    pendingEngines.clear();
+    deferEngines = true;
+    for (size_t i = 0; i < scanning.size(); ++i)
+        mergeRoot(scanning [i]);
+    deferEngines = false;
+
+    JobPool::run(_probeEngines, this, pendingEngines.size(), BANK_SCAN_THREADS);
+    for (size_t i = 0; i < pendingEngines.size(); ++i)
+        applyEngines(pendingEngines [i]);
+
+    pendingEngines.clear();
+    scanDirs.clear();
+    scanning.clear();
+}
+
+
+void Bank::_listRoot(void *arg, size_t index)
+{
+    Bank *bank = (Bank*) arg;
+    bank->listRoot(bank->scanning [index]);
+}
+
+
+void Bank::_examineDir(void *arg, size_t index)
+{
+    Bank *bank = (Bank*) arg;
+    bank->examineDir(*bank->scanDirs [index]);
+}
+
+
+void Bank::_probeEngines(void *arg, size_t index)
+{
+    Bank *bank = (Bank*) arg;
+    bank->probeEngines(bank->pendingEngines [index]);
+}
+
+
+// every directory directly under a root
+void Bank::listRoot(scanRoot &root)
+{
+    DIR *dir = opendir(root.path.c_str());
     if (dir == NULL)
     {
-        synth->getRuntime().Log("No such directory, root bank entry " + rootdir);
+        root.error = "No such directory, root bank entry " + root.path;
         return;
     }
     struct dirent *fn;
     struct stat st;
-    size_t xizpos;
-    roots [root_idx].banks.clear();
     while ((fn = readdir(dir)))
     {
         string candidate = string(fn->d_name);
         if (candidate == "." || candidate == "..")
             continue;
-        string chkdir = rootdir;
+        string chkdir = root.path;
         if (chkdir.at(chkdir.size() - 1) != '/')
             chkdir += "/";
         chkdir += candidate;
         lstat(chkdir.c_str(), &st);
         if (!S_ISDIR(st.st_mode))
             continue;
-        // check if directory contains an instrument or .bankdir
-        DIR *d = opendir(chkdir.c_str());
-        if (d == NULL)
+        scanDir found;
+        found.name = candidate;
+        found.path = chkdir;
+        found.mtime = st.st_mtime;
+        found.changed = false;
+        found.isBank = false;
+        root.dirs.push_back(found);
+    }
+    closedir(dir);
+}
+
+
+void Bank::examineDir(scanDir &dir)
+{
+    IndexDirMap::const_iterator cached = bankIndex.find(dir.path);
+    if (cached != bankIndex.end() && cached->second.mtime == dir.mtime)
+    {   // nothing added or removed since we last looked
+        dir.isBank = cached->second.isBank;
+        return;
+    }
+    dir.changed = true;
+    if (!readBankDir(dir.path, dir.isBank, dir.files))
+        dir.error = "Failed to open bank directory candidate " + dir.path;
+    dir.mtime = settledTime(dir.mtime);
+}
+
+
+void Bank::mergeRoot(scanRoot &root)
+{
+    if (!root.error.empty())
+    {
+        synth->getRuntime().Log(root.error);
+        return;
+    }
+    size_t root_idx = root.rootID;
+    map<string, string> bankDirsMap;
+    roots [root_idx].banks.clear();
+    for (size_t i = 0; i < root.dirs.size(); ++i)
+    {
+        scanDir &dir = root.dirs [i];
+        IndexDir &cached = bankIndex [dir.path];
+        cached.seen = true;
+        if (!dir.error.empty())
         {
-            synth->getRuntime().Log("Failed to open bank directory candidate " + chkdir);
+            synth->getRuntime().Log(dir.error);
+            cached = IndexDir(); // try again next time
+            cached.seen = true;
+            indexChanged = true;
             continue;
         }
-        struct dirent *fname;
-        //int idx;
-        //char x;
-        while ((fname = readdir(d)))
-        {
-            string possible = string(fname->d_name);
-            if (possible == "." || possible == "..")
-                continue;
-            if (possible == force_bank_dir_file)
-            {   // .bankdir file exists, so add the bank
-                bankDirsMap [candidate] = chkdir;
-                break;
-            }
-            string chkpath = chkdir + "/" + possible;
-            lstat(chkpath.c_str(), &st);
-            if (st.st_mode & (S_IFREG | S_IRGRP))
-            {
-                // check for .xiz extension
-                if ((xizpos = possible.rfind(xizext)) != string::npos)
-                {
-                    if (xizext.size() == (possible.size() - xizpos))
-                    {   // is an instrument, so add the bank
-                        bankDirsMap [candidate] = chkdir;
-                        break;
-                    }
-                }
-            }
-        }
-        closedir(d);
+        if (dir.changed)
+            relistIndex(cached, dir.mtime, dir.isBank, dir.files);
+        if (cached.isBank)
+            bankDirsMap [dir.name] = dir.path;
     }
-    closedir(dir);
+
     size_t idStep = (size_t)128 / (bankDirsMap.size() + 2);
     if(idStep > 1)
     {
@@ -659,15 +900,205 @@ bool Bank::addtobank(size_t rootID, size_t bankID, int pos, const string filenam
 
     // see which engines are used
     if (synth->getRuntime().checksynthengines)
+        checkEngines(rootID, bankID, pos);
+    return 0;
+}
+
+
+// While scanning, these are collected and done together afterwards.
+void Bank::checkEngines(size_t rootID, size_t bankID, int pos)
+{
+    engineCheck check;
+    check.rootID = rootID;
+    check.bankID = bankID;
+    check.pos = pos;
+    check.dir = getBankPath(rootID, bankID);
+    check.filename = getInstrumentReference(rootID, bankID, pos).filename;
+    if (deferEngines)
     {
-        XMLwrapper *xml = new XMLwrapper(synth);
-        xml->checkfileinformation(getFullPath(rootID, bankID, pos));
-        instrRef.PADsynth_used = xml->information.PADsynth_used;
-        instrRef.ADDsynth_used = xml->information.ADDsynth_used;
-        instrRef.SUBsynth_used = xml->information.SUBsynth_used;
+        pendingEngines.push_back(check);
+        return;
+    }
+    probeEngines(check);
+    applyEngines(check);
+}
+
+
+// Only opens the file if it has changed since the index saw it.
+void Bank::probeEngines(engineCheck &check)
+{
+    check.found = false;
+    check.fresh = false;
+    string fullpath = check.dir + "/" + check.filename;
+    struct stat st;
+    if (stat(fullpath.c_str(), &st) != 0)
+        return;
+    check.found = true;
+    check.mtime = st.st_mtime;
+    check.size = st.st_size;
+
+    IndexDirMap::const_iterator dir = bankIndex.find(check.dir);
+    if (dir != bankIndex.end())
+    {
+        IndexEntryMap::const_iterator entry = dir->second.instruments.find(check.filename);
+        if (entry != dir->second.instruments.end() && entry->second.checked
+            && entry->second.mtime == check.mtime && entry->second.size == check.size)
+        {
+            check.PADsynth_used = entry->second.PADsynth_used;
+            check.ADDsynth_used = entry->second.ADDsynth_used;
+            check.SUBsynth_used = entry->second.SUBsynth_used;
+            return;
+        }
+    }
+    XMLwrapper *xml = new XMLwrapper(synth);
+    xml->holdErrors = true;
+    xml->checkfileinformation(fullpath);
+    check.errors.swap(xml->errors);
+    check.PADsynth_used = xml->information.PADsynth_used;
+    check.ADDsynth_used = xml->information.ADDsynth_used;
+    check.SUBsynth_used = xml->information.SUBsynth_used;
+    delete xml;
+    check.mtime = settledTime(check.mtime);
+    check.fresh = true;
+}
+
+
+void Bank::applyEngines(const engineCheck &check)
+{
+    for (size_t i = 0; i < check.errors.size(); ++i)
+        synth->getRuntime().Log(check.errors [i]);
+    if (!check.found)
+        return;
+    InstrumentEntry &instrRef = getInstrumentReference(check.rootID, check.bankID, check.pos);
+    if (instrRef.filename != check.filename)
+        return;
+    instrRef.PADsynth_used = check.PADsynth_used;
+    instrRef.ADDsynth_used = check.ADDsynth_used;
+    instrRef.SUBsynth_used = check.SUBsynth_used;
+    if (!check.fresh)
+        return;
+    IndexEntry &cached = bankIndex [check.dir].instruments [check.filename];
+    cached.mtime = check.mtime;
+    cached.size = check.size;
+    cached.checked = true;
+    cached.PADsynth_used = check.PADsynth_used;
+    cached.ADDsynth_used = check.ADDsynth_used;
+    cached.SUBsynth_used = check.SUBsynth_used;
+    indexChanged = true;
+}
+
+
+string Bank::indexFile(void)
+{
+    string name = synth->getRuntime().ConfigDir + '/' + YOSHIMI;
+    unsigned int instance = synth->getUniqueId();
+    if (instance > 0)
+        name += ("-" + asString(instance));
+    return name + ".bankindex";
+}
+
+
+void Bank::loadIndex(void)
+{
+    indexLoaded = true;
+    indexChanged = false;
+    bankIndex.clear();
+    string filename = indexFile();
+    if (!isRegFile(filename))
+    {
+        indexChanged = true; // so the first scan writes one
+        return;
+    }
+    XMLwrapper *xml = new XMLwrapper(synth);
+    if (!xml->loadXMLfile(filename) || !xml->enterbranch("BANKINDEX"))
+    {
+        synth->getRuntime().Log("Bank index " + filename + " unreadable, rebuilding it");
         delete xml;
+        indexChanged = true;
+        return;
     }
-    return 0;
+    int dirs = xml->getpar("count", 0, 0, INT_MAX);
+    for (int i = 0; i < dirs; ++i)
+    {
+        if (!xml->enterbranch("DIR", i))
+            continue;
+        string path = xml->getparstr("path");
+        if (!path.empty())
+        {
+            IndexDir &dir = bankIndex [path];
+            dir.mtime = xml->getpar("mtime", 0, INT_MIN, INT_MAX);
+            dir.isBank = xml->getparbool("bank", 0);
+            dir.listed = xml->getparbool("listed", 0);
+            int files = xml->getpar("count", 0, 0, INT_MAX);
+            for (int j = 0; j < files; ++j)
+            {
+                if (!xml->enterbranch("FILE", j))
+                    continue;
+                string name = xml->getparstr("name");
+                if (!name.empty())
+                {
+                    IndexEntry &entry = dir.instruments [name];
+                    entry.mtime = xml->getpar("mtime", 0, INT_MIN, INT_MAX);
+                    entry.size = xml->getpar("size", 0, 0, INT_MAX);
+                    entry.checked = xml->getparbool("checked", 0);
+                    entry.ADDsynth_used = xml->getparbool("ADDsynth_used", 0);
+                    entry.SUBsynth_used = xml->getparbool("SUBsynth_used", 0);
+                    entry.PADsynth_used = xml->getparbool("PADsynth_used", 0);
+                    dir.order.push_back(name);
+                }
+                xml->exitbranch();
+            }
+            if (dir.order.size() != dir.instruments.size())
+                dir.listed = false; // damaged, read the directory again
+        }
+        xml->exitbranch();
+    }
+    xml->exitbranch();
+    delete xml;
+}
+
+
+void Bank::saveIndex(void)
+{
+    string filename = indexFile();
+    synth->getRuntime().xmlType = XML_BANK;
+    XMLwrapper *xml = new XMLwrapper(synth);
+    xml->beginbranch("BANKINDEX");
+    xml->addpar("count", bankIndex.size());
+    int i = 0;
+    IndexDirMap::const_iterator it;
+    for (it = bankIndex.begin(); it != bankIndex.end(); ++it, ++i)
+    {
+        const IndexDir &dir = it->second;
+        xml->beginbranch("DIR", i);
+        xml->addparstr("path", it->first);
+        xml->addpar("mtime", dir.mtime);
+        xml->addparbool("bank", dir.isBank);
+        xml->addparbool("listed", dir.listed);
+        xml->addpar("count", dir.order.size());
+        for (size_t j = 0; j < dir.order.size(); ++j)
+        {
+            IndexEntryMap::const_iterator entry = dir.instruments.find(dir.order [j]);
+            if (entry == dir.instruments.end())
+                continue;
+            xml->beginbranch("FILE", j);
+            xml->addparstr("name", entry->first);
+            xml->addpar("mtime", entry->second.mtime);
+            xml->addpar("size", entry->second.size);
+            xml->addparbool("checked", entry->second.checked);
+            xml->addparbool("ADDsynth_used", entry->second.ADDsynth_used);
+            xml->addparbool("SUBsynth_used", entry->second.SUBsynth_used);
+            xml->addparbool("PADsynth_used", entry->second.PADsynth_used);
+            xml->endbranch();
+        }
+        xml->endbranch();
+    }
+    xml->endbranch();
+    if (xml->saveXMLfile(filename))
+        indexChanged = false;
+    else
+        synth->getRuntime().Log("Failed to save bank index to " + filename);
+    delete xml;
 }
 
 
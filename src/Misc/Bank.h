@@ -92,6 +92,43 @@ typedef map<size_t, RootEntry> RootEntryMap; // Maps root id to root entry.
 
 typedef map<size_t, map<string, size_t> > BankHintsMap;
 
+
+typedef struct _IndexEntry
+{
+    int mtime;
+    int size;
+    bool checked; // engines below are valid
+    bool PADsynth_used;
+    bool ADDsynth_used;
+    bool SUBsynth_used;
+    _IndexEntry()
+        :mtime(0),
+         size(0),
+         checked(false),
+         PADsynth_used(false),
+         ADDsynth_used(false),
+         SUBsynth_used(false)
+    {
+
+    }
+} IndexEntry; // What was last found in an instrument file.
+
+typedef map<string, IndexEntry> IndexEntryMap; // Maps instrument leafname to index entry.
+
+typedef struct _IndexDir
+{
+    int mtime;
+    bool isBank;
+    bool listed; // instruments holds every instrument file in it
+    bool seen; // during this rescan
+    IndexEntryMap instruments;
+    vector<string> order; // as readdir found them
+    _IndexDir(): mtime(0), isBank(false), listed(false), seen(false)
+    {}
+} IndexDir; // What was last found in a directory under a root.
+
+typedef map<string, IndexDir> IndexDirMap; // Maps directory path to index dir.
+
 class SynthEngine;
 
 class Bank : private MiscFuncs
@@ -124,10 +161,11 @@ class Bank : private MiscFuncs
         bool newIDbank(string newbankdir, unsigned int bankID);
         bool newbankfile(string newbankdir);
         bool removebank(unsigned int bankID);
-        void rescanforbanks(void);
+        void rescanforbanks(bool full = false); // full ignores the index
         void clearBankrootDirlist(void);
         void removeRoot(size_t rootID);
         bool changeRootID(size_t oldID, size_t newID);
+        int convertBankDir(string dirname, bool toBinary); // returns count converted or -1
 
         bool setCurrentRootID(size_t newRootID);
         bool setCurrentBankID(size_t newBankID, bool ignoreMissing = false);
@@ -155,6 +193,7 @@ class Bank : private MiscFuncs
 
         void deletefrombank(size_t rootID, size_t bankID, unsigned int pos);
         void scanrootdir(int root_idx); // scans a root dir for banks
+        void scanRoots(const vector<size_t>& rootIDs);
         size_t add_bank(string name, string, size_t rootID);
         bool check_bank_duplicate(string alias);
 
@@ -175,6 +214,67 @@ class Bank : private MiscFuncs
 
         void addDefaultRootDirs();
 
+        // Saved between runs so that a rescan only needs to look
+        // inside directories and files that have changed since.
+        IndexDirMap bankIndex;
+        bool indexLoaded;
+        bool indexChanged;
+        string indexFile(void);
+        void loadIndex(void);
+        void saveIndex(void);
+        bool listBankDir(const string& bankdirname, vector<string>& found);
+        bool readBankDir(const string& dirname, bool &isBank, vector<string>& files);
+        void relistIndex(IndexDir &cached, int mtime, bool isBank, const vector<string>& files);
+        void checkEngines(size_t rootID, size_t bankID, int pos);
+
+        // Scanning is done in passes, each spread over several threads.
+        // The threads only fill in their own entries below and read the
+        // index, everything else is then merged in root and name order
+        // on the calling thread, so bank IDs come out as they always did.
+        struct scanDir {
+            string name; // under the root
+            string path;
+            int mtime;
+            bool changed; // since the index saw it
+            bool isBank;
+            vector<string> files;
+            string error;
+        };
+        struct scanRoot {
+            size_t rootID;
+            string path;
+            vector<scanDir> dirs;
+            string error;
+        };
+        struct engineCheck {
+            size_t rootID;
+            size_t bankID;
+            int pos;
+            string dir;
+            string filename;
+            int mtime;
+            int size;
+            bool found;
+            bool fresh; // had to open the file
+            bool PADsynth_used;
+            bool ADDsynth_used;
+            bool SUBsynth_used;
+            vector<string> errors; // from reading the file, logged by applyEngines()
+        };
+        vector<scanRoot> scanning;
+        vector<scanDir*> scanDirs;
+        vector<engineCheck> pendingEngines;
+        bool deferEngines;
+
+        static void _listRoot(void *arg, size_t index);
+        static void _examineDir(void *arg, size_t index);
+        static void _probeEngines(void *arg, size_t index);
+        void listRoot(scanRoot &root);
+        void examineDir(scanDir &dir);
+        void mergeRoot(scanRoot &root);
+        void probeEngines(engineCheck &check);
+        void applyEngines(const engineCheck &check);
+
         size_t getNewRootIndex();
         size_t getNewBankIndex(size_t rootID);
 };
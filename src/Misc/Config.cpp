@@ -66,6 +66,7 @@ static struct argp_option cmd_options[] = {
     {"alsa-midi",         'a',  "<device>",   1,  "use alsa midi input" },
     {"define-root",       'D',  "<path>",     0,  "define path to new bank root"},
     {"buffersize",        'b',  "<size>",     0,  "set internal buffer size" },
+    {"alsa-periods",      'p',  "<count>",    0,  "set number of alsa audio periods" },
     {"no-gui",            'i',  NULL,         0,  "disable gui"},
     {"gui",               'I',  NULL,         0,  "enable gui"},
     {"no-cmdline",        'c',  NULL,         0,  "disable command line interface"},
@@ -111,6 +112,8 @@ Config::Config(SynthEngine *_synth, int argc, char **argv) :
     connectJackaudio(true),
     alsaAudioDevice("default"),
     alsaMidiDevice("default"),
+    alsaPeriods(2),
+    alsaDither(0),
     loadDefaultState(false),
     Interpolation(0),
     checksynthengines(1),
@@ -131,7 +134,6 @@ Config::Config(SynthEngine *_synth, int argc, char **argv) :
     single_row_panel(1),
     NumAvailableParts(NUM_MIDI_CHANNELS),
     currentPart(0),
-    padApply(0xffff),
     channelSwitchType(0),
     channelSwitchCC(128),
     channelSwitchValue(0),
@@ -590,6 +592,8 @@ bool Config::extractConfigData(XMLwrapper *xml)
     // alsa settings
     alsaAudioDevice = xml->getparstr("linux_alsa_audio_dev");
     alsaMidiDevice = xml->getparstr("linux_alsa_midi_dev");
+    alsaPeriods = xml->getpar("linux_alsa_periods", alsaPeriods, 2, 16);
+    alsaDither = xml->getpar("linux_alsa_dither", alsaDither, 0, 1);
 
     // jack settings
     jackServer = xml->getparstr("linux_jack_server");
@@ -662,6 +666,8 @@ void Config::addConfigXML(XMLwrapper *xmltree)
 
     xmltree->addparstr("linux_alsa_audio_dev", alsaAudioDevice);
     xmltree->addparstr("linux_alsa_midi_dev", alsaMidiDevice);
+    xmltree->addpar("linux_alsa_periods", alsaPeriods);
+    xmltree->addpar("linux_alsa_dither", alsaDither);
 
     xmltree->addparstr("linux_jack_server", jackServer);
     xmltree->addparstr("linux_jack_midi_dev", jackMidiDevice);
@@ -718,7 +724,7 @@ bool Config::restoreSessionData(string sessionfile, bool startup)
         goto end_game;
     }
 
-    if (!xml->loadXMLfile(sessionfile))
+    if (!xml->loadXMLfile(sessionfile, true))
     {
         Log("Failed to load xml file " + sessionfile);
         goto end_game;
@@ -730,7 +736,9 @@ bool Config::restoreSessionData(string sessionfile, bool startup)
         ok = extractConfigData(xml); // this still needs improving
         if (ok)
         {
+            synth->stageParts(xml);
             ok = synth->getfromXML(xml);
+            synth->releaseStaged();
             if (ok)
                 synth->getRuntime().stateChanged = true;
         }
@@ -1095,6 +1103,16 @@ static error_t parse_cmds (int key, char *arg, struct argp_state *state)
             settings->Buffersize = Config::string2int(string(arg));
             break;
 
+        case 'p':
+            settings->configChanged = true;
+            num = Config::string2int(string(arg));
+            if (num < 2)
+                num = 2;
+            else if (num > 16)
+                num = 16;
+            settings->alsaPeriods = num;
+            break;
+
         case 'D':
             if (arg)
                 settings->rootDefine = string(arg);
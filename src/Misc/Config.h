@@ -119,6 +119,8 @@ class Config : public MiscFuncs
 
         string        alsaAudioDevice;
         string        alsaMidiDevice;
+        int           alsaPeriods; // periods in the alsa audio buffer
+        int           alsaDither; // 0 none, 1 triangular
         string        nameTag;
 
         bool          loadDefaultState;
@@ -144,7 +146,6 @@ class Config : public MiscFuncs
         int           single_row_panel;
         int           NumAvailableParts;
         int           currentPart;
-        unsigned int  padApply;
         unsigned char channelSwitchType;
         unsigned char channelSwitchCC;
         unsigned char channelSwitchValue;
@@ -0,0 +1,75 @@
+/*
+    JobPool.cpp - run a batch of independent jobs on several threads
+
+    Copyright 2016, Will Godfrey & others
+
+    This file is part of yoshimi, which is free software: you can redistribute
+    it and/or modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either version 2 of
+    the License, or (at your option) any later version.
+
+    yoshimi is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.   See the GNU General Public License (version 2 or
+    later) for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    yoshimi; if not, write to the Free Software Foundation, Inc., 51 Franklin
+    Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "Misc/JobPool.h"
+
+int JobPool::processors(void)
+{
+    long found = sysconf(_SC_NPROCESSORS_ONLN);
+    if (found < 1)
+        return 1;
+    if (found > JOBPOOL_MAX_THREADS)
+        return JOBPOOL_MAX_THREADS;
+    return found;
+}
+
+
+void JobPool::run(Job job, void *arg, size_t count, int threads)
+{
+    if (count == 0)
+        return;
+    if (threads <= 0)
+        threads = processors();
+    if (threads > JOBPOOL_MAX_THREADS)
+        threads = JOBPOOL_MAX_THREADS;
+    if ((size_t)threads > count)
+        threads = count;
+
+    batch work;
+    work.job = job;
+    work.arg = arg;
+    work.count = count;
+    work.next = 0;
+
+    pthread_t helpers[JOBPOOL_MAX_THREADS];
+    int started = 0;
+    for (int i = 1; i < threads; ++i)
+    {
+        if (pthread_create(&helpers[started], NULL, worker, &work))
+            break; // the rest will be done by those we have
+        ++started;
+    }
+    worker(&work);
+    for (int i = 0; i < started; ++i)
+        pthread_join(helpers[i], NULL);
+}
+
+
+void *JobPool::worker(void *arg)
+{
+    batch *work = (batch*) arg;
+    size_t index;
+    while ((index = __sync_fetch_and_add(&work->next, 1)) < work->count)
+        work->job(work->arg, index);
+    return NULL;
+}
@@ -0,0 +1,55 @@
+/*
+    JobPool.h - run a batch of independent jobs on several threads
+
+    Copyright 2016, Will Godfrey & others
+
+    This file is part of yoshimi, which is free software: you can redistribute
+    it and/or modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either version 2 of
+    the License, or (at your option) any later version.
+
+    yoshimi is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.   See the GNU General Public License (version 2 or
+    later) for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    yoshimi; if not, write to the Free Software Foundation, Inc., 51 Franklin
+    Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef JOBPOOL_H
+#define JOBPOOL_H
+
+#include <cstddef>
+
+#define JOBPOOL_MAX_THREADS 32
+
+/*
+ * Each job gets its own index and must only touch data belonging to
+ * that index, or data nobody is changing while the batch runs.
+ * Threads only last as long as one batch, and the calling thread
+ * works through the list as well, so if no thread can be started
+ * everything still gets done, just one after another.
+ */
+class JobPool
+{
+    public:
+        typedef void (*Job)(void *arg, size_t index);
+
+        // returns when job(arg, i) has finished for every i below count
+        // threads = 0 is one per processor
+        static void run(Job job, void *arg, size_t count, int threads = 0);
+        static int processors(void);
+
+    private:
+        struct batch {
+            Job job;
+            void *arg;
+            size_t count;
+            size_t next;
+        };
+        static void *worker(void *arg);
+};
+
+#endif
@@ -0,0 +1,55 @@
+/*
+    Notifier.cpp - wakes a helper thread when there is work for it
+
+    Copyright 2016, Will Godfrey & others
+
+    This file is part of yoshimi, which is free software: you can redistribute
+    it and/or modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either version 2 of
+    the License, or (at your option) any later version.
+
+    yoshimi is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.   See the GNU General Public License (version 2 or
+    later) for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    yoshimi; if not, write to the Free Software Foundation, Inc., 51 Franklin
+    Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <unistd.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "Misc/Notifier.h"
+
+void Notifier::post(void)
+{
+    __sync_fetch_and_add(&pending, 1);
+    if (sleeping)
+        syscall(SYS_futex, &pending, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+
+bool Notifier::wait(int ms)
+{
+    if (__sync_lock_test_and_set(&pending, 0))
+        return true;
+
+    // the barrier pairs with the one in post(), so either post() sees
+    // we are sleeping or we see what it posted
+    sleeping = 1;
+    __sync_synchronize();
+    if (pending == 0)
+    {
+        struct timespec limit;
+        limit.tv_sec = ms / 1000;
+        limit.tv_nsec = (ms % 1000) * 1000000L;
+        syscall(SYS_futex, &pending, FUTEX_WAIT_PRIVATE, 0,
+                (ms < 0) ? NULL : &limit, NULL, 0);
+    }
+    sleeping = 0;
+    return __sync_lock_test_and_set(&pending, 0) != 0;
+}
@@ -0,0 +1,40 @@
+/*
+    Notifier.h - wakes a helper thread when there is work for it
+
+    Copyright 2016, Will Godfrey & others
+
+    This file is part of yoshimi, which is free software: you can redistribute
+    it and/or modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either version 2 of
+    the License, or (at your option) any later version.
+
+    yoshimi is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.   See the GNU General Public License (version 2 or
+    later) for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    yoshimi; if not, write to the Free Software Foundation, Inc., 51 Franklin
+    Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef NOTIFIER_H
+#define NOTIFIER_H
+
+// One consumer thread waits, any number of producers post.
+// post() never blocks, and only makes a system call if the
+// consumer is actually asleep, so it is fine on the audio thread.
+class Notifier
+{
+    public:
+        Notifier() : pending(0), sleeping(0) { }
+        ~Notifier() { }
+        void post(void);
+        bool wait(int ms); // ms < 0 waits for ever, true if something was posted
+
+    private:
+        volatile int pending;
+        volatile int sleeping;
+};
+
+#endif
@@ -72,9 +72,7 @@ Part::Part(Microtonal *microtonal_, FFTwrapper *fft_, SynthEngine *_synth) :
         kit[n].padpars = NULL;
     }
 
-    kit[0].adpars = new ADnoteParameters(fft, synth);
-    kit[0].subpars = new SUBnoteParameters(synth);
-    kit[0].padpars = new PADnoteParameters(fft, synth);
+    pthread_mutex_init(&kitMutex, NULL);
 
     // Part's Insertion Effects init
     for (int nefx = 0; nefx < NUM_PART_EFX; ++nefx)
@@ -149,6 +147,7 @@ void Part::setNoteMap(int keyshift)
 
 void Part::defaultsinstrument(void)
 {
+    changed();
     Pname = "Simple Sound";
 
     info.Ptype = 0;
@@ -176,9 +175,12 @@ void Part::defaultsinstrument(void)
     }
     kit[0].Penabled = 1;
     kit[0].Padenabled = 1;
-    kit[0].adpars->defaults();
-    kit[0].subpars->defaults();
-    kit[0].padpars->defaults();
+    if (materialised())
+    {
+        kit[0].adpars->defaults();
+        kit[0].subpars->defaults();
+        kit[0].padpars->defaults();
+    }
 
     for (int nefx = 0; nefx < NUM_PART_EFX; ++nefx)
     {
@@ -225,6 +227,7 @@ Part::~Part()
         if (kit[n].padpars)
             delete kit[n].padpars;
     }
+    pthread_mutex_destroy(&kitMutex);
     fftwf_free(partoutl);
     fftwf_free(partoutr);
     fftwf_free(tmpoutl);
@@ -809,8 +812,9 @@ void Part::SetController(unsigned int type, int par)
 
         case C_resonance_bandwidth:
             ctl->setresonancebw(par);
-            kit[0].adpars->GlobalPar.Reson->sendcontroller(C_resonance_bandwidth,
-                                                           ctl->resonancebandwidth.relbw);
+            if (kit[0].adpars)
+                kit[0].adpars->GlobalPar.Reson->sendcontroller(C_resonance_bandwidth,
+                                                               ctl->resonancebandwidth.relbw);
             break;
     }
 }
@@ -1130,6 +1134,7 @@ void Part::setkititemstatus(int kititem, int Penabled_)
 {
     if (kititem == 0 || kititem >= NUM_KIT_ITEMS)
         return; // nonexistent kit item and the first kit item is always enabled
+    changed(kititem);
     kit[kititem].Penabled = Penabled_;
 
     bool resetallnotes = false;
@@ -1193,6 +1198,8 @@ void Part::add2XMLinstrument(XMLwrapper *xml)
 
     for (int i = 0; i < NUM_KIT_ITEMS; ++i)
     {
+        if (xml->begincached(xmlKit[i]))
+            continue;
         xml->beginbranch("INSTRUMENT_KIT_ITEM",i);
         xml->addparbool("enabled", kit[i].Penabled);
         if (kit[i].Penabled)
@@ -1230,6 +1237,7 @@ void Part::add2XMLinstrument(XMLwrapper *xml)
             }
         }
         xml->endbranch();
+        xml->endcached(xmlKit[i]);
     }
     xml->endbranch();
 
@@ -1314,7 +1322,7 @@ int Part::loadXMLinstrument(string filename)
         return 0;
     }
 
-    if (!xml->loadXMLfile(filename))
+    if (!xml->loadXMLfile(filename, true))
     {
         synth->getRuntime().Log("Part: loadXML failed to load instrument file " + filename);
         delete xml;
@@ -1338,6 +1346,41 @@ int Part::loadXMLinstrument(string filename)
 }
 
 
+/*
+ * Everything loadXMLinstrument() would have changed, taken from a part
+ * that has already loaded it. Only pointers and small values move, so
+ * it's quick. As with loading, the part must be disabled meanwhile.
+ */
+void Part::swapInstrument(Part *other)
+{
+    if (materialised())
+        other->materialise(); // the GUI may be showing them
+    changed();
+    other->changed();
+    swap(Pname, other->Pname);
+    swap(info.Ptype, other->info.Ptype);
+    swap(info.Pauthor, other->info.Pauthor);
+    swap(info.Pcomments, other->info.Pcomments);
+    swap(Pkitmode, other->Pkitmode);
+    swap(Pkitfade, other->Pkitfade);
+    swap(Pdrummode, other->Pdrummode);
+    swap(Pfrand, other->Pfrand);
+    for (int n = 0; n < NUM_KIT_ITEMS; ++n)
+        swap(kit[n], other->kit[n]);
+    for (int nefx = 0; nefx < NUM_PART_EFX; ++nefx)
+    {
+        // a type change asked for while the load was waiting is still wanted
+        int wanted = partefx[nefx]->requestedeffect();
+        swap(partefx[nefx], other->partefx[nefx]);
+        swap(Pefxroute[nefx], other->Pefxroute[nefx]);
+        swap(Pefxbypass[nefx], other->Pefxbypass[nefx]);
+        partefx[nefx]->cleanup();
+        if (wanted >= 0)
+            partefx[nefx]->requesteffect(wanted);
+    }
+}
+
+
 void Part::applyparameters(void)
 {
     for (int n = 0; n < NUM_KIT_ITEMS; ++n)
@@ -1346,8 +1389,39 @@ void Part::applyparameters(void)
 }
 
 
+// new parameters are already at their defaults
+void Part::materialise(void)
+{
+    if (materialised())
+        return;
+    pthread_mutex_lock(&kitMutex);
+    if (!kit[0].adpars)
+    {
+        ADnoteParameters *adpars = new ADnoteParameters(fft, synth);
+        kit[0].subpars = new SUBnoteParameters(synth);
+        kit[0].padpars = new PADnoteParameters(fft, synth);
+        __sync_synchronize();
+        kit[0].adpars = adpars; // last, it's what materialised() tests
+    }
+    pthread_mutex_unlock(&kitMutex);
+}
+
+
+void Part::changed(int kititem)
+{
+    if (kititem >= NUM_KIT_ITEMS)
+        return;
+    if (kititem >= 0)
+        xmlKit[kititem].touch();
+    else
+        for (int n = 0; n < NUM_KIT_ITEMS; ++n)
+            xmlKit[n].touch();
+}
+
+
 void Part::getfromXMLinstrument(XMLwrapper *xml)
 {
+    changed();
     string tempname;
     if (xml->enterbranch("INFO"))
     {
@@ -1370,6 +1444,7 @@ void Part::getfromXMLinstrument(XMLwrapper *xml)
     }
     else
     {
+        materialise();
         Pkitmode = xml->getpar127("kit_mode", Pkitmode);
         Pkitfade = xml->getparbool("kit_crossfade", Pkitfade);
         Pdrummode = xml->getparbool("drum_mode", Pdrummode);
@@ -1433,7 +1508,7 @@ void Part::getfromXMLinstrument(XMLwrapper *xml)
 }
 
 
-void Part::getfromXML(XMLwrapper *xml)
+void Part::getfromXML(XMLwrapper *xml, Part *prepared)
 {
     Penabled = xml->getparbool("enabled", Penabled);
 
@@ -1470,14 +1545,26 @@ void Part::getfromXML(XMLwrapper *xml)
 
     if (xml->enterbranch("INSTRUMENT"))
     {
-        Pname = ""; // clear out any previous name
-        getfromXMLinstrument(xml);
-        xml->exitbranch();
-        applyparameters();
+        if (prepared)
+        {
+            float frand = Pfrand; // a part setting, read above
+            swapInstrument(prepared);
+            Pfrand = frand;
+            xml->exitbranch();
+        }
+        else
+        {
+            Pname = ""; // clear out any previous name
+            getfromXMLinstrument(xml);
+            xml->exitbranch();
+            applyparameters();
+        }
     }
     if (xml->enterbranch("CONTROLLER"))
     {
         ctl->getfromXML(xml);
         xml->exitbranch();
     }
+    if (Penabled)
+        materialise();
 }
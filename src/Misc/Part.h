@@ -27,11 +27,13 @@
 #define PART_H
 
 #include <list>
+#include <pthread.h>
 
 using namespace std;
 
 #include "Misc/MiscFuncs.h"
 #include "Misc/SynthHelper.h"
+#include "Misc/XMLwrapper.h"
 
 class ADnoteParameters;
 class SUBnoteParameters;
@@ -40,7 +42,6 @@ class ADnote;
 class SUBnote;
 class PADnote;
 class Controller;
-class XMLwrapper;
 class Microtonal;
 class EffectMgr;
 class FFTwrapper;
@@ -62,6 +63,11 @@ class Part : private MiscFuncs, SynthHelper
         void applyparameters(void);
         void cleanup(void);
 
+        // Kit item 0's parameters are only made when the part is first
+        // enabled, loaded or edited. Most parts never are.
+        void materialise(void);
+        bool materialised(void) { return kit[0].adpars != NULL; }
+
         // Midi commands implemented
         void NoteOn(int note, int velocity, int masterkeyshift);
         void NoteOff(int note);
@@ -73,11 +79,17 @@ class Part : private MiscFuncs, SynthHelper
 
         bool saveXML(string filename); // true for load ok, otherwise false
         int loadXMLinstrument(string filename);
+        void swapInstrument(Part *other); // exchange all that an instrument file sets
         void add2XML(XMLwrapper *xml);
         void add2XMLinstrument(XMLwrapper *xml);
-        void getfromXML(XMLwrapper *xml);
+        void getfromXML(XMLwrapper *xml, Part *prepared = NULL); // prepared has the instrument already loaded
         void getfromXMLinstrument(XMLwrapper *xml);
 
+        // kit items as last saved, the rest of the part is small enough
+        // to always save again
+        XMLcache xmlKit[NUM_KIT_ITEMS];
+        void changed(int kititem = -1); // -1 for all of them
+
         Controller *ctl;
 
         // part's kit
@@ -189,6 +201,7 @@ class Part : private MiscFuncs, SynthHelper
         float oldfreq; // for portamento
         int partMuted;
         bool killallnotes;
+        pthread_mutex_t kitMutex;
 
         // MonoMem stuff
         list<unsigned char> monomemnotes; // held notes.
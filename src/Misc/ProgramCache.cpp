@@ -0,0 +1,305 @@
+/*
+    ProgramCache.cpp - instruments decoded ahead of program changes
+
+    Copyright 2016, Will Godfrey & others
+
+    This file is part of yoshimi, which is free software: you can redistribute
+    it and/or modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either version 2 of
+    the License, or (at your option) any later version.
+
+    yoshimi is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.   See the GNU General Public License (version 2 or
+    later) for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    yoshimi; if not, write to the Free Software Foundation, Inc., 51 Franklin
+    Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <sys/stat.h>
+
+#include "Misc/ProgramCache.h"
+#include "Misc/SynthEngine.h"
+#include "Misc/Part.h"
+#include "DSP/FFTwrapper.h"
+#include "Params/ADnoteParameters.h"
+#include "Params/PADnoteParameters.h"
+
+ProgramCache::ProgramCache(SynthEngine *_synth) :
+    total(0),
+    limit((size_t)PROGRAM_CACHE_MB << 20),
+    prefetchHandle(0),
+    running(false),
+    fft(NULL),
+    synth(_synth)
+{
+    pthread_mutex_init(&lock, NULL);
+}
+
+
+ProgramCache::~ProgramCache()
+{
+    stop();
+    if (fft)
+        delete fft;
+    pthread_mutex_destroy(&lock);
+}
+
+
+bool ProgramCache::start(void)
+{
+    if (!fft)
+        fft = new FFTwrapper(synth->oscilsize);
+    running = true;
+    if (synth->getRuntime().startThread(&prefetchHandle, _prefetchThread, this, false, 0, false, "Prefetch"))
+        return true;
+    running = false;
+    prefetchHandle = 0;
+    return false;
+}
+
+
+void ProgramCache::stop(void)
+{
+    running = false;
+    wake.post();
+    if (prefetchHandle)
+        pthread_join(prefetchHandle, NULL);
+    prefetchHandle = 0;
+    flush();
+}
+
+
+Part *ProgramCache::take(const string& filename)
+{
+    Part *part = NULL;
+    time_t mtime = 0;
+    off_t size = 0;
+    pthread_mutex_lock(&lock);
+    list<entry>::iterator it;
+    for (it = entries.begin(); it != entries.end(); ++it)
+    {
+        if (it->filename == filename)
+        {
+            part = it->part;
+            mtime = it->mtime;
+            size = it->size;
+            total -= it->bytes;
+            entries.erase(it);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    if (!part)
+        return NULL;
+
+    time_t nowMtime;
+    off_t nowSize;
+    if (!fileState(filename, nowMtime, nowSize) || nowMtime != mtime || nowSize != size)
+    {   // saved over since we read it
+        delete part;
+        return NULL;
+    }
+    return part;
+}
+
+
+void ProgramCache::used(const string& filename, const vector<string>& neighbours)
+{
+    vector<Part*> victims;
+    pthread_mutex_lock(&lock);
+    recent.remove(filename);
+    recent.push_front(filename);
+    if (recent.size() > PROGRAM_CACHE_RECENT)
+        recent.pop_back();
+
+    // the one just loaded, its neighbours, then the others by age
+    wanted.clear();
+    wanted.push_back(filename);
+    for (size_t i = 0; i < neighbours.size(); ++i)
+        if (!neighbours [i].empty() && neighbours [i] != filename)
+            wanted.push_back(neighbours [i]);
+    list<string>::iterator it = recent.begin();
+    for (++it; it != recent.end(); ++it)
+    {
+        bool found = false;
+        for (size_t i = 0; i < wanted.size() && !found; ++i)
+            found = (wanted [i] == *it);
+        if (!found)
+            wanted.push_back(*it);
+    }
+    trim(victims);
+    pthread_mutex_unlock(&lock);
+    for (size_t i = 0; i < victims.size(); ++i)
+        delete victims [i];
+    wake.post();
+}
+
+
+void ProgramCache::flush(void)
+{
+    vector<Part*> victims;
+    pthread_mutex_lock(&lock);
+    list<entry>::iterator it;
+    for (it = entries.begin(); it != entries.end(); ++it)
+        victims.push_back(it->part);
+    entries.clear();
+    total = 0;
+    pthread_mutex_unlock(&lock);
+    for (size_t i = 0; i < victims.size(); ++i)
+        delete victims [i];
+}
+
+
+void *ProgramCache::_prefetchThread(void *arg)
+{
+    return static_cast<ProgramCache*>(arg)->prefetchThread();
+}
+
+
+void *ProgramCache::prefetchThread(void)
+{
+    while (running && synth->getRuntime().runSynth)
+    {
+        // the most wanted one that isn't ready yet, if it would fit
+        string next;
+        size_t rank = 0;
+        pthread_mutex_lock(&lock);
+        for (; rank < wanted.size(); ++rank)
+        {
+            if (!isCached(wanted [rank]))
+            {
+                next = wanted [rank];
+                break;
+            }
+        }
+        bool full = (total >= limit);
+        pthread_mutex_unlock(&lock);
+        if (next.empty() || full)
+        {
+            wake.wait(-1);
+            continue;
+        }
+
+        time_t mtime;
+        off_t size;
+        Part *part = NULL;
+        if (fileState(next, mtime, size))
+        {
+            SynthEngine::LocalRandom local(mtime + size);
+            part = new Part(&synth->microtonal, fft, synth);
+            if (!part->loadXMLinstrument(next))
+            {
+                delete part;
+                part = NULL;
+            }
+        }
+
+        vector<Part*> victims;
+        pthread_mutex_lock(&lock);
+        rank = 0; // the list may have changed meanwhile
+        while (rank < wanted.size() && wanted [rank] != next)
+            ++rank;
+        if (rank < wanted.size())
+        {
+            if (part)
+            {
+                entry fresh;
+                fresh.filename = next;
+                fresh.mtime = mtime;
+                fresh.size = size;
+                fresh.part = part;
+                fresh.bytes = measure(part);
+                entries.push_back(fresh);
+                total += fresh.bytes;
+                part = NULL;
+                trim(victims);
+            }
+            else // unreadable, don't keep trying
+                wanted.erase(wanted.begin() + rank);
+        }
+        pthread_mutex_unlock(&lock);
+        if (part) // no longer wanted
+            delete part;
+        for (size_t i = 0; i < victims.size(); ++i)
+            delete victims [i];
+    }
+    return NULL;
+}
+
+
+// must be called with the lock held
+bool ProgramCache::isCached(const string& filename)
+{
+    list<entry>::iterator it;
+    for (it = entries.begin(); it != entries.end(); ++it)
+        if (it->filename == filename)
+            return true;
+    return false;
+}
+
+
+bool ProgramCache::fileState(const string& filename, time_t &mtime, off_t &size)
+{
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+        return false;
+    mtime = st.st_mtime;
+    size = st.st_size;
+    return true;
+}
+
+
+// Only roughly, but the PAD samples that dominate are counted exactly.
+size_t ProgramCache::measure(Part *part)
+{
+    size_t bytes = sizeof(Part) + synth->bufferbytes * (4 + 2 * (NUM_PART_EFX + 1));
+    // oscillator tables of one kit item, a pair per voice and the PAD one
+    size_t oscil = (2 * NUM_VOICES + 2) * 8 * synth->oscilsize * sizeof(float);
+    for (int n = 0; n < NUM_KIT_ITEMS; ++n)
+    {
+        if (part->kit[n].adpars)
+            bytes += sizeof(ADnoteParameters) + oscil;
+        if (!part->kit[n].padpars)
+            continue;
+        for (int s = 0; s < PAD_MAX_SAMPLES; ++s)
+            if (part->kit[n].padpars->sample[s].smp)
+                bytes += (part->kit[n].padpars->sample[s].size + 5) * sizeof(float);
+    }
+    return bytes;
+}
+
+
+/*
+ * Must be called with the lock held. Drops whatever is least wanted
+ * until everything fits, which may be the one just added, and stops
+ * the prefetcher going after anything less wanted than that. Dropped
+ * parts are passed back to be deleted after the lock is released.
+ */
+void ProgramCache::trim(vector<Part*>& victims)
+{
+    while (total > limit && !entries.empty())
+    {
+        list<entry>::iterator worst = entries.begin();
+        size_t worstRank = 0;
+        list<entry>::iterator it;
+        for (it = entries.begin(); it != entries.end(); ++it)
+        {
+            size_t rank = 0;
+            while (rank < wanted.size() && wanted [rank] != it->filename)
+                ++rank;
+            if (rank >= worstRank)
+            {
+                worst = it;
+                worstRank = rank;
+            }
+        }
+        victims.push_back(worst->part);
+        total -= worst->bytes;
+        if (worstRank < wanted.size()) // anything after it would go too
+            wanted.resize(worstRank);
+        entries.erase(worst);
+    }
+}
@@ -0,0 +1,99 @@
+/*
+    ProgramCache.h - instruments decoded ahead of program changes
+
+    Copyright 2016, Will Godfrey & others
+
+    This file is part of yoshimi, which is free software: you can redistribute
+    it and/or modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either version 2 of
+    the License, or (at your option) any later version.
+
+    yoshimi is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.   See the GNU General Public License (version 2 or
+    later) for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    yoshimi; if not, write to the Free Software Foundation, Inc., 51 Franklin
+    Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef PROGRAMCACHE_H
+#define PROGRAMCACHE_H
+
+#include <pthread.h>
+#include <sys/types.h>
+#include <string>
+#include <list>
+#include <vector>
+
+using namespace std;
+
+#include "Misc/MiscFuncs.h"
+#include "Misc/Notifier.h"
+
+#define PROGRAM_CACHE_MB 256 // most memory held by prepared instruments
+#define PROGRAM_CACHE_RECENT 8 // recently used programs kept ready
+#define PROGRAM_CACHE_NEIGHBOURS 2 // slots either side of the last program
+
+class Part;
+class SynthEngine;
+class FFTwrapper;
+
+/*
+ * Loading an instrument means parsing the file, building every kit
+ * item and generating the PAD samples, which can take seconds. Here
+ * a background thread does that ahead of time into spare parts, for
+ * the programs used most recently and their neighbours in the bank,
+ * so a program change that hits only has to swap the prepared kit
+ * into the real part. The least recently wanted are dropped first
+ * when the memory limit is reached.
+ */
+class ProgramCache : private MiscFuncs
+{
+    public:
+        ProgramCache(SynthEngine *_synth);
+        ~ProgramCache();
+        bool start(void);
+        void stop(void);
+
+        // a prepared instrument for this file, which now belongs to the
+        // caller, or NULL if there isn't one or the file has changed
+        Part *take(const string& filename);
+
+        // filename was just loaded, neighbours are the files around it
+        void used(const string& filename, const vector<string>& neighbours);
+        void flush(void);
+
+    private:
+        struct entry {
+            string filename;
+            time_t mtime;
+            off_t size;
+            Part *part;
+            size_t bytes;
+        };
+        list<entry> entries; // most recently wanted first
+        list<string> recent; // most recent first
+        vector<string> wanted; // in order of importance
+        size_t total;
+        size_t limit;
+
+        pthread_mutex_t lock;
+        Notifier wake;
+        pthread_t prefetchHandle;
+        bool running;
+        // parts are built with this, not the engine's, and it's kept
+        // until the engine has gone as their kits end up in its parts
+        FFTwrapper *fft;
+        static void *_prefetchThread(void *arg);
+        void *prefetchThread(void);
+
+        bool isCached(const string& filename);
+        bool fileState(const string& filename, time_t &mtime, off_t &size);
+        size_t measure(Part *part);
+        void trim(vector<Part*>& victims);
+        SynthEngine *synth;
+};
+
+#endif
@@ -0,0 +1,153 @@
+/*
+    SharedResources.cpp - read only data shared by every engine in the process
+
+    Copyright 2016, Will Godfrey & others
+
+    This file is part of yoshimi, which is free software: you can redistribute
+    it and/or modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either version 2 of
+    the License, or (at your option) any later version.
+
+    yoshimi is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.   See the GNU General Public License (version 2 or
+    later) for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    yoshimi; if not, write to the Free Software Foundation, Inc., 51 Franklin
+    Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <pthread.h>
+#include <map>
+
+using namespace std;
+
+#include "Misc/SharedResources.h"
+
+struct fftEntry {
+    FFTwrapper *fft;
+    int users;
+};
+
+struct baseEntry {
+    FFTFREQS table;
+    int users;
+    unsigned int released; // when users last went to 0
+};
+
+static pthread_mutex_t sharedLock = PTHREAD_MUTEX_INITIALIZER;
+static map<int, fftEntry> ffts;
+static map<unsigned long long, baseEntry> bases;
+static unsigned int releases = 0;
+static int spare = 0;
+
+
+FFTwrapper *SharedResources::getFFT(int fftsize)
+{
+    FFTwrapper *unused = NULL;
+    pthread_mutex_lock(&sharedLock);
+    map<int, fftEntry>::iterator it = ffts.find(fftsize);
+    if (it == ffts.end())
+    {
+        // planned without the lock, as for base functions below
+        pthread_mutex_unlock(&sharedLock);
+        fftEntry entry;
+        entry.fft = new FFTwrapper(fftsize);
+        entry.users = 0;
+        pthread_mutex_lock(&sharedLock);
+        pair<map<int, fftEntry>::iterator, bool> added = ffts.insert(make_pair(fftsize, entry));
+        it = added.first;
+        if (!added.second)
+            unused = entry.fft; // someone else got there first, use theirs
+    }
+    ++it->second.users;
+    FFTwrapper *fft = it->second.fft;
+    pthread_mutex_unlock(&sharedLock);
+    if (unused)
+        delete unused;
+    return fft;
+}
+
+
+void SharedResources::releaseFFT(FFTwrapper *fft)
+{
+    FFTwrapper *unused = NULL;
+    pthread_mutex_lock(&sharedLock);
+    for (map<int, fftEntry>::iterator it = ffts.begin(); it != ffts.end(); ++it)
+    {
+        if (it->second.fft != fft)
+            continue;
+        if (--it->second.users == 0)
+        {
+            unused = fft;
+            ffts.erase(it);
+        }
+        break;
+    }
+    pthread_mutex_unlock(&sharedLock);
+    if (unused)
+        delete unused; // plans have their own lock
+}
+
+
+const FFTFREQS *SharedResources::getBasefunction(unsigned long long key, int size, Builder build, void *arg)
+{
+    pthread_mutex_lock(&sharedLock);
+    map<unsigned long long, baseEntry>::iterator it = bases.find(key);
+    if (it == bases.end())
+    {
+        // made without the lock so nobody else waits for the FFT
+        pthread_mutex_unlock(&sharedLock);
+        baseEntry entry;
+        FFTwrapper::newFFTFREQS(&entry.table, size);
+        entry.users = 0;
+        entry.released = 0;
+        build(arg, &entry.table);
+        pthread_mutex_lock(&sharedLock);
+        pair<map<unsigned long long, baseEntry>::iterator, bool> added = bases.insert(make_pair(key, entry));
+        it = added.first;
+        if (!added.second)
+        {   // someone else got there first, use theirs
+            FFTwrapper::deleteFFTFREQS(&entry.table);
+            if (it->second.users == 0)
+                --spare;
+        }
+    }
+    else if (it->second.users == 0)
+        --spare;
+    ++it->second.users;
+    const FFTFREQS *table = &it->second.table;
+    pthread_mutex_unlock(&sharedLock);
+    return table;
+}
+
+
+void SharedResources::releaseBasefunction(const FFTFREQS *table)
+{
+    pthread_mutex_lock(&sharedLock);
+    map<unsigned long long, baseEntry>::iterator it;
+    for (it = bases.begin(); it != bases.end(); ++it)
+    {
+        if (&it->second.table != table)
+            continue;
+        if (--it->second.users == 0)
+        {
+            it->second.released = ++releases;
+            ++spare;
+        }
+        break;
+    }
+    while (spare > SHARED_SPARE_TABLES)
+    {   // drop the one unused the longest
+        map<unsigned long long, baseEntry>::iterator oldest = bases.end();
+        for (it = bases.begin(); it != bases.end(); ++it)
+            if (it->second.users == 0
+                && (oldest == bases.end() || it->second.released < oldest->second.released))
+                oldest = it;
+        FFTwrapper::deleteFFTFREQS(&oldest->second.table);
+        bases.erase(oldest);
+        --spare;
+    }
+    pthread_mutex_unlock(&sharedLock);
+}
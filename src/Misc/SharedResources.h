@@ -0,0 +1,52 @@
+/*
+    SharedResources.h - read only data shared by every engine in the process
+
+    Copyright 2016, Will Godfrey & others
+
+    This file is part of yoshimi, which is free software: you can redistribute
+    it and/or modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either version 2 of
+    the License, or (at your option) any later version.
+
+    yoshimi is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.   See the GNU General Public License (version 2 or
+    later) for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    yoshimi; if not, write to the Free Software Foundation, Inc., 51 Franklin
+    Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef SHARED_RESOURCES_H
+#define SHARED_RESOURCES_H
+
+#include "DSP/FFTwrapper.h"
+
+#define SHARED_SPARE_TABLES 64 // unused base functions kept for reuse
+
+/*
+ * Several engines in one process (extra instances, or several LV2
+ * plugins in a host) would otherwise each make their own copy of these.
+ * Everything handed out is only ever read, so it can be used by any
+ * number of engines and threads at once. Each get must be matched by a
+ * release, FFTs go when the last user releases them, base functions are
+ * kept a while in case they are wanted again. All of these take a process
+ * wide lock, so none are for the audio thread.
+ */
+class SharedResources
+{
+    public:
+        typedef void (*Builder)(void *arg, FFTFREQS *table);
+
+        static FFTwrapper *getFFT(int fftsize);
+        static void releaseFFT(FFTwrapper *fft);
+
+        // the key must cover everything the table depends on, build()
+        // fills in a zeroed table the first time that key is asked for,
+        // and isn't holding up anyone else while it does
+        static const FFTFREQS *getBasefunction(unsigned long long key, int size, Builder build, void *arg);
+        static void releaseBasefunction(const FFTFREQS *table);
+};
+
+#endif
@@ -26,12 +26,15 @@
 
 #include<stdio.h>
 #include <sys/time.h>
+#include <time.h>
 #include <set>
 
 using namespace std;
 
 #include "MasterUI.h"
 #include "Misc/SynthEngine.h"
+#include "Misc/JobPool.h"
+#include "Misc/SharedResources.h"
 #include "Misc/Config.h"
 
 #include <iostream>
@@ -107,6 +110,8 @@ SynthEngine::SynthEngine(int argc, char **argv, bool _isLV2Plugin, unsigned int
     processLock(NULL),
     vuringbuf(NULL),
     RBPringbuf(NULL),
+    RBPthreadHandle(0),
+    programs(this),
     stateXMLtree(NULL),
     guiMaster(NULL),
     guiClosedCallback(NULL),
@@ -120,18 +125,36 @@ SynthEngine::SynthEngine(int argc, char **argv, bool _isLV2Plugin, unsigned int
 
     ctl = new Controller(this);
     for (int npart = 0; npart < NUM_MIDI_PARTS; ++npart)
+    {
         part[npart] = NULL;
+        staged[npart] = NULL;
+        stageViews[npart] = NULL;
+    }
     for (int nefx = 0; nefx < NUM_INS_EFX; ++nefx)
         insefx[nefx] = NULL;
     for (int nefx = 0; nefx < NUM_SYS_EFX; ++nefx)
         sysefx[nefx] = NULL;
     shutup = false;
+
+    memset(routeTable, 0, sizeof(routeTable));
+    route = routeTable[0];
+    routeChanges = 1;
+    effectSwaps = 0;
+    routeBuilt = 0;
+    routeBuilding = 0;
+    routeSwaps = 0;
 }
 
 
 SynthEngine::~SynthEngine()
 {
     closeGui();
+    Runtime.runSynth = false; // the helper threads wait for work, so wake them to finish
+    RBPwake.post();
+    if (RBPthreadHandle)
+        pthread_join(RBPthreadHandle, NULL);
+    programs.stop();
+    interchange.stopThreads();
     if (vuringbuf)
         jack_ringbuffer_free(vuringbuf);
     if (RBPringbuf)
@@ -154,7 +177,7 @@ SynthEngine::~SynthEngine()
     if (tmpmixr)
         fftwf_free(tmpmixr);
     if (fft)
-        delete fft;
+        SharedResources::releaseFFT(fft);
     pthread_mutex_destroy(&processMutex);
     sem_destroy(&partlock);
     if (ctl)
@@ -166,12 +189,13 @@ SynthEngine::~SynthEngine()
 
 bool SynthEngine::Init(unsigned int audiosrate, int audiobufsize)
 {
+    clock_gettime(CLOCK_MONOTONIC, &traceStart);
+    traceLast = traceStart;
     samplerate_f = samplerate = audiosrate;
     halfsamplerate_f = samplerate_f / 2;
     buffersize_f = buffersize = Runtime.Buffersize;
-    if (buffersize_f > audiobufsize)
-        buffersize_f = audiobufsize;
-     // because its now *groups* of audio buffers.
+    // always whole blocks, jack carries any part of one over to the next
+    // period and the others render less by passing to_process
     p_all_buffersize_f = buffersize_f;
 
     bufferbytes = buffersize * sizeof(float);
@@ -208,7 +232,7 @@ bool SynthEngine::Init(unsigned int audiosrate, int audiobufsize)
         halfoscilsize_f = halfoscilsize = oscilsize / 2;
     }
 
-    if (!(fft = new FFTwrapper(oscilsize)))
+    if (!(fft = SharedResources::getFFT(oscilsize)))
     {
         Runtime.Log("SynthEngine failed to allocate fft");
         goto bail_out;
@@ -235,6 +259,7 @@ bool SynthEngine::Init(unsigned int audiosrate, int audiobufsize)
     }
 
     sem_init(&partlock, 0, 1);
+    tracePhase("buffers and fft");
 
     for (int npart = 0; npart < NUM_MIDI_PARTS; ++npart)
     {
@@ -246,6 +271,8 @@ bool SynthEngine::Init(unsigned int audiosrate, int audiobufsize)
         }
         VUpeak.values.parts[npart] = -0.2;
     }
+    part[0]->materialise(); // defaults() always enables it
+    tracePhase("parts");
 
     // Insertion Effects init
     for (int nefx = 0; nefx < NUM_INS_EFX; ++nefx)
@@ -266,9 +293,11 @@ bool SynthEngine::Init(unsigned int audiosrate, int audiobufsize)
             goto bail_out;
         }
     }
+    tracePhase("effects");
 
     defaults();
     ClearNRPNs();
+    tracePhase("defaults");
     if (Runtime.restoreJackSession) // the following are not fatal if failed
     {
         if (!Runtime.restoreJsession())
@@ -314,6 +343,8 @@ bool SynthEngine::Init(unsigned int audiosrate, int audiobufsize)
         }
     }
 
+    tracePhase("session");
+
     if (Runtime.rootDefine.size())
     {
         found = bank.addRootDir(Runtime.rootDefine);
@@ -333,15 +364,20 @@ bool SynthEngine::Init(unsigned int audiosrate, int audiobufsize)
         goto bail_out;
     }
 
+    if (!programs.start())
+        Runtime.Log("Failed to start program prefetch thread"); // loads will just be slower
+
     // we seem to need this here only for first time startup :(
     bank.setCurrentBankID(Runtime.tempBank);
+    tracePhase("banks and threads");
+    traceDone();
 
     return true;
 
 
 bail_out:
     if (fft)
-        delete fft;
+        SharedResources::releaseFFT(fft);
     fft = NULL;
 
     if (vuringbuf)
@@ -440,8 +476,42 @@ void *SynthEngine::RBPthread(void)
                         SetProgramToPart(block.data[1], -1, miscMsgPop(block.data[2]));
                         break;
 
+                    case 6: // build requested effect instances
+                        for (int nefx = 0; nefx < NUM_SYS_EFX; ++nefx)
+                            sysefx[nefx]->prepareeffect();
+                        for (int nefx = 0; nefx < NUM_INS_EFX; ++nefx)
+                            insefx[nefx]->prepareeffect();
+                        for (int npart = 0; npart < NUM_MIDI_PARTS; ++npart)
+                            for (int nefx = 0; nefx < NUM_PART_EFX; ++nefx)
+                                part[npart]->partefx[nefx]->prepareeffect();
+                        xmlSysEffects.touch();
+                        xmlInsEffects.touch();
+                        break;
+
+                    case 7: // enable a part that had to be made first
+                        part[(unsigned char)block.data[1]]->materialise();
+                        partonoffLock((unsigned char)block.data[1], 1);
+                        GuiThreadMsg::sendMessage(this, GuiThreadMsg::UpdatePanelItem, (unsigned char)block.data[1]);
+                        break;
+
+                    case 8: // effects swapped in, show their parameters
+                        for (int nefx = 0; nefx < NUM_SYS_EFX; ++nefx)
+                            if (sysefx[nefx]->takeswapped())
+                                GuiThreadMsg::sendMessage(this, GuiThreadMsg::UpdateEffects, nefx << 8);
+                        for (int nefx = 0; nefx < NUM_INS_EFX; ++nefx)
+                            if (insefx[nefx]->takeswapped())
+                                GuiThreadMsg::sendMessage(this, GuiThreadMsg::UpdateEffects,
+                                    (nefx << 8) | (1 << 22) | ((Pinsparts[nefx] + 2) << 24));
+                        for (int npart = 0; npart < NUM_MIDI_PARTS; ++npart)
+                            for (int nefx = 0; nefx < NUM_PART_EFX; ++nefx)
+                                if (part[npart]->partefx[nefx]->takeswapped())
+                                    GuiThreadMsg::sendMessage(this, GuiThreadMsg::UpdateEffects,
+                                        (nefx << 8) | (2 << 22) | (npart << 24));
+                        break;
+
                     case 10: // global fine detune
                         microtonal.Pglobalfinedetune = block.data[1];
+                        xmlMicrotonal.touch();
                         setAllPartMaps();
                 }
             }
@@ -449,12 +519,49 @@ void *SynthEngine::RBPthread(void)
                 Runtime.Log("Unable to read data from Root/bank/Program");
         }
         else
-            usleep(250); // yes it's a hack but seems reliable
+            RBPwake.wait(-1);
     }
     return NULL;
 }
 
 
+// time since the last phase, and since Init started
+void SynthEngine::tracePhase(const string& phase)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (Runtime.showTimes)
+    {
+        long step = (now.tv_sec - traceLast.tv_sec) * 1000000 + (now.tv_nsec - traceLast.tv_nsec) / 1000;
+        long total = (now.tv_sec - traceStart.tv_sec) * 1000000 + (now.tv_nsec - traceStart.tv_nsec) / 1000;
+        Runtime.Log("Startup " + phase + "  " + to_string(step) + "uS  (" + to_string(total) + "uS)");
+    }
+    traceLast = now;
+}
+
+
+void SynthEngine::traceDone(void)
+{
+    if (!Runtime.showTimes)
+        return;
+    int materialised = 0;
+    for (int npart = 0; npart < NUM_MIDI_PARTS; ++npart)
+        if (part[npart]->materialised())
+            ++materialised;
+    string msg = "Startup done, " + to_string(materialised) + " of "
+                 + to_string(NUM_MIDI_PARTS) + " parts made";
+    long pages = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm)
+    {
+        if (fscanf(statm, "%*d %ld", &pages) == 1)
+            msg += ", resident " + to_string(pages * (sysconf(_SC_PAGESIZE) / 1024)) + "kB";
+        fclose(statm);
+    }
+    Runtime.Log(msg);
+}
+
+
 void SynthEngine::defaults(void)
 {
     setPvolume(90);
@@ -491,7 +598,9 @@ void SynthEngine::defaults(void)
         GuiThreadMsg::sendMessage(this, GuiThreadMsg::UpdateConfig, 4);
     //CmdInterface.defaults(); // **** need to work out how to call this
     Runtime.NumAvailableParts = NUM_MIDI_CHANNELS;
+    routingChanged();
     ShutUp();
+    changed();
 }
 
 
@@ -507,6 +616,65 @@ void SynthEngine::setAllPartMaps(void)
         part[npart]->setNoteMap(part[npart]->Pkeyshift - 64);
 }
 
+/*
+ * Copies out the current routing for a channel, first rebuilding the
+ * table if anything has changed since it was made. If another thread is
+ * already rebuilding we make do with the previous one. Only the spare
+ * table is ever written, and not until after a swap, so if no swap
+ * happened while we copied, the copy is whole.
+ */
+void SynthEngine::getRoute(unsigned char chan, ChannelRoute &target)
+{
+    int changes = __sync_add_and_fetch(&routeChanges, 0);
+    if (changes != routeBuilt && !__sync_lock_test_and_set(&routeBuilding, 1))
+    {
+        buildRoutes(changes);
+        __sync_lock_release(&routeBuilding);
+    }
+    int swaps;
+    do
+    {
+        swaps = __sync_add_and_fetch(&routeSwaps, 0);
+        ChannelRoute *table = __sync_add_and_fetch(&route, 0);
+        target = table[chan];
+        __sync_synchronize();
+    } while (swaps != __sync_add_and_fetch(&routeSwaps, 0));
+}
+
+
+void SynthEngine::buildRoutes(int changes)
+{
+    ChannelRoute *table = (route == routeTable[0]) ? routeTable[1] : routeTable[0];
+    int parts = Runtime.NumAvailableParts;
+    for (int chan = 0; chan < NUM_MIDI_CHANNELS; ++chan)
+    {
+        ChannelRoute &entry = table[chan];
+        int count = 0;
+        for (int npart = 0; npart < parts; ++npart)
+            if (part[npart]->Prcvchn == chan && !partonoffRead(npart))
+                entry.part[count++] = npart;
+        entry.idle = count;
+        for (int npart = 0; npart < parts; ++npart)
+            if (part[npart]->Prcvchn == chan && partonoffRead(npart))
+                entry.part[count++] = npart;
+        entry.active = count - entry.idle;
+        for (int npart = 0; npart < parts; ++npart)
+        {
+            // mask values 16 - 31 to still allow a note off
+            unsigned char rcv = part[npart]->Prcvchn;
+            if (rcv != chan && (rcv & 0xef) == chan && partonoffRead(npart))
+                entry.part[count++] = npart;
+        }
+        entry.offOnly = count - entry.idle - entry.active;
+    }
+    __sync_synchronize();
+    route = table;
+    routeBuilt = changes;
+    // anyone still copying the old table will see this and try again
+    __sync_add_and_fetch(&routeSwaps, 1);
+}
+
+
 // Note On Messages (velocity == 0 => NoteOff)
 void SynthEngine::NoteOn(unsigned char chan, unsigned char note, unsigned char velocity)
 {
@@ -516,21 +684,24 @@ void SynthEngine::NoteOn(unsigned char chan, unsigned char note, unsigned char v
 #endif
     if (!velocity)
         this->NoteOff(chan, note);
-    else if (!isMuted())
-        for (int npart = 0; npart < Runtime.NumAvailableParts; ++npart)
+    else if (!isMuted() && chan < NUM_MIDI_CHANNELS)
+    {
+        ChannelRoute target;
+        getRoute(chan, target);
+        const unsigned char *npart = target.part;
+        for (const unsigned char *last = npart + target.idle; npart < last; ++npart)
         {
-            if (chan == part[npart]->Prcvchn)
-            {
-               if (partonoffRead(npart))
-                {
-                    actionLock(lock);
-                    part[npart]->NoteOn(note, velocity, keyshift);
-                    actionLock(unlock);
-                }
-                else if (VUpeak.values.parts[npart] > (-velocity))
-                    VUpeak.values.parts[npart] = -(0.2 + velocity); // ensure fake is always negative
-            }
+            if (VUpeak.values.parts[*npart] > (-velocity))
+                VUpeak.values.parts[*npart] = -(0.2 + velocity); // ensure fake is always negative
+        }
+        if (target.active)
+        {
+            actionLock(lock);
+            for (const unsigned char *last = npart + target.active; npart < last; ++npart)
+                part[*npart]->NoteOn(note, velocity, keyshift);
+            actionLock(unlock);
         }
+    }
 #ifdef REPORT_NOTEON
     if (Runtime.showTimes)
     {
@@ -550,15 +721,18 @@ void SynthEngine::NoteOn(unsigned char chan, unsigned char note, unsigned char v
 // Note Off Messages
 void SynthEngine::NoteOff(unsigned char chan, unsigned char note)
 {
-    for (int npart = 0; npart < Runtime.NumAvailableParts; ++npart)
+    if (chan >= NUM_MIDI_CHANNELS)
+        return;
+    ChannelRoute target;
+    getRoute(chan, target);
+    int count = target.active + target.offOnly;
+    if (count)
     {
-        // mask values 16 - 31 to still allow a note off
-        if (chan == (part[npart]->Prcvchn & 0xef) && partonoffRead(npart))
-        {
-            actionLock(lock);
-            part[npart]->NoteOff(note);
-            actionLock(unlock);
-        }
+        const unsigned char *npart = target.part + target.idle;
+        actionLock(lock);
+        for (const unsigned char *last = npart + count; npart < last; ++npart)
+            part[*npart]->NoteOff(note);
+        actionLock(unlock);
     }
 }
 
@@ -579,14 +753,15 @@ void SynthEngine::SetController(unsigned char chan, int type, short int par)
     int npart;
     if (chan < NUM_MIDI_CHANNELS)
     {
-        for (npart = 0; npart < Runtime.NumAvailableParts; ++npart)
+        ChannelRoute target;
+        getRoute(chan, target);
+        const unsigned char *listener = target.part + target.idle;
+        for (const unsigned char *last = listener + target.active; listener < last; ++listener)
         {   // Send the controller to all part assigned to the channel
-            if (chan == part[npart]->Prcvchn && partonoffRead(npart))
-            {
-                part[npart]->SetController(type, par);
-                if (type == 7 || type == 10) // currently only volume and pan
-                    GuiThreadMsg::sendMessage(this, GuiThreadMsg::UpdatePanelItem, npart);
-            }
+            npart = *listener;
+            part[npart]->SetController(type, par);
+            if (type == 7 || type == 10) // currently only volume and pan
+                GuiThreadMsg::sendMessage(this, GuiThreadMsg::UpdatePanelItem, npart);
         }
     }
     else
@@ -626,11 +801,7 @@ void SynthEngine::SetZynControls()
         {
             data |= (1 << 22);
             if (efftype == 0x40) // select effect
-            {
-                actionLock(lockmute);
-                insefx[effnum]->changeeffect(value);
-                actionLock(unlock);
-            }
+                insefx[effnum]->requesteffect(value);
             else if (efftype == 0x20) // select part
             {
                 if (value >= 0x7e)
@@ -645,7 +816,7 @@ void SynthEngine::SetZynControls()
         else
         {
             if (efftype == 0x40) // select effect
-                sysefx[effnum]->changeeffect(value);
+                sysefx[effnum]->requesteffect(value);
             else if (efftype == 0x20) // select output level
             {
                 // setPsysefxvol(effnum, parnum, value); // this isn't correct!
@@ -654,6 +825,8 @@ void SynthEngine::SetZynControls()
             else
                 sysefx[effnum]->seteffectpar(parnum, value);
         }
+        xmlSysEffects.touch();
+        xmlInsEffects.touch();
         GuiThreadMsg::sendMessage(this, GuiThreadMsg::UpdateEffects, data);
     }
 }
@@ -675,7 +848,7 @@ void SynthEngine::SetEffects(unsigned char category, unsigned char command, unsi
             switch (command)
             {
                 case 1:
-                    insefx[nFX]->changeeffect(nType);
+                    insefx[nFX]->requesteffect(nType);
                     data |= ((Pinsparts[nFX] + 2) << 24);
                     break;
 
@@ -692,11 +865,11 @@ void SynthEngine::SetEffects(unsigned char category, unsigned char command, unsi
             break;
 
         case 2:
-            data |= (2 << 22);
+            data |= (2 << 22) | (npart << 24);
             switch (command)
             {
                 case 1:
-                    part[npart]->partefx[nFX]->changeeffect(nType);
+                    part[npart]->partefx[nFX]->requesteffect(nType);
                     break;
 
                 case 4:
@@ -713,7 +886,7 @@ void SynthEngine::SetEffects(unsigned char category, unsigned char command, unsi
             switch (command)
             {
                 case 1:
-                    sysefx[nFX]->changeeffect(nType);
+                    sysefx[nFX]->requesteffect(nType);
                     break;
 
                 case 4:
@@ -726,6 +899,8 @@ void SynthEngine::SetEffects(unsigned char category, unsigned char command, unsi
             }
             break;
     }
+    xmlSysEffects.touch();
+    xmlInsEffects.touch();
     GuiThreadMsg::sendMessage(this, GuiThreadMsg::UpdateEffects, data);
 }
 
@@ -885,8 +1060,13 @@ bool SynthEngine::SetProgramToPart(int npart, int pgm, string fname)
         enablestate = 1;
     else
         enablestate = partonoffRead(npart);
+    if (enablestate)
+        part[npart]->materialise(); // rather than have it enabled later
     partonoffWrite(npart, 0);
-    if (part[npart]->loadXMLinstrument(fname))
+    Part *ready = programs.take(fname);
+    if (ready)
+        part[npart]->swapInstrument(ready);
+    if (ready || part[npart]->loadXMLinstrument(fname))
     {
         partonoffWrite(npart, enablestate); // must be here to update gui
         loadOK = true;
@@ -911,11 +1091,24 @@ bool SynthEngine::SetProgramToPart(int npart, int pgm, string fname)
         partonoffWrite(npart, enablestate); // also here to restore failed load state.
 
     sem_post (&partlock);
+    if (ready)
+        delete ready; // now holds the instrument that was replaced
 
     if (!loadOK)
         GuiThreadMsg::sendMessage(this, GuiThreadMsg::GuiAlert,miscMsgPush("Failed to load " + fname));
     else
     {
+        // have this one and those around it ready for next time
+        vector<string> neighbours;
+        for (int step = 1; pgm >= 0 && step <= PROGRAM_CACHE_NEIGHBOURS; ++step)
+        {
+            if (pgm + step < BANK_SIZE)
+                neighbours.push_back(bank.getfilename(pgm + step));
+            if (pgm - step >= 0)
+                neighbours.push_back(bank.getfilename(pgm - step));
+        }
+        programs.used(fname, neighbours);
+
         if (part[npart]->Pname == "Simple Sound")
             GuiThreadMsg::sendMessage(this, GuiThreadMsg::GuiAlert,miscMsgPush("Instrument is called 'Simple Sound', Yoshimi's basic sound name. You should change this if you wish to re-save."));
         Runtime.Log(loaded);
@@ -938,6 +1131,7 @@ void SynthEngine::SetPartChan(unsigned char npart, unsigned char nchan)
          * as will using the GUI controls.
          */
         part[npart]->Prcvchn =  nchan;
+        routingChanged();
         GuiThreadMsg::sendMessage(this, GuiThreadMsg::UpdatePartProgram, npart);
     }
 }
@@ -1607,6 +1801,7 @@ void SynthEngine::SetSystemValue(int type, int value)
             if (value == 16 || value == 32 || value == 64)
             {
                 Runtime.NumAvailableParts = value;
+                routingChanged();
                 Runtime.Log("Available parts set to " + asString(value));
                 GuiThreadMsg::sendMessage(this, GuiThreadMsg::UpdatePart,0);
             }
@@ -1671,6 +1866,7 @@ void SynthEngine::SetSystemValue(int type, int value)
             }
             else
                 return; // unrecognised
+            routingChanged();
             GuiThreadMsg::sendMessage(this, GuiThreadMsg::UpdatePart,0);
             break;
     }
@@ -1702,6 +1898,7 @@ void SynthEngine::writeRBP(char type, char data0, char data1)
         }
         if (towrite)
             Runtime.Log("Unable to write data to Root/bank/Program");
+        RBPwake.post();
     }
     else
         Runtime.Log("Root/bank/Program buffer full!");
@@ -1880,6 +2077,8 @@ void SynthEngine::vectorSet(int dHigh, unsigned char chan, int par)
             Runtime.Log("Channel " + asString((int) chan) + " vector control disabled");
             break;
     }
+    if (chan < NUM_MIDI_CHANNELS)
+        xmlVector[chan].touch();
 }
 
 
@@ -1896,6 +2095,7 @@ void SynthEngine::ClearNRPNs(void)
         Runtime.nrpndata.vectorYaxis[chan] = 0xff;
         Runtime.nrpndata.vectorXfeatures[chan] = 0;
         Runtime.nrpndata.vectorYfeatures[chan] = 0;
+        xmlVector[chan].touch();
     }
 }
 
@@ -1930,6 +2130,11 @@ void SynthEngine::partonoffWrite(int npart, int what)
 
     if (what == 1) // always enable
     {
+        if (!part[npart]->materialised())
+        {   // we may be on the audio thread or holding the lock
+            writeRBP(7, npart, 0);
+            return;
+        }
         VUpeak.values.parts[npart] = 1e-9f;
         part[npart]->Penabled = 1;
     }
@@ -1945,6 +2150,7 @@ void SynthEngine::partonoffWrite(int npart, int what)
                 insefx[nefx]->cleanup();
         VUpeak.values.parts[npart] = -0.2;
     }
+    routingChanged();
 }
 
 
@@ -1954,6 +2160,19 @@ bool SynthEngine::partonoffRead(int npart)
 }
 
 
+// Audio thread, with the engine locked
+void SynthEngine::swapEffects(void)
+{
+    for (int nefx = 0; nefx < NUM_SYS_EFX; ++nefx)
+        sysefx[nefx]->swapeffect();
+    for (int nefx = 0; nefx < NUM_INS_EFX; ++nefx)
+        insefx[nefx]->swapeffect();
+    for (int npart = 0; npart < NUM_MIDI_PARTS; ++npart)
+        for (int nefx = 0; nefx < NUM_PART_EFX; ++nefx)
+            part[npart]->partefx[nefx]->swapeffect();
+}
+
+
 // Master audio out (the final sound)
 int SynthEngine::MasterAudio(float *outl [NUM_MIDI_PARTS + 1], float *outr [NUM_MIDI_PARTS + 1], int to_process)
 {
@@ -1998,6 +2217,10 @@ int SynthEngine::MasterAudio(float *outl [NUM_MIDI_PARTS + 1], float *outr [NUM_
     {
         actionLock(lock);
 
+        // whether or not anything flows through them this time
+        if (__sync_fetch_and_and(&effectSwaps, 0))
+            swapEffects();
+
         // Compute part samples and store them ->partoutl,partoutr
         for (npart = 0; npart < Runtime.NumAvailableParts; ++npart)
             if (partonoffRead(npart))
@@ -2235,6 +2458,7 @@ void SynthEngine::setPsysefxvol(int Ppart, int Pefx, char Pvol)
 {
     Psysefxvol[Pefx][Ppart] = Pvol;
     sysefxvol[Pefx][Ppart]  = powf(0.1f, (1.0f - Pvol / 96.0f) * 2.0f);
+    xmlSysEffects.touch();
 }
 
 
@@ -2242,6 +2466,7 @@ void SynthEngine::setPsysefxsend(int Pefxfrom, int Pefxto, char Pvol)
 {
     Psysefxsend[Pefxfrom][Pefxto] = Pvol;
     sysefxsend[Pefxfrom][Pefxto]  = powf(0.1f, (1.0f - Pvol / 96.0f) * 2.0f);
+    xmlSysEffects.touch();
 }
 
 void SynthEngine::setPaudiodest(int value)
@@ -2321,12 +2546,18 @@ void SynthEngine::applyparameters(void)
 int SynthEngine::loadParameters(string fname)
 {
     int result = 0;
+    XMLwrapper *xml = new XMLwrapper(this);
+    bool loaded = xml->loadXMLfile(fname, true);
+    if (loaded)
+        stageParts(xml); // the slow bit, while we're still playing
 
     actionLock(lockmute);
     defaults(); // clear all parameters
-    if (loadXML(fname)) // load the data
+    if (loaded && getfromXML(xml)) // load the data
         result = 1; // this is messy, but can't trust bool to int conversions
     actionLock(unlock);
+    releaseStaged();
+    delete xml;
     return result;
 }
 
@@ -2637,7 +2868,10 @@ bool SynthEngine::loadVector(unsigned char baseChan, string name, bool full)
             part[npart + baseChan]->Prcvchn = baseChan;
             xml->exitbranch();
         }
+        routingChanged();
     }
+    for (int chan = 0; chan < NUM_MIDI_CHANNELS; ++chan)
+        xmlVector[chan].touch();
     xml->endbranch(); // VECTOR
     addHistory(file, 5);
     delete xml;
@@ -2836,19 +3070,31 @@ bool SynthEngine::insertVectorData(unsigned char baseChan, bool full, XMLwrapper
 }
 
 
+/*
+ * Only kit items and the sections with their own XMLcache are kept
+ * between saves. Everything else is small, and MIDI and the CLI change
+ * much of it directly, so it's always saved again.
+ */
 void SynthEngine::add2XML(XMLwrapper *xml)
 {
     xml->beginbranch("MASTER");
     actionLock(lockmute);
+    if (guiMaster)
+        guiEdited();
+    xml->cachable = true;
     xml->addpar("current_midi_parts", Runtime.NumAvailableParts);
     xml->addpar("volume", Pvolume);
     xml->addpar("key_shift", Pkeyshift);
     xml->addpar("channel_switch_type", Runtime.channelSwitchType);
     xml->addpar("channel_switch_CC", Runtime.channelSwitchCC);
 
-    xml->beginbranch("MICROTONAL");
-    microtonal.add2XML(xml);
-    xml->endbranch();
+    if (!xml->begincached(xmlMicrotonal))
+    {
+        xml->beginbranch("MICROTONAL");
+        microtonal.add2XML(xml);
+        xml->endbranch();
+        xml->endcached(xmlMicrotonal);
+    }
 
     for (int npart = 0; npart < NUM_MIDI_PARTS; ++npart)
     {
@@ -2857,6 +3103,8 @@ void SynthEngine::add2XML(XMLwrapper *xml)
         xml->endbranch();
     }
 
+    if (!xml->begincached(xmlSysEffects))
+    {
     xml->beginbranch("SYSTEM_EFFECTS");
     for (int nefx = 0; nefx < NUM_SYS_EFX; ++nefx)
     {
@@ -2881,7 +3129,11 @@ void SynthEngine::add2XML(XMLwrapper *xml)
         xml->endbranch();
     }
     xml->endbranch();
+    xml->endcached(xmlSysEffects);
+    }
 
+    if (!xml->begincached(xmlInsEffects))
+    {
     xml->beginbranch("INSERTION_EFFECTS");
     for (int nefx = 0; nefx < NUM_INS_EFX; ++nefx)
     {
@@ -2894,13 +3146,47 @@ void SynthEngine::add2XML(XMLwrapper *xml)
         xml->endbranch();
     }
     xml->endbranch(); // INSERTION_EFFECTS
-    actionLock(unlock);
+    xml->endcached(xmlInsEffects);
+    }
+
     for (int i = 0; i < NUM_MIDI_CHANNELS; ++i)
+    {
+        if (xml->begincached(xmlVector[i]))
+            continue;
         insertVectorData(i, false, xml);
+        xml->endcached(xmlVector[i]);
+    }
+    xml->cachable = false;
+    actionLock(unlock);
     xml->endbranch(); // MASTER
 }
 
 
+void SynthEngine::changed(void)
+{
+    for (int npart = 0; npart < NUM_MIDI_PARTS; ++npart)
+        part[npart]->changed();
+    xmlMicrotonal.touch();
+    xmlSysEffects.touch();
+    xmlInsEffects.touch();
+    for (int chan = 0; chan < NUM_MIDI_CHANNELS; ++chan)
+        xmlVector[chan].touch();
+}
+
+
+// Most editors send their changes on, but not all yet, and
+// only ever to the part that's showing.
+void SynthEngine::guiEdited(void)
+{
+    part[Runtime.currentPart]->changed();
+    xmlMicrotonal.touch();
+    xmlSysEffects.touch();
+    xmlInsEffects.touch();
+    for (int chan = 0; chan < NUM_MIDI_CHANNELS; ++chan)
+        xmlVector[chan].touch();
+}
+
+
 int SynthEngine::getalldata(char **data)
 {
     XMLwrapper *xml = new XMLwrapper(this);
@@ -2922,10 +3208,12 @@ void SynthEngine::putalldata(const char *data, int size)
     }
     //if (xml->enterbranch("MASTER"))
     //{
+        stageParts(xml);
         actionLock(lock);
         defaults();
         getfromXML(xml);
         actionLock(unlock);
+        releaseStaged();
         xml->exitbranch();
     //}
     //else
@@ -2953,13 +3241,15 @@ bool SynthEngine::loadXML(string filename)
         Runtime.Log("Failed to init xml tree");
         return false;
     }
-    if (!xml->loadXMLfile(filename))
+    if (!xml->loadXMLfile(filename, true))
     {
         delete xml;
         return false;
     }
+    stageParts(xml);
     defaults();
     bool isok = getfromXML(xml);
+    releaseStaged();
     delete xml;
     return isok;
 }
@@ -2983,11 +3273,12 @@ bool SynthEngine::getfromXML(XMLwrapper *xml)
     {
         if (!xml->enterbranch("PART", npart))
             continue;
-        part[npart]->getfromXML(xml);
+        part[npart]->getfromXML(xml, staged[npart]);
         xml->exitbranch();
         if (partonoffRead(npart) && (part[npart]->Paudiodest & 2))
             GuiThreadMsg::sendMessage(this, GuiThreadMsg::RegisterAudioPort, npart);
     }
+    routingChanged();
 
     if (xml->enterbranch("MICROTONAL"))
     {
@@ -3047,10 +3338,92 @@ bool SynthEngine::getfromXML(XMLwrapper *xml)
     for (int i = 0; i < NUM_MIDI_CHANNELS; ++i)
         extractVectorData(i, false, xml);
     xml->exitbranch(); // MASTER
+    changed();
     return true;
 }
 
 
+void SynthEngine::stageParts(XMLwrapper *xml)
+{
+    releaseStaged();
+    if (!xml->enterbranch("MASTER"))
+        return;
+    int found = 0;
+    for (int npart = 0; npart < NUM_MIDI_PARTS; ++npart)
+    {
+        if (!xml->enterbranch("PART", npart))
+            continue;
+        if (xml->enterbranch("INSTRUMENT"))
+        {
+            stageViews[npart] = xml->branchView();
+            ++found;
+            xml->exitbranch();
+        }
+        xml->exitbranch();
+    }
+    xml->exitbranch();
+    if (!found)
+        return;
+
+    JobPool::run(_stagePart, this, NUM_MIDI_PARTS);
+    for (int npart = 0; npart < NUM_MIDI_PARTS; ++npart)
+    {
+        if (stageViews[npart])
+            delete stageViews[npart];
+        stageViews[npart] = NULL;
+    }
+}
+
+
+__thread struct random_data *SynthEngine::threadRandom = NULL;
+
+
+SynthEngine::LocalRandom::LocalRandom(unsigned int seed) :
+    previous(threadRandom)
+{
+    memset(&buf, 0, sizeof(buf));
+    initstate_r(seed, state, sizeof(state), &buf);
+    threadRandom = &buf;
+}
+
+
+SynthEngine::LocalRandom::~LocalRandom()
+{
+    threadRandom = previous;
+}
+
+
+void SynthEngine::_stagePart(void *arg, size_t npart)
+{
+    static_cast<SynthEngine*>(arg)->stagePart(npart);
+}
+
+
+// exactly what Part::getfromXML() would do with the instrument
+void SynthEngine::stagePart(int npart)
+{
+    if (!stageViews[npart])
+        return;
+    LocalRandom local(time(NULL) + npart); // pool threads run side by side
+    Part *spare = new Part(&microtonal, fft, this);
+    spare->Pname = "";
+    spare->getfromXMLinstrument(stageViews[npart]);
+    spare->applyparameters();
+    staged[npart] = spare;
+}
+
+
+void SynthEngine::releaseStaged(void)
+{
+    for (int npart = 0; npart < NUM_MIDI_PARTS; ++npart)
+    {
+        if (staged[npart])
+            delete staged[npart];
+        staged[npart] = NULL;
+    }
+}
+
+
 float SynthHelper::getDetune(unsigned char type, unsigned short int coarsedetune,
                              unsigned short int finedetune) const
 {
@@ -3112,6 +3485,7 @@ MasterUI *SynthEngine::getGuiMaster(bool createGui)
 
 void SynthEngine::guiClosed(bool stopSynth)
 {
+    guiEdited(); // not caught by the next save otherwise
     if (stopSynth && !isLV2Plugin)
         Runtime.runSynth = false;
     if (guiClosedCallback != NULL)
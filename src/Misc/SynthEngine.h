@@ -41,6 +41,8 @@ using namespace std;
 #include "Interface/InterChange.h"
 #include "Interface/MidiLearn.h"
 #include "Misc/Config.h"
+#include "Misc/Notifier.h"
+#include "Misc/ProgramCache.h"
 #include "Params/PresetsStore.h"
 
 typedef enum { init, trylock, lock, unlock, lockmute, destroy } lockset;
@@ -92,9 +94,23 @@ class SynthEngine : private SynthHelper, MiscFuncs
 
         bool getfromXML(XMLwrapper *xml);
 
+        // Loads every part's instrument from xml into a spare part, several
+        // at once, without locking anything. getfromXML() then only has to
+        // swap them in, after which releaseStaged() deletes what they held.
+        void stageParts(XMLwrapper *xml);
+        void releaseStaged(void);
+
         int getalldata(char **data);
         void putalldata(const char *data, int size);
 
+        // sections of the state as last saved, parts keep their own
+        XMLcache xmlMicrotonal;
+        XMLcache xmlSysEffects;
+        XMLcache xmlInsEffects;
+        XMLcache xmlVector[NUM_MIDI_CHANNELS];
+        void changed(void); // all of it
+        void guiEdited(void); // what the GUI can change without saying
+
         void NoteOn(unsigned char chan, unsigned char note, unsigned char velocity);
         void NoteOff(unsigned char chan, unsigned char note);
         void SetController(unsigned char chan, int type, short int par);
@@ -136,6 +152,8 @@ class SynthEngine : private SynthHelper, MiscFuncs
         void partonoffWrite(int npart, int what);
         bool partonoffRead(int npart);
         sem_t partlock;
+        void routingChanged(void) { __sync_add_and_fetch(&routeChanges, 1); }
+        void effectsWaiting(void) { __sync_or_and_fetch(&effectSwaps, 1); }
         void setPartMap(int npart);
         void setAllPartMaps(void);
 
@@ -234,15 +252,52 @@ class SynthEngine : private SynthHelper, MiscFuncs
         float *tmpmixr; // which are sent to system effect
         int keyshift;
 
+        /*
+         * Parts listening to each channel, rebuilt only when a part's
+         * channel, enable state or the number of parts changes.
+         * part[] holds 'idle' disabled listeners (VU fake only), then
+         * 'active' enabled listeners, then 'offOnly' enabled parts on
+         * channels 16 - 31 which still take note off.
+         */
+        struct ChannelRoute {
+            unsigned char idle;
+            unsigned char active;
+            unsigned char offOnly;
+            unsigned char part[NUM_MIDI_PARTS];
+        };
+        ChannelRoute routeTable[2][NUM_MIDI_CHANNELS];
+        ChannelRoute *route;
+        int routeChanges;
+        int effectSwaps; // some effect has a type change to put in place
+        void swapEffects(void);
+        int routeBuilt;
+        int routeBuilding;
+        int routeSwaps;
+        void getRoute(unsigned char chan, ChannelRoute &target);
+        void buildRoutes(int changes);
+
         pthread_mutex_t  processMutex;
         pthread_mutex_t *processLock;
 
         jack_ringbuffer_t *vuringbuf;
 
         jack_ringbuffer_t *RBPringbuf;
+        Notifier RBPwake;
         void *RBPthread(void);
         static void *_RBPthread(void *arg);
         pthread_t  RBPthreadHandle;
+        ProgramCache programs;
+
+        // startup phase timings, logged with report_load_times set
+        struct timespec traceStart;
+        struct timespec traceLast;
+        void tracePhase(const string& phase);
+        void traceDone(void);
+
+        Part *staged[NUM_MIDI_PARTS];
+        XMLwrapper *stageViews[NUM_MIDI_PARTS];
+        static void _stagePart(void *arg, size_t npart);
+        void stagePart(int npart);
 
         struct RBP_data {
             char data[4];
@@ -252,9 +307,21 @@ class SynthEngine : private SynthHelper, MiscFuncs
 
         char random_state[256];
         struct random_data random_buf;
-        int32_t random_result;
-        float random_0_1;
+        static __thread struct random_data *threadRandom;
     public:
+        // while one of these is alive the thread that made it draws from
+        // its own sequence, so parts built off the audio thread never touch
+        // the engine's random state
+        class LocalRandom {
+            public:
+                LocalRandom(unsigned int seed);
+                ~LocalRandom();
+            private:
+                char state[256];
+                struct random_data buf;
+                struct random_data *previous;
+        };
+
         MasterUI *guiMaster; // need to read this in InterChange::returns
     private:
         void( *guiClosedCallback)(void*);
@@ -267,9 +334,10 @@ class SynthEngine : private SynthHelper, MiscFuncs
 
 inline float SynthEngine::numRandom(void)
 {
-    if (!random_r(&random_buf, &random_result))
+    int32_t result;
+    if (!random_r(threadRandom ? threadRandom : &random_buf, &result))
     {
-        random_0_1 = (float)random_result / (float)INT_MAX;
+        float random_0_1 = (float)result / (float)INT_MAX;
         random_0_1 = (random_0_1 > 1.0f) ? 1.0f : random_0_1;
         random_0_1 = (random_0_1 < 0.0f) ? 0.0f : random_0_1;
         return random_0_1;
@@ -279,8 +347,9 @@ inline float SynthEngine::numRandom(void)
 
 inline unsigned int SynthEngine::random(void)
 {
-    if (!random_r(&random_buf, &random_result))
-        return random_result + INT_MAX / 2;
+    int32_t result;
+    if (!random_r(threadRandom ? threadRandom : &random_buf, &result))
+        return result + INT_MAX / 2;
     return INT_MAX / 2;
 }
 
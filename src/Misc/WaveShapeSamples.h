@@ -33,7 +33,7 @@ class WaveShapeSamples
         void waveShapeSmps(int n, float *smps, unsigned char type, unsigned char drive);
 };
 
-// Waveshape, used by OscilGen::waveshape and Distorsion::process
+// Waveshape, used by OscilGen::waveshape and WaveShaper (Distorsion)
 inline void WaveShapeSamples::waveShapeSmps(int n, float *smps, unsigned char type, unsigned char drive)
 {
     int i;
@@ -0,0 +1,611 @@
+/*
+    XMLbinary.cpp - compact memory mapped form of the XML parameter tree
+
+    Copyright 2016, Will Godfrey & others
+
+    This file is part of yoshimi, which is free software: you can redistribute
+    it and/or modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either version 2 of
+    the License, or (at your option) any later version.
+
+    yoshimi is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.   See the GNU General Public License (version 2 or
+    later) for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    yoshimi; if not, write to the Free Software Foundation, Inc., 51 Franklin
+    Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <cstring>
+#include <cstdio>
+#include <endian.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "Misc/XMLbinary.h"
+
+#define HAS_ID 1
+#define HAS_TEXT 2
+
+XMLbinary::XMLbinary() :
+    map(NULL),
+    mapSize(0),
+    nodes(NULL),
+    attrs(NULL),
+    strings(NULL),
+    nodeCount(0),
+    attrCount(0),
+    stringBytes(0)
+{
+    for (int i = 0; i <= XMLBIN_STRING; ++i)
+        kindName[i] = XMLBIN_NONE;
+}
+
+
+XMLbinary::~XMLbinary()
+{
+    unmap();
+}
+
+
+void XMLbinary::unmap(void)
+{
+    if (map)
+        munmap(map, mapSize);
+    map = NULL;
+    mapSize = 0;
+    nodes = NULL;
+    attrs = NULL;
+    strings = NULL;
+    nodeCount = attrCount = stringBytes = 0;
+    stringIds.clear();
+}
+
+
+// everything on disk is little-endian
+unsigned int XMLbinary::field(unsigned int word)
+{
+#if __BYTE_ORDER == __BIG_ENDIAN
+    return __builtin_bswap32(word);
+#else
+    return word;
+#endif
+}
+
+
+bool XMLbinary::isBinary(const string& filename)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    char magic[4];
+    bool found = (read(fd, magic, 4) == 4 && memcmp(magic, "YBIN", 4) == 0);
+    close(fd);
+    return found;
+}
+
+
+unsigned int XMLbinary::intern(const string& text)
+{
+    unordered_map<string, unsigned int>::iterator it = newIds.find(text);
+    if (it != newIds.end())
+        return it->second;
+    unsigned int offset = newStrings.size();
+    newStrings.append(text);
+    newStrings.push_back(0);
+    newIds[text] = offset;
+    return offset;
+}
+
+
+// Only stored as a value if it will be written back exactly as it was
+bool XMLbinary::encodePar(mxml_node_t *element, binNode &bin)
+{
+    const char *name = element->value.element.name;
+    int kind;
+    if (!strcmp(name, "par"))
+        kind = XMLBIN_PAR;
+    else if (!strcmp(name, "par_real"))
+        kind = XMLBIN_REAL;
+    else if (!strcmp(name, "par_bool"))
+        kind = XMLBIN_BOOL;
+    else if (!strcmp(name, "string"))
+        kind = XMLBIN_STRING;
+    else
+        return false;
+
+    mxml_element_t &el = element->value.element;
+    if (el.num_attrs < 1 || strcmp(el.attrs[0].name, "name") || !el.attrs[0].value)
+        return false;
+
+    if (kind == XMLBIN_STRING)
+    {
+        mxml_node_t *text = element->child;
+        if (el.num_attrs != 1 || (text && (text->next || text->type != MXML_OPAQUE)))
+            return false;
+        bin.key = intern(el.attrs[0].value);
+        if (text && text->value.opaque)
+            bin.value = intern(text->value.opaque);
+        bin.info = kind << 16;
+        return true;
+    }
+
+    if (el.num_attrs != 2 || strcmp(el.attrs[1].name, "value")
+        || !el.attrs[1].value || element->child)
+        return false;
+    string value = el.attrs[1].value;
+    if (kind == XMLBIN_PAR)
+    {
+        int val = string2int(value);
+        if (asString(val) != value)
+            return false;
+        bin.value = val;
+    }
+    else if (kind == XMLBIN_REAL)
+    {
+        float val = string2float(value);
+        if (asLongString(val) != value)
+            return false;
+        memcpy(&bin.value, &val, sizeof(float));
+    }
+    else if (value == "yes")
+        bin.value = 1;
+    else if (value == "no")
+        bin.value = 0;
+    else
+        return false;
+    bin.key = intern(el.attrs[0].value);
+    bin.info = kind << 16;
+    return true;
+}
+
+
+unsigned int XMLbinary::encode(mxml_node_t *element)
+{
+    unsigned int index = newNodes.size();
+    binNode bin;
+    bin.name = intern(element->value.element.name);
+    bin.key = XMLBIN_NONE;
+    bin.value = XMLBIN_NONE;
+    bin.child = XMLBIN_NONE;
+    bin.next = XMLBIN_NONE;
+    bin.attrs = newAttrs.size();
+    bin.info = 0;
+
+    if (!encodePar(element, bin))
+    {
+        mxml_element_t &el = element->value.element;
+        unsigned int flags = 0;
+        for (int i = 0; i < el.num_attrs && i < 0xffff; ++i)
+        {
+            binAttr attr;
+            attr.name = intern(el.attrs[i].name);
+            attr.value = el.attrs[i].value ? intern(el.attrs[i].value) : XMLBIN_NONE;
+            newAttrs.push_back(attr);
+            if (!strcmp(el.attrs[i].name, "id") && el.attrs[i].value)
+            {
+                int id = string2int(el.attrs[i].value);
+                if (asString(id) == el.attrs[i].value)
+                {
+                    bin.key = id;
+                    flags |= HAS_ID;
+                }
+            }
+        }
+        // only whitespace between the children is ever lost
+        for (mxml_node_t *text = element->child; text; text = text->next)
+        {
+            if (text->type != MXML_OPAQUE || !text->value.opaque)
+                continue;
+            if (text->value.opaque[strspn(text->value.opaque, " \t\r\n")])
+            {
+                bin.value = intern(text->value.opaque);
+                flags |= HAS_TEXT;
+                break;
+            }
+        }
+        bin.info = (newAttrs.size() - bin.attrs) | (flags << 24);
+    }
+    newNodes.push_back(bin);
+
+    if (((bin.info >> 16) & 0xff) != XMLBIN_BRANCH)
+        return index;
+    unsigned int last = XMLBIN_NONE;
+    for (mxml_node_t *child = element->child; child; child = child->next)
+    {
+        if (child->type != MXML_ELEMENT)
+            continue;
+        unsigned int found = encode(child);
+        if (last == XMLBIN_NONE)
+            newNodes[index].child = found;
+        else
+            newNodes[last].next = found;
+        last = found;
+    }
+    return index;
+}
+
+
+bool XMLbinary::save(mxml_node_t *root, const string& filename)
+{
+    newNodes.clear();
+    newAttrs.clear();
+    newStrings.clear();
+    newIds.clear();
+    if (!root)
+        return false;
+    encode(root);
+
+    header head;
+    memcpy(head.magic, "YBIN", 4);
+    head.version = field(XMLBIN_VERSION);
+    head.nodeCount = field(newNodes.size());
+    head.attrCount = field(newAttrs.size());
+    head.stringBytes = field(newStrings.size());
+    unsigned int offset = sizeof(header);
+    head.nodeStart = field(offset);
+    offset += newNodes.size() * sizeof(binNode);
+    head.attrStart = field(offset);
+    offset += newAttrs.size() * sizeof(binAttr);
+    head.stringStart = field(offset);
+
+    for (size_t i = 0; i < newNodes.size(); ++i)
+    {
+        unsigned int *word = (unsigned int*) &newNodes[i];
+        for (size_t w = 0; w < sizeof(binNode) / sizeof(unsigned int); ++w)
+            word[w] = field(word[w]);
+    }
+    for (size_t i = 0; i < newAttrs.size(); ++i)
+    {
+        newAttrs[i].name = field(newAttrs[i].name);
+        newAttrs[i].value = field(newAttrs[i].value);
+    }
+
+    bool ok = false;
+    FILE *binfile = fopen(filename.c_str(), "wb");
+    if (binfile)
+    {
+        ok = fwrite(&head, sizeof(header), 1, binfile) == 1
+          && (newNodes.empty() || fwrite(&newNodes[0], sizeof(binNode), newNodes.size(), binfile) == newNodes.size())
+          && (newAttrs.empty() || fwrite(&newAttrs[0], sizeof(binAttr), newAttrs.size(), binfile) == newAttrs.size())
+          && fwrite(newStrings.data(), 1, newStrings.size(), binfile) == newStrings.size();
+        if (fclose(binfile) != 0)
+            ok = false;
+    }
+    newNodes.clear();
+    newAttrs.clear();
+    newStrings.clear();
+    newIds.clear();
+    return ok;
+}
+
+
+/*
+ * Everything is checked here once so that lookups can follow indexes
+ * and offsets without any further tests. Children and siblings always
+ * come later in the file, so a damaged one can't make a loop.
+ */
+bool XMLbinary::load(const string& filename)
+{
+    unmap();
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(header))
+    {
+        close(fd);
+        return false;
+    }
+    mapSize = st.st_size;
+    map = mmap(NULL, mapSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        map = NULL;
+        return false;
+    }
+
+    const header *head = (const header*) map;
+    nodeCount = field(head->nodeCount);
+    attrCount = field(head->attrCount);
+    stringBytes = field(head->stringBytes);
+    size_t nodeStart = field(head->nodeStart);
+    size_t attrStart = field(head->attrStart);
+    size_t stringStart = field(head->stringStart);
+    if (memcmp(head->magic, "YBIN", 4) || field(head->version) != XMLBIN_VERSION
+        || nodeCount == 0 || stringBytes == 0
+        || (nodeStart & 3) || (attrStart & 3)
+        || nodeStart + (size_t)nodeCount * sizeof(binNode) > mapSize
+        || attrStart + (size_t)attrCount * sizeof(binAttr) > mapSize
+        || stringStart + stringBytes > mapSize)
+    {
+        unmap();
+        return false;
+    }
+    nodes = (const binNode*) ((const char*) map + nodeStart);
+    attrs = (const binAttr*) ((const char*) map + attrStart);
+    strings = (const char*) map + stringStart;
+    if (strings[stringBytes - 1] != 0)
+    {
+        unmap();
+        return false;
+    }
+
+    bool ok = true;
+    for (unsigned int i = 0; ok && i < nodeCount; ++i)
+    {
+        const binNode &bin = nodes[i];
+        unsigned int info = field(bin.info);
+        unsigned int kind = (info >> 16) & 0xff;
+        unsigned int child = field(bin.child);
+        unsigned int next = field(bin.next);
+        ok = field(bin.name) < stringBytes && kind <= XMLBIN_STRING
+            && (child == XMLBIN_NONE || (child > i && child < nodeCount))
+            && (next == XMLBIN_NONE || (next > i && next < nodeCount));
+        if (!ok)
+            break;
+        if (kind == XMLBIN_BRANCH)
+        {
+            ok = (size_t)field(bin.attrs) + (info & 0xffff) <= attrCount;
+            if (ok && (info >> 24) & HAS_TEXT)
+                ok = field(bin.value) < stringBytes;
+        }
+        else
+        {
+            ok = field(bin.key) < stringBytes && child == XMLBIN_NONE;
+            if (ok && kind == XMLBIN_STRING && field(bin.value) != XMLBIN_NONE)
+                ok = field(bin.value) < stringBytes;
+        }
+    }
+    for (unsigned int i = 0; ok && i < attrCount; ++i)
+    {
+        unsigned int value = field(attrs[i].value);
+        ok = field(attrs[i].name) < stringBytes
+            && (value == XMLBIN_NONE || value < stringBytes);
+    }
+    if (!ok)
+    {
+        unmap();
+        return false;
+    }
+
+    for (unsigned int offset = 0; offset < stringBytes; offset += strlen(strings + offset) + 1)
+        stringIds.insert(make_pair(string(strings + offset), offset));
+    kindName[XMLBIN_PAR] = nameId("par");
+    kindName[XMLBIN_REAL] = nameId("par_real");
+    kindName[XMLBIN_BOOL] = nameId("par_bool");
+    kindName[XMLBIN_STRING] = nameId("string");
+    return true;
+}
+
+
+unsigned int XMLbinary::nameId(const string& name)
+{
+    unordered_map<string, unsigned int>::iterator it = stringIds.find(name);
+    if (it == stringIds.end())
+        return XMLBIN_NONE;
+    return it->second;
+}
+
+
+mxml_node_t *XMLbinary::unpack(mxml_node_t *parent, unsigned int index)
+{
+    const binNode &bin = nodes[index];
+    unsigned int info = field(bin.info);
+    unsigned int value = field(bin.value);
+    mxml_node_t *element = mxmlNewElement(parent, strings + field(bin.name));
+    switch ((info >> 16) & 0xff)
+    {
+        case XMLBIN_PAR:
+            mxmlElementSetAttr(element, "name", strings + field(bin.key));
+            mxmlElementSetAttr(element, "value", asString((int)value).c_str());
+            break;
+
+        case XMLBIN_REAL:
+        {
+            float val;
+            memcpy(&val, &value, sizeof(float));
+            mxmlElementSetAttr(element, "name", strings + field(bin.key));
+            mxmlElementSetAttr(element, "value", asLongString(val).c_str());
+            break;
+        }
+
+        case XMLBIN_BOOL:
+            mxmlElementSetAttr(element, "name", strings + field(bin.key));
+            mxmlElementSetAttr(element, "value", value ? "yes" : "no");
+            break;
+
+        case XMLBIN_STRING:
+            mxmlElementSetAttr(element, "name", strings + field(bin.key));
+            if (value != XMLBIN_NONE)
+                mxmlNewOpaque(element, strings + value);
+            break;
+
+        default:
+        {
+            unsigned int first = field(bin.attrs);
+            for (unsigned int i = first; i < first + (info & 0xffff); ++i)
+            {
+                unsigned int attrValue = field(attrs[i].value);
+                mxmlElementSetAttr(element, strings + field(attrs[i].name),
+                                   (attrValue == XMLBIN_NONE) ? NULL : strings + attrValue);
+            }
+            if ((info >> 24) & HAS_TEXT)
+                mxmlNewOpaque(element, strings + value);
+            break;
+        }
+    }
+    for (unsigned int child = field(bin.child); child != XMLBIN_NONE; child = field(nodes[child].next))
+        unpack(element, child);
+    return element;
+}
+
+
+unsigned int XMLbinary::findBranch(unsigned int parent, const string& name)
+{
+    unsigned int element = nameId(name);
+    if (element == XMLBIN_NONE || parent >= nodeCount)
+        return XMLBIN_NONE;
+    for (unsigned int child = field(nodes[parent].child); child != XMLBIN_NONE; child = field(nodes[child].next))
+    {
+        if (field(nodes[child].name) == element)
+            return child;
+    }
+    return XMLBIN_NONE;
+}
+
+
+unsigned int XMLbinary::findBranch(unsigned int parent, const string& name, int id)
+{
+    unsigned int element = nameId(name);
+    if (element == XMLBIN_NONE || parent >= nodeCount)
+        return XMLBIN_NONE;
+    for (unsigned int child = field(nodes[parent].child); child != XMLBIN_NONE; child = field(nodes[child].next))
+    {
+        const binNode &bin = nodes[child];
+        if (field(bin.name) == element && ((field(bin.info) >> 24) & HAS_ID)
+            && (int)field(bin.key) == id)
+            return child;
+    }
+    return XMLBIN_NONE;
+}
+
+
+// typed nodes match on their key, any that weren't typed on their attribute
+unsigned int XMLbinary::findPar(unsigned int parent, int kind, const string& name)
+{
+    unsigned int key = nameId(name);
+    unsigned int element = kindName[kind];
+    if (key == XMLBIN_NONE || element == XMLBIN_NONE || parent >= nodeCount)
+        return XMLBIN_NONE;
+    for (unsigned int child = field(nodes[parent].child); child != XMLBIN_NONE; child = field(nodes[child].next))
+    {
+        const binNode &bin = nodes[child];
+        unsigned int found = (field(bin.info) >> 16) & 0xff;
+        if (found == (unsigned int)kind)
+        {
+            if (field(bin.key) == key)
+                return child;
+        }
+        else if (found == XMLBIN_BRANCH && field(bin.name) == element)
+        {
+            const char *attr = getAttr(child, "name");
+            if (attr && name == attr)
+                return child;
+        }
+    }
+    return XMLBIN_NONE;
+}
+
+
+const char *XMLbinary::elementName(unsigned int index)
+{
+    if (index >= nodeCount)
+        return NULL;
+    return strings + field(nodes[index].name);
+}
+
+
+const char *XMLbinary::getAttr(unsigned int index, const char *name)
+{
+    if (index >= nodeCount)
+        return NULL;
+    unsigned int info = field(nodes[index].info);
+    if ((info >> 16) & 0xff)
+        return NULL; // typed nodes are reached through their values
+    unsigned int first = field(nodes[index].attrs);
+    for (unsigned int i = first; i < first + (info & 0xffff); ++i)
+    {
+        if (!strcmp(strings + field(attrs[i].name), name))
+        {
+            unsigned int value = field(attrs[i].value);
+            return (value == XMLBIN_NONE) ? NULL : strings + value;
+        }
+    }
+    return NULL;
+}
+
+
+bool XMLbinary::getId(unsigned int index, int &id)
+{
+    if (index >= nodeCount)
+        return false;
+    if ((field(nodes[index].info) >> 24) & HAS_ID)
+    {
+        id = field(nodes[index].key);
+        return true;
+    }
+    const char *attr = getAttr(index, "id");
+    if (!attr)
+        return false;
+    id = string2int(attr);
+    return true;
+}
+
+
+bool XMLbinary::getInt(unsigned int index, int &val)
+{
+    unsigned int kind = (field(nodes[index].info) >> 16) & 0xff;
+    if (kind == XMLBIN_PAR)
+    {
+        val = field(nodes[index].value);
+        return true;
+    }
+    const char *attr = getAttr(index, "value");
+    if (!attr)
+        return false;
+    val = string2int(attr);
+    return true;
+}
+
+
+bool XMLbinary::getReal(unsigned int index, float &val)
+{
+    unsigned int kind = (field(nodes[index].info) >> 16) & 0xff;
+    if (kind == XMLBIN_REAL)
+    {
+        unsigned int bits = field(nodes[index].value);
+        memcpy(&val, &bits, sizeof(float));
+        return true;
+    }
+    const char *attr = getAttr(index, "value");
+    if (!attr)
+        return false;
+    val = string2float(attr);
+    return true;
+}
+
+
+bool XMLbinary::getBool(unsigned int index, int &val)
+{
+    unsigned int kind = (field(nodes[index].info) >> 16) & 0xff;
+    if (kind == XMLBIN_BOOL)
+    {
+        val = field(nodes[index].value);
+        return true;
+    }
+    const char *attr = getAttr(index, "value");
+    if (!attr)
+        return false;
+    char tmp = attr[0] | 0x20;
+    val = (tmp != '0' && tmp != 'n' && tmp != 'f') ? 1 : 0;
+    return true;
+}
+
+
+string XMLbinary::getText(unsigned int index)
+{
+    const binNode &bin = nodes[index];
+    unsigned int info = field(bin.info);
+    unsigned int value = field(bin.value);
+    if (((info >> 16) & 0xff) == XMLBIN_STRING && value != XMLBIN_NONE)
+        return string(strings + value);
+    if (((info >> 16) & 0xff) == XMLBIN_BRANCH && ((info >> 24) & HAS_TEXT))
+        return string(strings + value);
+    return string();
+}
@@ -0,0 +1,133 @@
+/*
+    XMLbinary.h - compact memory mapped form of the XML parameter tree
+
+    Copyright 2016, Will Godfrey & others
+
+    This file is part of yoshimi, which is free software: you can redistribute
+    it and/or modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either version 2 of
+    the License, or (at your option) any later version.
+
+    yoshimi is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE.   See the GNU General Public License (version 2 or
+    later) for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    yoshimi; if not, write to the Free Software Foundation, Inc., 51 Franklin
+    Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef XML_BINARY_H
+#define XML_BINARY_H
+
+#include <mxml.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+using namespace std;
+
+#include "Misc/MiscFuncs.h"
+
+#define XMLBIN_VERSION 1
+#define XMLBIN_NONE 0xffffffff
+
+// node kinds, anything not exactly a plain parameter is a branch
+#define XMLBIN_BRANCH 0
+#define XMLBIN_PAR 1
+#define XMLBIN_REAL 2
+#define XMLBIN_BOOL 3
+#define XMLBIN_STRING 4
+
+/*
+ * The same tree as the xml files, but with par, par_real and par_bool
+ * values already in binary and every name and string stored only once.
+ * Files are little-endian with fixed size records and are mapped
+ * straight into memory, so loading needs no text parsing at all.
+ * Converting an xml tree to this and back gives the same xml.
+ *
+ * File layout:
+ *   header  magic "YBIN", version, counts and offsets of the rest
+ *   nodes   7 words each, node 0 is the root element
+ *   attrs   2 words each, name and value, only used by branches
+ *   strings all names and texts, nul terminated
+ */
+class XMLbinary : private MiscFuncs
+{
+    public:
+        XMLbinary();
+        ~XMLbinary();
+
+        static bool isBinary(const string& filename);
+        bool save(mxml_node_t *root, const string& filename);
+        bool load(const string& filename);
+
+        // rebuild the xml from index down as children of parent
+        mxml_node_t *unpack(mxml_node_t *parent, unsigned int index);
+
+        // all return XMLBIN_NONE if there is no match
+        unsigned int findBranch(unsigned int parent, const string& name);
+        unsigned int findBranch(unsigned int parent, const string& name, int id);
+        unsigned int findPar(unsigned int parent, int kind, const string& name);
+
+        const char *elementName(unsigned int index);
+        const char *getAttr(unsigned int index, const char *name);
+        bool getId(unsigned int index, int &id);
+        bool getInt(unsigned int index, int &val);
+        bool getReal(unsigned int index, float &val);
+        bool getBool(unsigned int index, int &val);
+        string getText(unsigned int index);
+
+    private:
+        struct header {
+            char magic[4];
+            unsigned int version;
+            unsigned int nodeCount;
+            unsigned int attrCount;
+            unsigned int stringBytes;
+            unsigned int nodeStart;
+            unsigned int attrStart;
+            unsigned int stringStart;
+        };
+        struct binNode {
+            unsigned int name; // string offsets unless noted
+            unsigned int key; // name attribute, or id if HAS_ID
+            unsigned int value; // int, float bits, bool or text
+            unsigned int child;
+            unsigned int next;
+            unsigned int attrs; // first of this branch's attributes
+            unsigned int info; // attribute count, kind << 16, flags << 24
+        };
+        struct binAttr {
+            unsigned int name;
+            unsigned int value;
+        };
+
+        // mapped file
+        void *map;
+        size_t mapSize;
+        const binNode *nodes;
+        const binAttr *attrs;
+        const char *strings;
+        unsigned int nodeCount;
+        unsigned int attrCount;
+        unsigned int stringBytes;
+        unordered_map<string, unsigned int> stringIds;
+        unsigned int kindName[XMLBIN_STRING + 1]; // element names of the kinds
+
+        unsigned int nameId(const string& name);
+        unsigned int field(unsigned int word);
+        void unmap(void);
+
+        // building a file
+        vector<binNode> newNodes;
+        vector<binAttr> newAttrs;
+        string newStrings;
+        unordered_map<string, unsigned int> newIds;
+        unsigned int intern(const string& text);
+        unsigned int encode(mxml_node_t *element);
+        bool encodePar(mxml_node_t *element, binNode &bin);
+};
+
+#endif
@@ -24,6 +24,7 @@
 
 #include <zlib.h>
 #include <sstream>
+#include <stdio.h>
 
 #include "Misc/Config.h"
 #include "Misc/XMLwrapper.h"
@@ -32,6 +33,8 @@
 int xml_k = 0;
 char tabs[STACKSIZE + 2];
 
+#define XML_SPLICE "XMLwrapper-cached"
+
 const char *XMLwrapper_whitespace_callback(mxml_node_t *node, int where)
 {
     const char *name = node->value.element.name;
@@ -47,8 +50,47 @@ const char *XMLwrapper_whitespace_callback(mxml_node_t *node, int where)
 }
 
 
+// Streamed loads only keep elements and the text of strings.
+// Whitespace and comments are dropped as they are parsed.
+void XMLwrapper_sax_callback(mxml_node_t *node, mxml_sax_event_t event, void *)
+{
+    switch (event)
+    {
+        case MXML_SAX_ELEMENT_OPEN:
+        case MXML_SAX_DIRECTIVE:
+            mxmlRetain(node);
+            break;
+
+        case MXML_SAX_DATA:
+            if (node->parent && !strcmp(node->parent->value.element.name, "string"))
+                mxmlRetain(node);
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+ssize_t XMLwrapper_gzread(void *cookie, char *buf, size_t size)
+{
+    return gzread((gzFile)cookie, buf, size);
+}
+
+
+int XMLwrapper_gzclose(void *cookie)
+{
+    return (gzclose((gzFile)cookie) == Z_OK) ? 0 : EOF;
+}
+
+
 XMLwrapper::XMLwrapper(SynthEngine *_synth) :
     minimal(true),
+    holdErrors(false),
+    cachable(false),
+    binary(NULL),
+    binnode(0),
+    borrowed(false),
     stackpos(0),
     synth(_synth)
 {
@@ -113,16 +155,62 @@ XMLwrapper::XMLwrapper(SynthEngine *_synth) :
 
 XMLwrapper::~XMLwrapper()
 {
+    clearIndex();
+    dropBinary();
     if (tree)
         mxmlDelete(tree);
 }
 
 
+/*
+ * Reading never changes the tree or the binary data, only the stack
+ * and branch index, and the view has its own of both.
+ */
+XMLwrapper *XMLwrapper::branchView(void)
+{
+    XMLwrapper *view = new XMLwrapper(synth);
+    view->clearIndex();
+    mxmlDelete(view->tree);
+    view->tree = NULL;
+    view->info = NULL;
+    view->borrowed = true;
+    view->minimal = minimal;
+    view->xml_version = xml_version;
+    if (binary)
+    {
+        view->binary = binary;
+        view->binpush(binpeek());
+    }
+    else
+    {
+        view->root = view->node = peek();
+        view->push(view->root);
+    }
+    return view;
+}
+
+
+void XMLwrapper::report(const string& msg, char tostderr)
+{
+    if (!holdErrors)
+        synth->getRuntime().Log(msg, tostderr);
+    else if (!((tostderr & 2) && synth->getRuntime().hideErrors))
+        errors.push_back(msg);
+}
+
+
 bool XMLwrapper::checkfileinformation(const string& filename)
 {
     stackpos = 0;
     memset(&parentstack, 0, sizeof(parentstack));
     information.PADsynth_used = 0;
+    if (XMLbinary::isBinary(filename))
+    {
+        information.ADDsynth_used = 0;
+        information.SUBsynth_used = 0;
+        return loadXMLfile(filename) && binaryinfo();
+    }
+    clearIndex();
     if (tree)
         mxmlDelete(tree);
     tree = NULL;
@@ -189,6 +277,43 @@ bool XMLwrapper::checkfileinformation(const string& filename)
 }
 
 
+// the same search as the two above, through the getters
+bool XMLwrapper::binaryinfo(void)
+{
+    if (enterbranch("INFORMATION"))
+    {
+        information.ADDsynth_used = getparbool("ADDsynth_used", 0);
+        information.SUBsynth_used = getparbool("SUBsynth_used", 0);
+        information.PADsynth_used = getparbool("PADsynth_used", 0);
+        exitbranch();
+        return true;
+    }
+    if (!enterbranch("INSTRUMENT"))
+        return false;
+    if (!enterbranch("INSTRUMENT_KIT"))
+    {
+        exitbranch();
+        return false;
+    }
+    int max = (getpar127("kit_mode", 0) == 0) ? 1 : NUM_KIT_ITEMS;
+    for (int kitnum = 0; kitnum < max; ++kitnum)
+    {
+        if (!enterbranch("INSTRUMENT_KIT_ITEM", kitnum))
+            continue;
+        if (getparbool("enabled", 0))
+        {
+            information.ADDsynth_used |= getparbool("add_enabled", 0);
+            information.SUBsynth_used |= getparbool("sub_enabled", 0);
+            information.PADsynth_used |= getparbool("pad_enabled", 0);
+        }
+        exitbranch();
+    }
+    exitbranch();
+    exitbranch();
+    return true;
+}
+
+
 bool XMLwrapper::slowinfosearch(char *idx)
 {
     idx = strstr(idx, "<INSTRUMENT_KIT>");
@@ -268,16 +393,24 @@ bool XMLwrapper::saveXMLfile(const string& filename)
 
     if (!xmldata)
     {
-        synth->getRuntime().Log("XML: Failed to allocate xml data space");
+        report("XML: Failed to allocate xml data space");
         return false;
     }
+    bool ok = writeXMLdata(filename, xmldata);
+    free(xmldata);
+    return ok;
+}
+
+
+bool XMLwrapper::writeXMLdata(const string& filename, const char *xmldata)
+{
     unsigned int compression = synth->getRuntime().GzipCompression;
     if (compression == 0)
     {
         FILE *xmlfile = fopen(filename.c_str(), "w");
         if (!xmlfile)
         {
-            synth->getRuntime().Log("XML: Failed to open xml file " + filename + " for save", 2);
+            report("XML: Failed to open xml file " + filename + " for save", 2);
             return false;
         }
         fputs(xmldata, xmlfile);
@@ -294,17 +427,58 @@ bool XMLwrapper::saveXMLfile(const string& filename)
         gzfile = gzopen(filename.c_str(), options);
         if (gzfile == NULL)
         {
-            synth->getRuntime().Log("XML: gzopen() == NULL");
+            report("XML: gzopen() == NULL");
             return false;
         }
         gzputs(gzfile, xmldata);
         gzclose(gzfile);
     }
-    free(xmldata);
     return true;
 }
 
 
+/*
+ * Written to a temporary name first so a failure never leaves
+ * a damaged file behind. XML comes back out with the compression
+ * currently set.
+ */
+bool XMLwrapper::convertfile(const string& filename, bool toBinary)
+{
+    if (XMLbinary::isBinary(filename) == toBinary)
+        return true; // already there
+    if (!loadXMLfile(filename))
+        return false;
+    string tmpname = filename + ".convert";
+    bool ok;
+    if (toBinary)
+    {
+        XMLbinary packed;
+        ok = packed.save(root, tmpname);
+    }
+    else
+    {
+        const char *rootname = binary->elementName(0);
+        mxml_node_t *newtree = mxmlNewElement(MXML_NO_PARENT, "?xml version=\"1.0\" encoding=\"UTF-8\"?");
+        mxml_node_t *doctype = mxmlNewElement(newtree, "!DOCTYPE");
+        mxmlElementSetAttr(doctype, rootname, NULL);
+        binary->unpack(newtree, 0);
+        char *xmldata = mxmlSaveAllocString(newtree, XMLwrapper_whitespace_callback);
+        mxmlDelete(newtree);
+        ok = xmldata && writeXMLdata(tmpname, xmldata);
+        if (xmldata)
+            free(xmldata);
+    }
+    if (ok && rename(tmpname.c_str(), filename.c_str()) != 0)
+        ok = false;
+    if (!ok)
+    {
+        unlink(tmpname.c_str());
+        report("XML: Failed to convert " + filename, 2);
+    }
+    return ok;
+}
+
+
 char *XMLwrapper::getXMLdata()
 {
     xml_k = 0;
@@ -366,6 +540,14 @@ char *XMLwrapper::getXMLdata()
     }
     node = oldnode;
     char *xmldata = mxmlSaveAllocString(tree, XMLwrapper_whitespace_callback);
+    if (xmldata && !spliced.empty())
+    {
+        string full = splice(xmldata);
+        free(xmldata);
+        xmldata = (char*) malloc(full.size() + 1);
+        if (xmldata)
+            memcpy(xmldata, full.c_str(), full.size() + 1);
+    }
     return xmldata;
 }
 
@@ -393,6 +575,7 @@ void XMLwrapper::addparbool(const string& name, int val)
 
 void XMLwrapper::addparstr(const string& name, const string& val)
 {
+    dropIndex(node);
     mxml_node_t *element = mxmlNewElement(node, "string");
     mxmlElementSetAttr(element, "name", name.c_str());
     mxmlNewText(element, 0, val.c_str());
@@ -419,66 +602,187 @@ void XMLwrapper::endbranch()
 }
 
 
+/*
+ * Each element starts on a new line and nothing is indented, so text
+ * written out on its own is exactly what it would be as part of the
+ * whole tree.
+ */
+bool XMLwrapper::begincached(XMLcache &cache)
+{
+    if (!cachable)
+        return false;
+    if (!__sync_fetch_and_and(&cache.dirty, 0))
+    {
+        addsplice(cache.text);
+        return true;
+    }
+    // cleared before making it, so a change while we do is kept for next time
+    push(node);
+    node = addparams0(XML_SPLICE);
+    return false;
+}
+
+
+void XMLwrapper::endcached(XMLcache &cache)
+{
+    if (!cachable)
+        return;
+    mxml_node_t *holder = node;
+    node = pop();
+    char *xmldata = mxmlSaveAllocString(holder, XMLwrapper_whitespace_callback);
+    mxmlDelete(holder); // nothing added after it yet
+    cache.text.clear();
+    if (xmldata)
+    {
+        // only what's inside the holder
+        char *start = strchr(xmldata, '>');
+        char *end = strrchr(xmldata, '<');
+        if (start && end > start && end[1] == '/')
+        {
+            if (end[-1] == '\n')
+                --end;
+            *end = 0;
+            cache.text = splice(start + 1);
+        }
+        free(xmldata);
+    }
+    else
+        cache.touch(); // try again next time
+    addsplice(cache.text);
+}
+
+
+void XMLwrapper::addsplice(const string& text)
+{
+    mxml_node_t *marker = addparams1(XML_SPLICE, "n", asString((int)spliced.size()));
+    if (marker)
+        spliced.push_back(text);
+}
+
+
+string XMLwrapper::splice(const char *xmldata)
+{
+    static const string marker = "<" XML_SPLICE " n=\"";
+    string result;
+    const char *from = xmldata;
+    const char *found;
+    while ((found = strstr(from, marker.c_str())))
+    {
+        const char *close = strchr(found, '>');
+        if (!close)
+            break;
+        unsigned int n = strtoul(found + marker.size(), NULL, 10);
+        if (found > from && found[-1] == '\n')
+            --found; // the text brings its own
+        result.append(from, found - from);
+        if (n < spliced.size())
+            result += spliced[n];
+        from = close + 1;
+    }
+    result += from;
+    return result;
+}
+
+
 // LOAD XML members
-bool XMLwrapper::loadXMLfile(const string& filename)
+bool XMLwrapper::loadXMLfile(const string& filename, bool streamed)
 {
     bool zynfile = true;
     bool yoshitoo = false;
 
+    clearIndex();
+    dropBinary();
     if (tree)
         mxmlDelete(tree);
-    tree = NULL;
+    root = node = tree = NULL;
     memset(&parentstack, 0, sizeof(parentstack));
     stackpos = 0;
-    const char *xmldata = doloadfile(filename);
-    if (xmldata == NULL)
+    if (XMLbinary::isBinary(filename))
     {
-        synth->getRuntime().Log("XML: Could not load xml file: " + filename, 2);
-         return false;
+        binary = new XMLbinary;
+        if (!binary->load(filename))
+        {
+            report("XML: File " + filename + " is not valid binary data", 2);
+            dropBinary();
+            return false;
+        }
+        const char *rootname = binary->elementName(0);
+        zynfile = !strcmp(rootname, "ZynAddSubFX-data");
+        if (!zynfile && strcmp(rootname, "Yoshimi-data"))
+        {
+            report("XML: File " + filename + " doesn't contain valid data in this context", 2);
+            dropBinary();
+            return false;
+        }
+        binpush(0);
     }
-    root = tree = mxmlLoadString(NULL, xmldata, MXML_OPAQUE_CALLBACK);
-    delete [] xmldata;
-    if (!tree)
+    else if (streamed)
     {
-        synth->getRuntime().Log("XML: File " + filename + " is not XML", 2);
-        return false;
+        FILE *xmlfile = openstream(filename);
+        if (xmlfile == NULL)
+        {
+            report("XML: Could not load xml file: " + filename, 2);
+            return false;
+        }
+        root = tree = mxmlSAXLoadFile(NULL, xmlfile, MXML_OPAQUE_CALLBACK,
+                                      XMLwrapper_sax_callback, NULL);
+        fclose(xmlfile);
     }
-    root = mxmlFindElement(tree, tree, "ZynAddSubFX-data", NULL, NULL, MXML_DESCEND);
-    if (!root)
+    else
     {
-        zynfile = false;
-        root = mxmlFindElement(tree, tree, "Yoshimi-data", NULL, NULL, MXML_DESCEND);
+        const char *xmldata = doloadfile(filename);
+        if (xmldata == NULL)
+        {
+            report("XML: Could not load xml file: " + filename, 2);
+            return false;
+        }
+        root = tree = mxmlLoadString(NULL, xmldata, MXML_OPAQUE_CALLBACK);
+        delete [] xmldata;
     }
-
-    if (!root)
+    if (!binary)
     {
-        synth->getRuntime().Log("XML: File " + filename + " doesn't contain valid data in this context", 2);
-        return false;
+        if (!tree)
+        {
+            report("XML: File " + filename + " is not XML", 2);
+            return false;
+        }
+        root = mxmlFindElement(tree, tree, "ZynAddSubFX-data", NULL, NULL, MXML_DESCEND);
+        if (!root)
+        {
+            zynfile = false;
+            root = mxmlFindElement(tree, tree, "Yoshimi-data", NULL, NULL, MXML_DESCEND);
+        }
+
+        if (!root)
+        {
+            report("XML: File " + filename + " doesn't contain valid data in this context", 2);
+            return false;
+        }
+        node = root;
+        push(root);
     }
-    node = root;
-    push(root);
     if (zynfile)
     {
-        xml_version.major = string2int(mxmlElementGetAttr(root, "version-major"));
-        xml_version.minor = string2int(mxmlElementGetAttr(root, "version-minor"));
+        xml_version.major = string2int(rootAttr("version-major"));
+        xml_version.minor = string2int(rootAttr("version-minor"));
     }
-    if (mxmlElementGetAttr(root, "Yoshimi-major"))
+    if (rootAttr("Yoshimi-major"))
     {
-        xml_version.y_major = string2int(mxmlElementGetAttr(root, "Yoshimi-major"));
+        xml_version.y_major = string2int(rootAttr("Yoshimi-major"));
         yoshitoo = true;
 //        synth->getRuntime().Log("XML: Yoshimi " + asString(xml_version.y_major));
     }
-    if (mxmlElementGetAttr(root, "Yoshimi-minor"))
+    if (rootAttr("Yoshimi-minor"))
     {
-        xml_version.y_minor = string2int(mxmlElementGetAttr(root, "Yoshimi-minor"));
+        xml_version.y_minor = string2int(rootAttr("Yoshimi-minor"));
 //        synth->getRuntime().Log("XML: Yoshimi " + asString(xml_version.y_minor));
     }
     if (synth->getRuntime().logXMLheaders)
     {
         if (zynfile)
-            synth->getRuntime().Log("ZynAddSubFX version major " + asString(xml_version.major) + "   minor " + asString(xml_version.minor));
+            report("ZynAddSubFX version major " + asString(xml_version.major) + "   minor " + asString(xml_version.minor));
         if (yoshitoo)
-            synth->getRuntime().Log("Yoshimi version major " + asString(xml_version.y_major) + "   minor " + asString(xml_version.y_minor));
+            report("Yoshimi version major " + asString(xml_version.y_major) + "   minor " + asString(xml_version.y_minor));
     }
     return true;
 }
@@ -490,7 +794,7 @@ char *XMLwrapper::doloadfile(const string& filename)
     gzFile gzf  = gzopen(filename.c_str(), "rb");
     if (!gzf)
     {
-        synth->getRuntime().Log("XML: Failed to open xml file " + filename + " for load, errno: "
+        report("XML: Failed to open xml file " + filename + " for load, errno: "
                     + asString(errno) + "  " + string(strerror(errno)), 2);
         return NULL;
     }
@@ -511,9 +815,9 @@ char *XMLwrapper::doloadfile(const string& filename)
         else if (this_read < 0)
         {
             int errnum;
-            synth->getRuntime().Log("XML: Read error in zlib: " + string(gzerror(gzf, &errnum)), 2);
+            report("XML: Read error in zlib: " + string(gzerror(gzf, &errnum)), 2);
             if (errnum == Z_ERRNO)
-                synth->getRuntime().Log("XML: Filesystem error: " + string(strerror(errno)), 2);
+                report("XML: Filesystem error: " + string(strerror(errno)), 2);
             quit = true;
         }
         else if (total_bytes > 0)
@@ -532,8 +836,29 @@ char *XMLwrapper::doloadfile(const string& filename)
 }
 
 
+// zlib reads plain files as well as gzipped ones
+FILE *XMLwrapper::openstream(const string& filename)
+{
+    gzFile gzf  = gzopen(filename.c_str(), "rb");
+    if (!gzf)
+    {
+        report("XML: Failed to open xml file " + filename + " for load, errno: "
+                    + asString(errno) + "  " + string(strerror(errno)), 2);
+        return NULL;
+    }
+    gzbuffer(gzf, 65536);
+    cookie_io_functions_t gzio = { XMLwrapper_gzread, NULL, NULL, XMLwrapper_gzclose };
+    FILE *xmlfile = fopencookie(gzf, "r", gzio);
+    if (!xmlfile)
+        gzclose(gzf);
+    return xmlfile;
+}
+
+
 bool XMLwrapper::putXMLdata(const char *xmldata)
 {
+    clearIndex();
+    dropBinary();
     if (tree)
         mxmlDelete(tree);
     tree = NULL;
@@ -554,8 +879,15 @@ bool XMLwrapper::putXMLdata(const char *xmldata)
 
 bool XMLwrapper::enterbranch(const string& name)
 {
-    node = mxmlFindElement(peek(), peek(), name.c_str(), NULL, NULL,
-                           MXML_DESCEND_FIRST);
+    if (binary)
+    {
+        unsigned int found = binary->findBranch(binpeek(), name);
+        if (found == XMLBIN_NONE)
+            return false;
+        binpush(found);
+        return true;
+    }
+    node = findChild(name.c_str(), NULL, name);
     if (!node)
         return false;
     push(node);
@@ -565,8 +897,15 @@ bool XMLwrapper::enterbranch(const string& name)
 
 bool XMLwrapper::enterbranch(const string& name, int id)
 {
-    node = mxmlFindElement(peek(), peek(), name.c_str(), "id",
-                           asString(id).c_str(), MXML_DESCEND_FIRST);
+    if (binary)
+    {
+        unsigned int found = binary->findBranch(binpeek(), name, id);
+        if (found == XMLBIN_NONE)
+            return false;
+        binpush(found);
+        return true;
+    }
+    node = findChild(name.c_str(), "id", asString(id));
     if (!node)
         return false;
     push(node);
@@ -576,7 +915,11 @@ bool XMLwrapper::enterbranch(const string& name, int id)
 
 int XMLwrapper::getbranchid(int min, int max)
 {
-    int id = string2int(mxmlElementGetAttr(node, "id"));
+    int id = 0;
+    if (binary)
+        binary->getId(binnode, id);
+    else
+        id = string2int(mxmlElementGetAttr(node, "id"));
     if (min == 0 && max == 0)
         return id;
     if (id < min)
@@ -589,13 +932,23 @@ int XMLwrapper::getbranchid(int min, int max)
 
 int XMLwrapper::getpar(const string& name, int defaultpar, int min, int max)
 {
-    node = mxmlFindElement(peek(), peek(), "par", "name", name.c_str(), MXML_DESCEND_FIRST);
-    if (!node)
-        return defaultpar;
-    const char *strval = mxmlElementGetAttr(node, "value");
-    if (!strval)
-        return defaultpar;
-    int val = string2int(strval);
+    int val;
+    if (binary)
+    {
+        unsigned int found = binary->findPar(binpeek(), XMLBIN_PAR, name);
+        if (found == XMLBIN_NONE || !binary->getInt(found, val))
+            return defaultpar;
+    }
+    else
+    {
+        node = findChild("par", "name", name);
+        if (!node)
+            return defaultpar;
+        const char *strval = mxmlElementGetAttr(node, "value");
+        if (!strval)
+            return defaultpar;
+        val = string2int(strval);
+    }
     if (val < min)
         val = min;
     else if (val > max)
@@ -618,7 +971,15 @@ int XMLwrapper::getpar255(const string& name, int defaultpar)
 
 int XMLwrapper::getparbool(const string& name, int defaultpar)
 {
-    node = mxmlFindElement(peek(), peek(), "par_bool", "name", name.c_str(), MXML_DESCEND_FIRST);
+    if (binary)
+    {
+        int val;
+        unsigned int found = binary->findPar(binpeek(), XMLBIN_BOOL, name);
+        if (found == XMLBIN_NONE || !binary->getBool(found, val))
+            return defaultpar;
+        return val;
+    }
+    node = findChild("par_bool", "name", name);
     if (!node)
         return defaultpar;
     const char *strval = mxmlElementGetAttr(node, "value");
@@ -631,7 +992,14 @@ int XMLwrapper::getparbool(const string& name, int defaultpar)
 
 string XMLwrapper::getparstr(const string& name)
 {
-    node = mxmlFindElement(peek(), peek(), "string", "name", name.c_str(), MXML_DESCEND_FIRST);
+    if (binary)
+    {
+        unsigned int found = binary->findPar(binpeek(), XMLBIN_STRING, name);
+        if (found == XMLBIN_NONE)
+            return string();
+        return binary->getText(found);
+    }
+    node = findChild("string", "name", name);
     if (!node)
         return string();
     if (!node->child)
@@ -644,8 +1012,15 @@ string XMLwrapper::getparstr(const string& name)
 
 float XMLwrapper::getparreal(const string& name, float defaultpar)
 {
-    node = mxmlFindElement(peek(), peek(), "par_real", "name", name.c_str(),
-                           MXML_DESCEND_FIRST);
+    if (binary)
+    {
+        float val;
+        unsigned int found = binary->findPar(binpeek(), XMLBIN_REAL, name);
+        if (found == XMLBIN_NONE || !binary->getReal(found, val))
+            return defaultpar;
+        return val;
+    }
+    node = findChild("par_real", "name", name);
     if (!node)
         return defaultpar;
     const char *strval = mxmlElementGetAttr(node, "value");
@@ -670,6 +1045,7 @@ float XMLwrapper::getparreal(const string& name, float defaultpar, float min, fl
 
 mxml_node_t *XMLwrapper::addparams0(const string& name)
 {
+    dropIndex(node);
     mxml_node_t *element = mxmlNewElement(node, name.c_str());
     return element;
 }
@@ -677,6 +1053,7 @@ mxml_node_t *XMLwrapper::addparams0(const string& name)
 
 mxml_node_t *XMLwrapper::addparams1(const string& name, const string& par1, const string& val1)
 {
+    dropIndex(node);
     mxml_node_t *element = mxmlNewElement(node, name.c_str());
     mxmlElementSetAttr(element, par1.c_str(), val1.c_str());
     return element;
@@ -686,6 +1063,7 @@ mxml_node_t *XMLwrapper::addparams1(const string& name, const string& par1, cons
 mxml_node_t *XMLwrapper::addparams2(const string& name, const string& par1, const string& val1,
                                     const string& par2, const string& val2)
 {
+    dropIndex(node);
     mxml_node_t *element = mxmlNewElement(node, name.c_str());
     mxmlElementSetAttr(element, par1.c_str(), val1.c_str());
     mxmlElementSetAttr(element, par2.c_str(), val2.c_str());
@@ -693,11 +1071,122 @@ mxml_node_t *XMLwrapper::addparams2(const string& name, const string& par1, cons
 }
 
 
+/*
+ * Same result as mxmlFindElement(branch, branch, element, attr, value,
+ * MXML_DESCEND_FIRST), the first matching child, but without comparing
+ * against every child of a big branch on every call.
+ */
+mxml_node_t *XMLwrapper::findChild(const char *element, const char *attr, const string& value)
+{
+    mxml_node_t *branch = peek();
+    branchMap *index = indexOf(branch);
+    if (!index)
+        return mxmlFindElement(branch, branch, element, attr,
+                               attr ? value.c_str() : NULL, MXML_DESCEND_FIRST);
+    string key = element;
+    if (attr)
+    {
+        key += (attr[0] == 'i') ? '\x02' : '\x01'; // only "id" and "name"
+        key += value;
+    }
+    branchMap::iterator it = index->find(key);
+    if (it == index->end())
+        return NULL;
+    return it->second;
+}
+
+
+XMLwrapper::branchMap *XMLwrapper::indexOf(mxml_node_t *branch)
+{
+    unordered_map<mxml_node_t*, branchMap*>::iterator it = branchIndex.find(branch);
+    if (it != branchIndex.end())
+        return it->second;
+
+    // small branches aren't remembered, they may yet grow
+    // and counting no further than this is cheap anyway
+    int children = 0;
+    for (mxml_node_t *child = branch->child; child && children < INDEX_MIN_CHILDREN; child = child->next)
+        if (child->type == MXML_ELEMENT)
+            ++children;
+    if (children < INDEX_MIN_CHILDREN)
+        return NULL;
+
+    branchMap *index = new branchMap;
+    for (mxml_node_t *child = branch->child; child; child = child->next)
+    {
+        if (child->type != MXML_ELEMENT)
+            continue;
+        string element = child->value.element.name;
+        index->insert(make_pair(element, child)); // insert keeps the first one
+        const char *name = mxmlElementGetAttr(child, "name");
+        if (name)
+            index->insert(make_pair(element + '\x01' + name, child));
+        const char *id = mxmlElementGetAttr(child, "id");
+        if (id)
+            index->insert(make_pair(element + '\x02' + id, child));
+    }
+    branchIndex[branch] = index;
+    return index;
+}
+
+
+// a branch being added to can't use what was found before
+void XMLwrapper::dropIndex(mxml_node_t *branch)
+{
+    if (branchIndex.empty())
+        return;
+    unordered_map<mxml_node_t*, branchMap*>::iterator it = branchIndex.find(branch);
+    if (it == branchIndex.end())
+        return;
+    delete it->second;
+    branchIndex.erase(it);
+}
+
+
+void XMLwrapper::clearIndex(void)
+{
+    unordered_map<mxml_node_t*, branchMap*>::iterator it;
+    for (it = branchIndex.begin(); it != branchIndex.end(); ++it)
+        delete it->second;
+    branchIndex.clear();
+}
+
+
+void XMLwrapper::binpush(unsigned int index)
+{
+    if (stackpos >= STACKSIZE - 1)
+    {
+        report("XML: Not good, XMLwrapper push on a full parentstack", 2);
+        return;
+    }
+    stackpos++;
+    binstack[stackpos] = index;
+    binnode = index;
+}
+
+
+void XMLwrapper::dropBinary(void)
+{
+    if (binary && !borrowed)
+        delete binary;
+    binary = NULL;
+    borrowed = false;
+}
+
+
+const char *XMLwrapper::rootAttr(const char *name)
+{
+    if (binary)
+        return binary->getAttr(0, name);
+    return mxmlElementGetAttr(root, name);
+}
+
+
 void XMLwrapper::push(mxml_node_t *node)
 {
     if (stackpos >= STACKSIZE - 1)
     {
-        synth->getRuntime().Log("XML: Not good, XMLwrapper push on a full parentstack", 2);
+        report("XML: Not good, XMLwrapper push on a full parentstack", 2);
         return;
     }
     stackpos++;
@@ -709,7 +1198,7 @@ mxml_node_t *XMLwrapper::pop(void)
 {
     if (stackpos <= 0)
     {
-        synth->getRuntime().Log("XML: Not good, XMLwrapper pop on empty parentstack", 2);
+        report("XML: Not good, XMLwrapper pop on empty parentstack", 2);
         return root;
     }
     mxml_node_t *node = parentstack[stackpos];
@@ -723,7 +1212,7 @@ mxml_node_t *XMLwrapper::peek(void)
 {
     if (stackpos <= 0)
     {
-        synth->getRuntime().Log("XML: Not good, XMLwrapper peek on an empty parentstack", 2);
+        report("XML: Not good, XMLwrapper peek on an empty parentstack", 2);
         return root;
     }
     return parentstack[stackpos];
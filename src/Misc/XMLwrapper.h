@@ -27,16 +27,38 @@
 
 #include <mxml.h>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 using namespace std;
 
 #include "Misc/MiscFuncs.h"
+#include "Misc/XMLbinary.h"
 
 // max tree depth
 #define STACKSIZE 128
 
+// branches with fewer children than this are just searched in turn
+#define INDEX_MIN_CHILDREN 12
+
 class SynthEngine;
 
+/*
+ * Part of a save kept as finished xml text for the next one. Whatever
+ * changes what it holds calls touch(), and only then is it made again.
+ */
+class XMLcache
+{
+    public:
+        XMLcache() : dirty(1) { }
+        void touch(void) { __sync_or_and_fetch(&dirty, 1); }
+
+    private:
+        friend class XMLwrapper;
+        int dirty;
+        string text;
+};
+
 class XMLwrapper : private MiscFuncs
 {
     public:
@@ -46,6 +68,9 @@ class XMLwrapper : private MiscFuncs
         // SAVE to XML
         bool saveXMLfile(const string& filename); // return true if ok, false otherwise
 
+        // rewrite a file in the other format, keeping its name
+        bool convertfile(const string& filename, bool toBinary);
+
         // returns the new allocated string that contains the XML data (used for clipboard)
         // the string is NULL terminated
         char *getXMLdata(void);
@@ -67,12 +92,26 @@ class XMLwrapper : private MiscFuncs
         // this must be called after each branch (nodes that contains child nodes)
         void endbranch(void);
 
-        // LOAD from XML
-        bool loadXMLfile(const string& filename); // true if loaded ok
+        // Everything added between these two is kept in cache. If nothing
+        // has touched it since, begincached() adds the kept text instead
+        // and returns true, and the caller skips making it all again.
+        // Does nothing unless cachable is set.
+        bool begincached(XMLcache &cache);
+        void endcached(XMLcache &cache);
+
+        // LOAD from XML, or the binary form of it
+        // streamed decompresses straight into the parser and keeps only
+        // what the getters use, for big read-only loads
+        bool loadXMLfile(const string& filename, bool streamed = false); // true if loaded ok
 
         // used by the clipboard
         bool putXMLdata(const char *xmldata);
 
+        // A new wrapper reading just the current branch, which can be used
+        // from another thread while this one is left alone. It shares this
+        // one's tree so must be deleted first.
+        XMLwrapper *branchView(void);
+
         // enter into the branch
         // returns 1 if is ok, or 0 otherwise
         bool enterbranch(const string& name);
@@ -110,6 +149,9 @@ class XMLwrapper : private MiscFuncs
                          float min, float max);
 
         bool minimal; // false if all parameters will be stored (used only for clipboard)
+        bool holdErrors; // keep messages in 'errors' for the caller to log, off the main threads
+        vector<string> errors;
+        bool cachable; // the caches aren't shared safely, only set with the engine locked
 
         struct {
             unsigned char ADDsynth_used;
@@ -123,7 +165,39 @@ class XMLwrapper : private MiscFuncs
         bool slowinfosearch(char *xmldata);
 
     private:
+        void report(const string& msg, char tostderr = 0);
         char *doloadfile(const string& filename);
+        FILE *openstream(const string& filename);
+        bool writeXMLdata(const string& filename, const char *xmldata);
+        const char *rootAttr(const char *name);
+        bool binaryinfo(void);
+
+        // cached text goes in as a marker element, swapped for the
+        // text itself once the tree is written out, by which time the
+        // cache may be in use again so we hold a copy
+        vector<string> spliced;
+        void addsplice(const string& text);
+        string splice(const char *xmldata);
+
+        // set when a binary file is loaded, the getters then read
+        // from it and the stack holds its node numbers instead
+        XMLbinary *binary;
+        unsigned int binstack[STACKSIZE];
+        unsigned int binnode;
+        bool borrowed; // binary belongs to another wrapper
+        void binpush(unsigned int index);
+        unsigned int binpeek(void) { return (stackpos > 0) ? binstack[stackpos] : 0; }
+        void dropBinary(void);
+
+        // Lookup of a branch's children by element name, and by name
+        // plus "name" or "id" attribute. Each branch is only indexed
+        // the first time something is looked for in it.
+        typedef unordered_map<string, mxml_node_t*> branchMap;
+        unordered_map<mxml_node_t*, branchMap*> branchIndex;
+        mxml_node_t *findChild(const char *element, const char *attr, const string& value);
+        branchMap *indexOf(mxml_node_t *branch);
+        void dropIndex(mxml_node_t *branch);
+        void clearIndex(void);
 
         mxml_node_t *tree;
         mxml_node_t *root;
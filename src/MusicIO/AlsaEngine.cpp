@@ -20,6 +20,10 @@
 */
 
 #include <endian.h>
+#include <time.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 using namespace std;
 
@@ -27,6 +31,19 @@ using namespace std;
 #include "Misc/SynthEngine.h"
 #include "MusicIO/AlsaEngine.h"
 
+#define MIDI_QUEUE_SIZE 512 // timed events waiting for the audio thread
+
+// what gets passed from the midi thread to the audio one
+struct timedEvent {
+    long long when; // monotonic ns
+    snd_seq_event_t event;
+};
+
+static long long nsecs(const struct timespec &ts)
+{
+    return (long long)ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
 AlsaEngine::AlsaEngine(SynthEngine *_synth) :MusicIO(_synth)
 {
     audio.handle = NULL;
@@ -37,10 +54,21 @@ AlsaEngine::AlsaEngine(SynthEngine *_synth) :MusicIO(_synth)
     audio.buffer_size = 0;
     audio.alsaId = -1;
     audio.pThread = 0;
+    audio.direct = false;
+    audio.dither = 0;
+    for (int i = 0; i < 4; ++i)
+        audio.noise[i] = 0x9e3779b9 * (i + 1); // xorshift, any non-zero seed
+    audio.timed = false;
+    audio.midiEvents = jack_ringbuffer_create(sizeof(timedEvent) * MIDI_QUEUE_SIZE);
+    if (audio.midiEvents && jack_ringbuffer_mlock(audio.midiEvents))
+        synth->getRuntime().Log("Failed to lock memory for alsa midi queue");
 
     midi.handle = NULL;
     midi.alsaId = -1;
     midi.pThread = 0;
+    midi.queue = -1;
+    midi.queueBase = 0;
+    midi.audioSide = NULL;
 #if __BYTE_ORDER  == __LITTLE_ENDIAN
         little_endian = true;
 #else
@@ -49,13 +77,24 @@ AlsaEngine::AlsaEngine(SynthEngine *_synth) :MusicIO(_synth)
 }
 
 
+AlsaEngine::~AlsaEngine()
+{
+    if (audio.midiEvents)
+    {
+        jack_ringbuffer_free(audio.midiEvents);
+        audio.midiEvents = NULL;
+    }
+}
+
+
 bool AlsaEngine::openAudio(void)
 {
     audio.device = synth->getRuntime().audioDevice;
     audio.samplerate = synth->getRuntime().Samplerate;
     audio.period_size = synth->getRuntime().Buffersize;
-    audio.period_count = 2;
+    audio.period_count = synth->getRuntime().alsaPeriods;
     audio.buffer_size = audio.period_size * audio.period_count;
+    audio.dither = synth->getRuntime().alsaDither;
     if (alsaBad(snd_pcm_open(&audio.handle, audio.device.c_str(),
                              SND_PCM_STREAM_PLAYBACK, SND_PCM_NO_AUTO_CHANNELS),
             "failed to open alsa audio device:" + audio.device))
@@ -91,7 +130,8 @@ bool AlsaEngine::openMidi(void)
     midi.device = synth->getRuntime().midiDevice;
     const char* port_name = "input";
     int port_num;
-    if (snd_seq_open(&midi.handle, "default", SND_SEQ_OPEN_INPUT, SND_SEQ_NONBLOCK) != 0)
+    // duplex only so we can start our own queue
+    if (snd_seq_open(&midi.handle, "default", SND_SEQ_OPEN_DUPLEX, SND_SEQ_NONBLOCK) != 0)
     {
         synth->getRuntime().Log("Failed to open alsa midi");
         goto bail_out;
@@ -127,6 +167,32 @@ bool AlsaEngine::openMidi(void)
         synth->getRuntime().Log("Failed to acquire alsa midi port");
         goto bail_out;
     }
+
+    // have every incoming event stamped with the real time it arrived
+    midi.queue = snd_seq_alloc_named_queue(midi.handle, midiClientName().c_str());
+    if (midi.queue >= 0)
+    {
+        snd_seq_port_info_t *port_info;
+        snd_seq_port_info_alloca(&port_info);
+        bool stamped = (snd_seq_get_port_info(midi.handle, port_num, port_info) == 0);
+        if (stamped)
+        {
+            snd_seq_port_info_set_timestamping(port_info, 1);
+            snd_seq_port_info_set_timestamp_real(port_info, 1);
+            snd_seq_port_info_set_timestamp_queue(port_info, midi.queue);
+            stamped = snd_seq_set_port_info(midi.handle, port_num, port_info) == 0
+                   && snd_seq_start_queue(midi.handle, midi.queue, NULL) == 0
+                   && snd_seq_drain_output(midi.handle) >= 0;
+        }
+        if (!stamped)
+        {
+            synth->getRuntime().Log("Failed to set alsa midi timestamps");
+            snd_seq_free_queue(midi.handle, midi.queue);
+            midi.queue = -1;
+        }
+        else
+            syncQueueClock();
+    }
     if (!midi.device.empty() && midi.device != "default")
     {
         bool midiSource = false;
@@ -172,6 +238,9 @@ void AlsaEngine::Close(void)
     if (audio.handle != NULL)
         alsaBad(snd_pcm_close(audio.handle), "close pcm failed");
     audio.handle = NULL;
+    if (NULL != midi.handle && midi.queue >= 0)
+        snd_seq_free_queue(midi.handle, midi.queue);
+    midi.queue = -1;
     if (NULL != midi.handle)
         if (snd_seq_close(midi.handle) < 0)
             synth->getRuntime().Log("Error closing Alsa midi connection");
@@ -218,16 +287,18 @@ bool AlsaEngine::prepHwparams(void)
         int card_bits;
         bool card_endian;
         bool card_signed;
+        bool card_float;
     }
     card_formats[] =
     {
-        {SND_PCM_FORMAT_S32_LE, 32, true, true},
-        {SND_PCM_FORMAT_S32_BE, 32, false, true},
-        {SND_PCM_FORMAT_S24_3LE, 24, true, true},
-        {SND_PCM_FORMAT_S24_3BE, 24, false, true},
-        {SND_PCM_FORMAT_S16_LE, 16, true, true},
-        {SND_PCM_FORMAT_S16_BE, 16, false, true},
-        {SND_PCM_FORMAT_UNKNOWN, 0, false, true}
+        {SND_PCM_FORMAT_FLOAT_LE, 32, true, true, true}, // little endian machines only
+        {SND_PCM_FORMAT_S32_LE, 32, true, true, false},
+        {SND_PCM_FORMAT_S32_BE, 32, false, true, false},
+        {SND_PCM_FORMAT_S24_3LE, 24, true, true, false},
+        {SND_PCM_FORMAT_S24_3BE, 24, false, true, false},
+        {SND_PCM_FORMAT_S16_LE, 16, true, true, false},
+        {SND_PCM_FORMAT_S16_BE, 16, false, true, false},
+        {SND_PCM_FORMAT_UNKNOWN, 0, false, true, false}
     };
     int formidx;
     string formattxt = "";
@@ -258,7 +329,8 @@ bool AlsaEngine::prepHwparams(void)
     }
 
     formidx = 0;
-    while (snd_pcm_hw_params_set_format(audio.handle, hwparams, card_formats[formidx].card_format) < 0)
+    while ((card_formats[formidx].card_float && !little_endian)
+           || snd_pcm_hw_params_set_format(audio.handle, hwparams, card_formats[formidx].card_format) < 0)
     {
         ++formidx;
         if (card_formats[formidx].card_bits == 0)
@@ -270,10 +342,17 @@ bool AlsaEngine::prepHwparams(void)
     card_bits = card_formats[formidx].card_bits;
     card_endian = card_formats[formidx].card_endian;
     card_signed = card_formats[formidx].card_signed;
+    card_float = card_formats[formidx].card_float;
+
+    // 24 bit is packed in 3 bytes, and the others would need swapping
+    audio.direct = (axs == SND_PCM_ACCESS_MMAP_INTERLEAVED
+                    && card_bits != 24 && card_endian == little_endian);
 
     synth->getRuntime().Log("March little endian = " + asString(little_endian), 2);
 
-    if (card_signed) // not currently used, may be later
+    if (card_float)
+        formattxt = "Float";
+    else if (card_signed) // not currently used, may be later
         formattxt = "Signed";
     else
         formattxt = "Unsigned";
@@ -345,6 +424,13 @@ bool AlsaEngine::prepSwparams(void)
                                                     boundary),
                "alsa audio failed to set stop threshold"))
         goto bail_out;
+    // midi is placed in time against these, so they must use the same clock
+    audio.timed = snd_pcm_sw_params_set_tstamp_mode(audio.handle, swparams,
+                                                   SND_PCM_TSTAMP_ENABLE) == 0
+               && snd_pcm_sw_params_set_tstamp_type(audio.handle, swparams,
+                                                   SND_PCM_TSTAMP_TYPE_MONOTONIC) == 0;
+    if (!audio.timed)
+        synth->getRuntime().Log("Alsa audio has no monotonic timestamps, midi won't be sample accurate", 2);
     if (alsaBad(snd_pcm_sw_params(audio.handle, swparams),
                 "alsa audio failed to set software parameters"))
         goto bail_out;
@@ -357,6 +443,11 @@ bail_out:
 
 void AlsaEngine::Interleave(int buffersize)
 {
+    if (card_bits != 24 && card_endian == little_endian)
+    {
+        Convert((char*) interleaved, 0, buffersize);
+        return;
+    }
     int idx = 0;
     bool byte_swap = (little_endian != card_endian);
     unsigned short int tmp16a, tmp16b;
@@ -404,6 +495,151 @@ void AlsaEngine::Interleave(int buffersize)
 }
 
 
+/*
+ * Main outs to native endian float, S32 or S16 frames. The integer
+ * formats are clipped, and can be given triangular dither of one LSB
+ * (taken as 24 bit for S32, as that is what most converters use).
+ */
+void AlsaEngine::Convert(char *dest, int from, int frames)
+{
+    float *left = zynLeft[NUM_MIDI_PARTS] + from;
+    float *right = zynRight[NUM_MIDI_PARTS] + from;
+    int chans = card_chans;
+    int frame = 0;
+
+    if (card_float)
+    {
+        float *out = (float*) dest;
+#if defined(__SSE2__)
+        if (chans == 2)
+        {
+            for (; frame + 4 <= frames; frame += 4)
+            {
+                __m128 l = _mm_loadu_ps(left + frame);
+                __m128 r = _mm_loadu_ps(right + frame);
+                _mm_storeu_ps(out + frame * 2, _mm_unpacklo_ps(l, r));
+                _mm_storeu_ps(out + frame * 2 + 4, _mm_unpackhi_ps(l, r));
+            }
+        }
+#endif
+        for (; frame < frames; ++frame)
+        {
+            float *point = out + frame * chans;
+            point[0] = left[frame];
+            point[1] = right[frame];
+            for (int ch = 2; ch < chans; ++ch)
+                point[ch] = 0;
+        }
+        return;
+    }
+
+    float scale = 0x78000000;
+    float lsb = 256;
+    float limit = 2147483520.0f; // largest float below 2^31
+    if (card_bits == 16)
+    {
+        scale = 0x7800;
+        lsb = 1;
+        limit = 32767.0f;
+    }
+    int *out32 = (int*) dest;
+    short int *out16 = (short int*) dest;
+
+#if defined(__SSE2__)
+    if (chans == 2)
+    {
+        __m128 scaleV = _mm_set1_ps(scale);
+        __m128 ditherV = _mm_set1_ps(lsb / 4294967296.0f);
+        __m128 maxV = _mm_set1_ps(limit);
+        __m128 minV = _mm_set1_ps(-limit);
+        __m128i noise = _mm_loadu_si128((__m128i*) audio.noise);
+        for (; frame + 4 <= frames; frame += 4)
+        {
+            __m128 l = _mm_mul_ps(_mm_loadu_ps(left + frame), scaleV);
+            __m128 r = _mm_mul_ps(_mm_loadu_ps(right + frame), scaleV);
+            if (audio.dither)
+            {
+                __m128 tri[2];
+                for (int side = 0; side < 2; ++side)
+                {
+                    __m128i a, b;
+                    noise = _mm_xor_si128(noise, _mm_slli_epi32(noise, 13));
+                    noise = _mm_xor_si128(noise, _mm_srli_epi32(noise, 17));
+                    a = noise = _mm_xor_si128(noise, _mm_slli_epi32(noise, 5));
+                    noise = _mm_xor_si128(noise, _mm_slli_epi32(noise, 13));
+                    noise = _mm_xor_si128(noise, _mm_srli_epi32(noise, 17));
+                    b = noise = _mm_xor_si128(noise, _mm_slli_epi32(noise, 5));
+                    tri[side] = _mm_mul_ps(_mm_add_ps(_mm_cvtepi32_ps(a), _mm_cvtepi32_ps(b)), ditherV);
+                }
+                l = _mm_add_ps(l, tri[0]);
+                r = _mm_add_ps(r, tri[1]);
+            }
+            l = _mm_min_ps(_mm_max_ps(l, minV), maxV);
+            r = _mm_min_ps(_mm_max_ps(r, minV), maxV);
+            __m128i il = _mm_cvtps_epi32(l);
+            __m128i ir = _mm_cvtps_epi32(r);
+            __m128i lo = _mm_unpacklo_epi32(il, ir);
+            __m128i hi = _mm_unpackhi_epi32(il, ir);
+            if (card_bits == 16)
+                _mm_storeu_si128((__m128i*) (out16 + frame * 2), _mm_packs_epi32(lo, hi));
+            else
+            {
+                _mm_storeu_si128((__m128i*) (out32 + frame * 2), lo);
+                _mm_storeu_si128((__m128i*) (out32 + frame * 2 + 4), hi);
+            }
+        }
+        _mm_storeu_si128((__m128i*) audio.noise, noise);
+    }
+#endif
+    for (; frame < frames; ++frame)
+    {
+        int l = ditherSample(left[frame], scale, lsb, limit);
+        int r = ditherSample(right[frame], scale, lsb, limit);
+        if (card_bits == 16)
+        {
+            short int *point = out16 + frame * chans;
+            point[0] = l;
+            point[1] = r;
+            for (int ch = 2; ch < chans; ++ch)
+                point[ch] = 0;
+        }
+        else
+        {
+            int *point = out32 + frame * chans;
+            point[0] = l;
+            point[1] = r;
+            for (int ch = 2; ch < chans; ++ch)
+                point[ch] = 0;
+        }
+    }
+}
+
+
+inline int AlsaEngine::ditherSample(float sample, float scale, float lsb, float limit)
+{
+    float value = sample * scale;
+    if (audio.dither)
+    {
+        int tri = 0;
+        for (int i = 0; i < 2; ++i)
+        {
+            unsigned int x = audio.noise[0];
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            audio.noise[0] = x;
+            tri += (int) x >> 1; // halved so the pair can't overflow
+        }
+        value += tri * (lsb / 2147483648.0f);
+    }
+    if (value > limit)
+        value = limit;
+    else if (value < -limit)
+        value = -limit;
+    return lrintf(value);
+}
+
+
 void *AlsaEngine::_AudioThread(void *arg)
 {
     return static_cast<AlsaEngine*>(arg)->AudioThread();
@@ -444,10 +680,15 @@ void *AlsaEngine::AudioThread(void)
         }
         if (audio.pcm_state == SND_PCM_STATE_RUNNING)
         {
-            getAudio();
+            renderTimed();
             int alsa_buff = getBuffersize();
-            Interleave(alsa_buff);
-            Write(alsa_buff);
+            if (audio.direct)
+                WriteMmap(alsa_buff);
+            else
+            {
+                Interleave(alsa_buff);
+                Write(alsa_buff);
+            }
         }
         else
             synth->getRuntime().Log("Audio pcm still not running");
@@ -456,6 +697,86 @@ void *AlsaEngine::AudioThread(void)
 }
 
 
+/*
+ * Midi events are played a fixed time after they arrived rather than
+ * at the start of whichever period happens to come next. That time is
+ * the whole pcm buffer plus one period, so an event that came in while
+ * the last period was being written lands somewhere inside this one,
+ * and the engine is run in pieces up to each event in turn.
+ */
+void AlsaEngine::renderTimed(void)
+{
+    int period = getBuffersize();
+    if (!audio.timed || !audio.midiEvents
+        || jack_ringbuffer_read_space(audio.midiEvents) < sizeof(timedEvent))
+    {
+        getAudio();
+        return;
+    }
+
+    snd_pcm_uframes_t avail = 0;
+    snd_htimestamp_t stamp;
+    long long now = 0;
+    if (snd_pcm_htimestamp(audio.handle, &avail, &stamp) == 0)
+        now = nsecs(stamp);
+    long long latest = period + audio.buffer_size;
+    int done = 0;
+    timedEvent timed;
+    while (jack_ringbuffer_read_space(audio.midiEvents) >= sizeof(timedEvent))
+    {
+        jack_ringbuffer_peek(audio.midiEvents, (char*)&timed, sizeof(timedEvent));
+        long long frame = period + avail
+                        + (timed.when - now) * audio.samplerate / 1000000000ll;
+        if (frame < 0 || frame > latest || now == 0)
+            frame = 0; // late, or the clocks have lost each other
+        if (frame >= period)
+            break; // belongs to a later period
+        if (frame > done)
+        {
+            renderFrom(done, frame - done);
+            done = frame;
+        }
+        handleMidi(&timed.event);
+        jack_ringbuffer_read_advance(audio.midiEvents, sizeof(timedEvent));
+    }
+    if (done < period)
+        renderFrom(done, period - done);
+}
+
+
+void AlsaEngine::renderFrom(int from, int frames)
+{
+    if (from == 0)
+    {
+        synth->MasterAudio(zynLeft, zynRight, frames);
+        return;
+    }
+    float *partLeft[NUM_MIDI_PARTS + 1];
+    float *partRight[NUM_MIDI_PARTS + 1];
+    for (int npart = 0; npart < NUM_MIDI_PARTS + 1; ++npart)
+    {
+        partLeft[npart] = zynLeft[npart] + from;
+        partRight[npart] = zynRight[npart] + from;
+    }
+    synth->MasterAudio(partLeft, partRight, frames);
+}
+
+
+// called from the midi thread of the engine linked to this one
+bool AlsaEngine::queueMidi(long long when, snd_seq_event_t *event)
+{
+    if (!audio.timed || !audio.midiEvents || !audio.pThread)
+        return false;
+    if (jack_ringbuffer_write_space(audio.midiEvents) < sizeof(timedEvent))
+        return false; // play it now rather than lose it
+    timedEvent timed;
+    timed.when = when;
+    timed.event = *event;
+    jack_ringbuffer_write(audio.midiEvents, (char*)&timed, sizeof(timedEvent));
+    return true;
+}
+
+
 void AlsaEngine::Write(snd_pcm_uframes_t towrite)
 {
     snd_pcm_sframes_t wrote = 0;
@@ -500,6 +821,52 @@ void AlsaEngine::Write(snd_pcm_uframes_t towrite)
 }
 
 
+// Converts straight into the ring buffer the card reads from
+void AlsaEngine::WriteMmap(snd_pcm_uframes_t towrite)
+{
+    int from = 0;
+    unsigned int framebits = card_chans * card_bits;
+    while (towrite > 0 && synth->getRuntime().runSynth)
+    {
+        snd_pcm_sframes_t avail = snd_pcm_avail_update(audio.handle);
+        if (avail == 0)
+        {
+            snd_pcm_wait(audio.handle, 666);
+            continue;
+        }
+        const snd_pcm_channel_area_t *areas;
+        snd_pcm_uframes_t offset;
+        snd_pcm_uframes_t frames = towrite;
+        int err = (avail < 0) ? avail : snd_pcm_mmap_begin(audio.handle, &areas, &offset, &frames);
+        if (err < 0)
+        {
+            if (err == -EPIPE)
+                xrunRecover();
+            else if (!Recover(err))
+                alsaBad(err, "alsa audio mmap transfer failed");
+            return; // drop the rest of this period
+        }
+        if (areas[0].step != framebits)
+        {
+            snd_pcm_mmap_commit(audio.handle, offset, 0);
+            synth->getRuntime().Log("Alsa mmap area not interleaved as expected, using writes");
+            audio.direct = false;
+            return;
+        }
+        char *dest = (char*) areas[0].addr + (areas[0].first + offset * areas[0].step) / 8;
+        Convert(dest, from, frames);
+        snd_pcm_sframes_t done = snd_pcm_mmap_commit(audio.handle, offset, frames);
+        if (done < 0 || (snd_pcm_uframes_t) done != frames)
+        {
+            xrunRecover();
+            return;
+        }
+        towrite -= frames;
+        from += frames;
+    }
+}
+
+
 bool AlsaEngine::Recover(int err)
 {
     if (err > 0)
@@ -578,11 +945,6 @@ void *AlsaEngine::_MidiThread(void *arg)
 void *AlsaEngine::MidiThread(void)
 {
     snd_seq_event_t *event;
-    unsigned char channel;
-    unsigned char note;
-    unsigned char velocity;
-    unsigned int ctrltype;
-    unsigned int par;
     int chk;
     while (synth->getRuntime().runSynth)
     {
@@ -591,97 +953,138 @@ void *AlsaEngine::MidiThread(void)
             if (!event)
                 continue;
 
-            switch (event->type)
+            bool queued = false;
+            if (midi.audioSide && midi.queue >= 0
+                && event->type != SND_SEQ_EVENT_PORT_SUBSCRIBED
+                && event->type != SND_SEQ_EVENT_PORT_UNSUBSCRIBED
+                && (event->flags & SND_SEQ_TIME_STAMP_MASK) == SND_SEQ_TIME_STAMP_REAL)
             {
-                case SND_SEQ_EVENT_NOTEON:
-                    if (event->data.note.note)
-                    {
-                        channel = event->data.note.channel;
-                        note = event->data.note.note;
-                        velocity = event->data.note.velocity;
-                        setMidiNote(channel, note, velocity);
-                    }
-                    break;
+                long long when = midi.queueBase
+                               + event->time.time.tv_sec * 1000000000ll
+                               + event->time.time.tv_nsec;
+                queued = midi.audioSide->queueMidi(when, event);
+            }
+            if (!queued)
+                handleMidi(event);
+            snd_seq_free_event(event);
+        }
+;
+        if(chk < 0)
+        {
+            usleep(1024);
+        }
+    }
+    return NULL;
+}
 
-                case SND_SEQ_EVENT_NOTEOFF:
-                    channel = event->data.note.channel;
-                    note = event->data.note.note;
-                    setMidiNote(channel, note);
-                    break;
 
-                case SND_SEQ_EVENT_KEYPRESS:
-                    channel = event->data.note.channel;
-                    ctrltype = C_keypressure;
-                    par = event->data.note.velocity;
-                    setMidiController(channel, ctrltype, par);
-                    break;
+void AlsaEngine::handleMidi(snd_seq_event_t *event)
+{
+    unsigned char channel;
+    unsigned char note;
+    unsigned char velocity;
+    unsigned int ctrltype;
+    unsigned int par;
 
-                case SND_SEQ_EVENT_CHANPRESS:
-                    channel = event->data.control.channel;
-                    ctrltype = C_channelpressure;
-                    par = event->data.control.value;
-                    setMidiController(channel, ctrltype, par);
-                    break;
+    switch (event->type)
+    {
+        case SND_SEQ_EVENT_NOTEON:
+            if (event->data.note.note)
+            {
+                channel = event->data.note.channel;
+                note = event->data.note.note;
+                velocity = event->data.note.velocity;
+                setMidiNote(channel, note, velocity);
+            }
+            break;
 
-                case SND_SEQ_EVENT_PGMCHANGE:
-                    channel = event->data.control.channel;
-                    ctrltype = C_programchange;
-                    par = event->data.control.value;
-                    setMidiProgram(channel, par);
-                    break;
+        case SND_SEQ_EVENT_NOTEOFF:
+            channel = event->data.note.channel;
+            note = event->data.note.note;
+            setMidiNote(channel, note);
+            break;
 
-                case SND_SEQ_EVENT_PITCHBEND:
-                    channel = event->data.control.channel;
-                    ctrltype = C_pitchwheel;
-                    par = event->data.control.value;
-                    setMidiController(channel, ctrltype, par);
-                    break;
+        case SND_SEQ_EVENT_KEYPRESS:
+            channel = event->data.note.channel;
+            ctrltype = C_keypressure;
+            par = event->data.note.velocity;
+            setMidiController(channel, ctrltype, par);
+            break;
 
-                case SND_SEQ_EVENT_CONTROLLER:
-                    channel = event->data.control.channel;
-                    ctrltype = event->data.control.param;//getMidiController(event->data.control.param);
-                    par = event->data.control.value;
-                    setMidiController(channel, ctrltype, par);
-                    break;
+        case SND_SEQ_EVENT_CHANPRESS:
+            channel = event->data.control.channel;
+            ctrltype = C_channelpressure;
+            par = event->data.control.value;
+            setMidiController(channel, ctrltype, par);
+            break;
 
-                case SND_SEQ_EVENT_NONREGPARAM:
-                    channel = event->data.control.channel;
-                    ctrltype = event->data.control.param;
-                    par = event->data.control.value;
-                    setMidiController(channel, 99, ctrltype >> 7);
-                    setMidiController(channel, 98, ctrltype & 0x7f);
-                    setMidiController(channel, 6, par >> 7);
-                    setMidiController(channel, 38, par & 0x7f);
-                    break;
+        case SND_SEQ_EVENT_PGMCHANGE:
+            channel = event->data.control.channel;
+            ctrltype = C_programchange;
+            par = event->data.control.value;
+            setMidiProgram(channel, par);
+            break;
 
-                case SND_SEQ_EVENT_RESET: // reset to power-on state
-                    channel = event->data.control.channel;
-                    ctrltype = C_resetallcontrollers;
-                    setMidiController(channel, ctrltype, 0);
-                    break;
+        case SND_SEQ_EVENT_PITCHBEND:
+            channel = event->data.control.channel;
+            ctrltype = C_pitchwheel;
+            par = event->data.control.value;
+            setMidiController(channel, ctrltype, par);
+            break;
 
-                case SND_SEQ_EVENT_PORT_SUBSCRIBED: // ports connected
-                    synth->getRuntime().Log("Alsa midi port connected");
-                    break;
+        case SND_SEQ_EVENT_CONTROLLER:
+            channel = event->data.control.channel;
+            ctrltype = event->data.control.param;//getMidiController(event->data.control.param);
+            par = event->data.control.value;
+            setMidiController(channel, ctrltype, par);
+            break;
 
-                case SND_SEQ_EVENT_PORT_UNSUBSCRIBED: // ports disconnected
-                    synth->getRuntime().Log("Alsa midi port disconnected");
-                    break;
+        case SND_SEQ_EVENT_NONREGPARAM:
+            channel = event->data.control.channel;
+            ctrltype = event->data.control.param;
+            par = event->data.control.value;
+            setMidiController(channel, 99, ctrltype >> 7);
+            setMidiController(channel, 98, ctrltype & 0x7f);
+            setMidiController(channel, 6, par >> 7);
+            setMidiController(channel, 38, par & 0x7f);
+            break;
 
-                default:// commented out some progs spam us :(
-                    /* synth->getRuntime().Log("Other non-handled midi event, type: "
-                                + asString((int)event->type));*/
-                    break;
-            }
-            snd_seq_free_event(event);
-        }
-;
-        if(chk < 0)
-        {
-            usleep(1024);
-        }
+        case SND_SEQ_EVENT_RESET: // reset to power-on state
+            channel = event->data.control.channel;
+            ctrltype = C_resetallcontrollers;
+            setMidiController(channel, ctrltype, 0);
+            break;
+
+        case SND_SEQ_EVENT_PORT_SUBSCRIBED: // ports connected
+            synth->getRuntime().Log("Alsa midi port connected");
+            break;
+
+        case SND_SEQ_EVENT_PORT_UNSUBSCRIBED: // ports disconnected
+            synth->getRuntime().Log("Alsa midi port disconnected");
+            break;
+
+        default:// commented out some progs spam us :(
+            /* synth->getRuntime().Log("Other non-handled midi event, type: "
+                        + asString((int)event->type));*/
+            break;
     }
-    return NULL;
+}
+
+
+// The queue counts real time from when it was started. Reading its
+// position against the monotonic clock gives the offset between them.
+void AlsaEngine::syncQueueClock(void)
+{
+    snd_seq_queue_status_t *status;
+    snd_seq_queue_status_alloca(&status);
+    struct timespec before, after;
+    clock_gettime(CLOCK_MONOTONIC, &before);
+    if (snd_seq_get_queue_status(midi.handle, midi.queue, status) < 0)
+        return;
+    clock_gettime(CLOCK_MONOTONIC, &after);
+    const snd_seq_real_time_t *qtime = snd_seq_queue_status_get_real_time(status);
+    long long queueNow = qtime->tv_sec * 1000000000ll + qtime->tv_nsec;
+    midi.queueBase = (nsecs(before) + nsecs(after)) / 2 - queueNow;
 }
 
 
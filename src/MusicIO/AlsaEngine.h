@@ -23,6 +23,7 @@
 #include <pthread.h>
 #include <string>
 #include <alsa/asoundlib.h>
+#include <jack/ringbuffer.h>
 
 using namespace std;
 
@@ -36,7 +37,7 @@ class AlsaEngine : public MusicIO
 {
     public:
         AlsaEngine(SynthEngine *_synth);
-        ~AlsaEngine() { }
+        ~AlsaEngine();
 
         bool openAudio(void);
         bool openMidi(void);
@@ -52,10 +53,16 @@ class AlsaEngine : public MusicIO
         int midiClientId(void) { return midi.alsaId; }
         virtual void registerAudioPort(int )  {}
 
+        // midi and audio are separate engines, so the midi one
+        // needs to be told where its events are to be played
+        void linkAudio(AlsaEngine *audioEngine) { midi.audioSide = audioEngine; }
+        bool queueMidi(long long when, snd_seq_event_t *event);
+
         bool little_endian;
         bool card_endian;
         int card_bits;
         bool card_signed;
+        bool card_float;
         unsigned int card_chans;
 
     private:
@@ -63,6 +70,9 @@ class AlsaEngine : public MusicIO
         bool prepSwparams(void);
         void Interleave(int buffersize);
         void Write(snd_pcm_uframes_t towrite);
+        void WriteMmap(snd_pcm_uframes_t towrite);
+        void Convert(char *dest, int from, int frames);
+        inline int ditherSample(float sample, float scale, float lsb, float limit);
         bool Recover(int err);
         bool xrunRecover(void);
         bool alsaBad(int op_result, string err_msg);
@@ -73,6 +83,10 @@ class AlsaEngine : public MusicIO
         static void *_AudioThread(void *arg);
         void *MidiThread(void);
         static void *_MidiThread(void *arg);
+        void handleMidi(snd_seq_event_t *event);
+        void syncQueueClock(void);
+        void renderTimed(void);
+        void renderFrom(int from, int frames);
 
         snd_pcm_sframes_t (*pcmWrite)(snd_pcm_t *handle, const void *data,
                                       snd_pcm_uframes_t nframes);
@@ -87,6 +101,11 @@ class AlsaEngine : public MusicIO
             int                alsaId;
             snd_pcm_state_t    pcm_state;
             pthread_t          pThread;
+            bool               direct; // convert straight into the mmap area
+            int                dither;
+            unsigned int       noise[4]; // dither generator state
+            bool               timed; // pcm timestamps are monotonic
+            jack_ringbuffer_t *midiEvents; // waiting for their frame
         } audio;
 
         struct {
@@ -95,6 +114,9 @@ class AlsaEngine : public MusicIO
             snd_seq_addr_t      addr;
             int                 alsaId;
             pthread_t           pThread;
+            int                 queue; // only used to timestamp input
+            long long           queueBase; // monotonic ns at queue time zero
+            AlsaEngine          *audioSide;
         } midi;
 };
 
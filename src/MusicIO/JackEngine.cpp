@@ -43,6 +43,10 @@ JackEngine::JackEngine(SynthEngine *_synth) : MusicIO(_synth), jackClient(NULL)
         audio.ports[i] = NULL;
         audio.portBuffs[i] = NULL;
     }
+    for (int i = 0; i < 2 * NUM_MIDI_PARTS; ++i)
+        audio.connected[i] = false;
+    audio.connectChanges = 1;
+    audio.connectSeen = 0;
     midi.port = NULL;
 }
 
@@ -136,6 +140,7 @@ bool JackEngine::Start(void)
 {
     bool jackPortsRegistered = true;
     internalbuff = synth->getRuntime().Buffersize;
+    audio.fifoPos = internalbuff; // nothing left over yet
     //Andrew Deryabin: use default error callback function provided by jack
     //jack_set_error_function(_errorCallback);
     jack_set_xrun_callback(jackClient, _xrunCallback, this);
@@ -151,6 +156,9 @@ bool JackEngine::Start(void)
         goto bail_out;
     }
 
+    if (jack_set_port_connect_callback(jackClient, _portConnectCallback, this))
+        synth->getRuntime().Log("JackEngine failed to set port connect callback");
+
     if (!latencyPrep())
     {
         synth->getRuntime().Log("Jack latency prep failed ");
@@ -246,6 +254,7 @@ void JackEngine::registerAudioPort(int partnum)
 
             if(audio.ports [portnum])
             {
+                __sync_add_and_fetch(&audio.connectChanges, 1);
                 synth->getRuntime().Log("Registered jack port " + asString(partnum));
             }
             else
@@ -399,40 +408,99 @@ bool JackEngine::processAudio(jack_nframes_t nframes)
         return false;
     }
 
-    int framesize = sizeof(float) * nframes;
-    if (nframes < internalbuff)
+    checkConnections();
+    if (nframes == internalbuff && audio.fifoPos >= internalbuff)
     {
-        synth->MasterAudio(zynLeft, zynRight, nframes);
-        sendAudio(framesize, 0);
+        renderDirect();
+        return true;
     }
-    else
+
+    // otherwise the engine runs in its own block size and whatever
+    // is left of a block goes out at the start of the next period
+    unsigned int done = 0;
+    while (done < nframes)
     {
-        for (unsigned int pos = 0; pos < nframes; pos += internalbuff)
+        if (audio.fifoPos >= internalbuff)
         {
-        synth->MasterAudio(zynLeft, zynRight, 0);
-        sendAudio(framesize, pos);
+            synth->MasterAudio(zynLeft, zynRight, 0);
+            audio.fifoPos = 0;
         }
+        unsigned int count = internalbuff - audio.fifoPos;
+        if (count > nframes - done)
+            count = nframes - done;
+        sendAudio(audio.fifoPos, count, done);
+        audio.fifoPos += count;
+        done += count;
     }
     return true;
 }
 
 
-void JackEngine::sendAudio(int framesize, unsigned int offset)
+// The jack period is the same as ours, so parts with a connected port
+// are rendered straight into its buffer, as are the main outs.
+void JackEngine::renderDirect(void)
 {
+    bool direct[NUM_MIDI_PARTS];
+    int currentmax = synth->getRuntime().NumAvailableParts;
+    for (int port = 0, idx = 0; idx < 2 * NUM_MIDI_PARTS; port++ , idx += 2)
+    {
+        direct[port] = audio.ports[idx] && audio.connected[idx] && directWanted(port, currentmax);
+        audio.directLeft[port] = direct[port] ? audio.portBuffs[idx] : zynLeft[port];
+        audio.directRight[port] = direct[port] ? audio.portBuffs[idx + 1] : zynRight[port];
+    }
+    audio.directLeft[NUM_MIDI_PARTS] = audio.portBuffs[2 * NUM_MIDI_PARTS];
+    audio.directRight[NUM_MIDI_PARTS] = audio.portBuffs[2 * NUM_MIDI_PARTS + 1];
+
+    synth->MasterAudio(audio.directLeft, audio.directRight, 0);
+
+    // commands run at the start of MasterAudio can change the routing
+    int framesize = sizeof(float) * internalbuff;
+    currentmax = synth->getRuntime().NumAvailableParts;
+    for (int port = 0, idx = 0; idx < 2 * NUM_MIDI_PARTS; port++ , idx += 2)
+    {
+        if (!audio.ports[idx] || !audio.connected[idx])
+            continue;
+        bool wanted = directWanted(port, currentmax);
+        if (wanted && direct[port])
+            continue; // already there
+        if (wanted)
+        {
+            memcpy(audio.portBuffs[idx], zynLeft[port], framesize);
+            memcpy(audio.portBuffs[idx + 1], zynRight[port], framesize);
+        }
+        else
+        {
+            memset(audio.portBuffs[idx], 0, framesize);
+            memset(audio.portBuffs[idx + 1], 0, framesize);
+        }
+    }
+}
+
+
+// Only then is the buffer certain to be written, even when muted
+bool JackEngine::directWanted(int partnum, int currentmax)
+{
+    return partnum < currentmax && (synth->part[partnum]->Paudiodest & 2) && synth->partonoffRead(partnum);
+}
+
+
+void JackEngine::sendAudio(unsigned int from, unsigned int count, unsigned int offset)
+{
+    int framesize = sizeof(float) * count;
     // Part outputs
     int currentmax = synth->getRuntime().NumAvailableParts;
     for (int port = 0, idx = 0; idx < 2 * NUM_MIDI_PARTS; port++ , idx += 2)
     {
         if(audio.ports [idx])
         {
-            if (jack_port_connected(audio.ports[idx])) // just a few % improvement.
+            if (audio.connected[idx]) // just a few % improvement.
             {
                 float *lpoint = audio.portBuffs[idx] + offset;
                 float *rpoint = audio.portBuffs[idx + 1] + offset;
                 if ((synth->part[port]->Paudiodest & 2) && port < currentmax)
                 {
-                    memcpy(lpoint, zynLeft[port], framesize);
-                    memcpy(rpoint, zynRight[port], framesize);
+                    memcpy(lpoint, zynLeft[port] + from, framesize);
+                    memcpy(rpoint, zynRight[port] + from, framesize);
                 }
                 else
                 {
@@ -445,8 +513,8 @@ void JackEngine::sendAudio(int framesize, unsigned int offset)
     // And mixed outputs
     float *Lpoint = audio.portBuffs[2 * NUM_MIDI_PARTS] + offset;
     float *Rpoint = audio.portBuffs[2 * NUM_MIDI_PARTS + 1] + offset;
-    memcpy(Lpoint, zynLeft[NUM_MIDI_PARTS], framesize);
-    memcpy(Rpoint, zynRight[NUM_MIDI_PARTS], framesize);
+    memcpy(Lpoint, zynLeft[NUM_MIDI_PARTS] + from, framesize);
+    memcpy(Rpoint, zynRight[NUM_MIDI_PARTS] + from, framesize);
 }
 
 
@@ -573,12 +641,52 @@ int JackEngine::_xrunCallback(void *arg)
 }
 
 
+// Called by jack outside the process thread, so just note it and let
+// the next period pick up the new state.
+void JackEngine::_portConnectCallback(jack_port_id_t a, jack_port_id_t b, int connect, void *arg)
+{
+    __sync_add_and_fetch(&static_cast<JackEngine*>(arg)->audio.connectChanges, 1);
+}
+
+
+void JackEngine::checkConnections(void)
+{
+    int changes = __sync_add_and_fetch(&audio.connectChanges, 0);
+    if (changes == audio.connectSeen)
+        return;
+    audio.connectSeen = changes;
+    for (int idx = 0; idx < 2 * NUM_MIDI_PARTS; ++idx)
+        audio.connected[idx] = audio.ports[idx] && jack_port_connected(audio.ports[idx]) > 0;
+}
+
+
 void JackEngine::_errorCallback(const char *msg)
 {
     //synth->getRuntime().Log("Jack reports error: " + string(msg));
 }
 
 
+/*
+ * When the periods don't line up, a block can be rendered up to this
+ * many frames before it is all sent, so late events wait that long.
+ */
+unsigned int JackEngine::fifoLatency(void)
+{
+    unsigned int block = synth->getRuntime().Buffersize;
+    unsigned int a = block;
+    unsigned int b = audio.jackNframes;
+    if (!a || !b)
+        return 0;
+    while (b)
+    {
+        unsigned int t = a % b;
+        a = b;
+        b = t;
+    }
+    return block - a; // none if the period is whole blocks
+}
+
+
 bool JackEngine::latencyPrep(void)
 {
 #if defined(JACK_LATENCY)  // >= 0.120.1 API
@@ -594,8 +702,8 @@ bool JackEngine::latencyPrep(void)
 
     if (jack_port_set_latency && audio.ports[0] && audio.ports[1])
     {
-        jack_port_set_latency(audio.ports[0], jack_get_buffer_size(jackClient));
-        jack_port_set_latency(audio.ports[1], jack_get_buffer_size(jackClient));
+        jack_port_set_latency(audio.ports[0], jack_get_buffer_size(jackClient) + fifoLatency());
+        jack_port_set_latency(audio.ports[1], jack_get_buffer_size(jackClient) + fifoLatency());
         if (jack_recompute_total_latencies)
             jack_recompute_total_latencies(jackClient);
     }
@@ -648,7 +756,7 @@ void JackEngine::latencyCallback(jack_latency_callback_mode_t mode)
             {
                 jack_port_get_latency_range(audio.ports[i], mode, &range[i]);
                 range[i].min++;
-                range[i].max += audio.jackNframes;
+                range[i].max += audio.jackNframes + fifoLatency();
                 jack_port_set_latency_range(audio.ports[i], JackPlaybackLatency, &range[i]);
             }
         }
@@ -63,13 +63,18 @@ class JackEngine : public MusicIO
         bool openJackClient(string server);
         bool connectJackPorts(void);
         bool processAudio(jack_nframes_t nframes);
-        void sendAudio(int framesize, unsigned int offset);
+        void renderDirect(void);
+        bool directWanted(int partnum, int currentmax);
+        void sendAudio(unsigned int from, unsigned int count, unsigned int offset);
+        unsigned int fifoLatency(void);
+        void checkConnections(void);
         bool processMidi(jack_nframes_t nframes);
         bool latencyPrep(void);
         int processCallback(jack_nframes_t nframes);
         static int _processCallback(jack_nframes_t nframes, void *arg);
         static void _errorCallback(const char *msg);
         static int _xrunCallback(void *arg);
+        static void _portConnectCallback(jack_port_id_t a, jack_port_id_t b, int connect, void *arg);
 
 
 #if defined(JACK_SESSION)
@@ -89,6 +94,12 @@ class JackEngine : public MusicIO
             unsigned int  jackNframes;
             jack_port_t  *ports[2*NUM_MIDI_PARTS+2];
             float        *portBuffs[2*NUM_MIDI_PARTS+2];
+            bool          connected[2*NUM_MIDI_PARTS];
+            int           connectChanges; // bumped by jack, read in process
+            int           connectSeen;
+            float        *directLeft[NUM_MIDI_PARTS+1]; // where MasterAudio
+            float        *directRight[NUM_MIDI_PARTS+1]; // writes in place
+            unsigned int  fifoPos; // first unsent frame of the last block
         } audio;
 
         struct {
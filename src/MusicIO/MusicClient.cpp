@@ -131,6 +131,12 @@ MusicClient::MusicClient(SynthEngine *_synth, audio_drivers _audioDrv, midi_driv
             break;
     }
 
+    if(audioDrv == alsa_audio && midiDrv == alsa_midi)
+    {
+        // lets midi events be placed exactly within each period
+        static_cast<AlsaEngine*>(midiIO)->linkAudio(static_cast<AlsaEngine*>(audioIO));
+    }
+
     if(audioDrv != no_audio)
     {
         if(!audioIO)
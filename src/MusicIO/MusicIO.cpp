@@ -662,6 +662,9 @@ void MusicIO::setMidiNote(unsigned char channel, unsigned char note)
 bool MusicIO::prepBuffers(void)
 {
     int buffersize = getBuffersize();
+    // MasterAudio can fill a whole block even when the period is shorter
+    if (buffersize > 0 && buffersize < (int)synth->getRuntime().Buffersize)
+        buffersize = synth->getRuntime().Buffersize;
     if (buffersize > 0)
     {
         for (int part = 0; part < (NUM_MIDI_PARTS + 1); part++)
@@ -28,6 +28,7 @@ using namespace std;
 
 #include "Misc/XMLwrapper.h"
 #include "DSP/FFTwrapper.h"
+#include "Misc/SharedResources.h"
 #include "Synth/OscilGen.h"
 #include "Synth/Resonance.h"
 #include "Params/EnvelopeParams.h"
@@ -601,7 +602,7 @@ void PADnoteParameters::applyparameters(bool islocked)
         samplemax = 1;
 
     // prepare a BIG FFT stuff
-    FFTwrapper *fft = new FFTwrapper(samplesize);
+    FFTwrapper *fft = SharedResources::getFFT(samplesize);
     FFTFREQS fftfreqs;
     FFTwrapper::newFFTFREQS(&fftfreqs, samplesize / 2);
 
@@ -662,7 +663,7 @@ void PADnoteParameters::applyparameters(bool islocked)
             synth->actionLock(unlock);
         newsample.smp = NULL;
     }
-    delete fft;
+    SharedResources::releaseFFT(fft);
     FFTwrapper::deleteFFTFREQS(&fftfreqs);
 
     // delete the additional samples that might exists and are not useful
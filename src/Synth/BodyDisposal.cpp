@@ -19,15 +19,29 @@
 
 #include "Synth/BodyDisposal.h"
 
+// Safe from any number of threads at once, and never allocates
 void BodyDisposal::addBody(Carcass *body)
 {
     if (body != NULL)
-        corpses.push_back(body);
+    {
+        Carcass *head;
+        do
+        {
+            head = corpses;
+            body->nextCorpse = head;
+        } while (!__sync_bool_compare_and_swap(&corpses, head, body));
+        arrivals.post();
+    }
 }
 
 
 void BodyDisposal::disposeBodies(void)
 {
-    for (int x = corpses.size(); x > 0; --x)
-        corpses.pop_front();
+    Carcass *body = __sync_lock_test_and_set(&corpses, (Carcass*)NULL);
+    while (body)
+    {
+        Carcass *next = body->nextCorpse;
+        delete body;
+        body = next;
+    }
 }
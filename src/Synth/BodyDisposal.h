@@ -20,22 +20,22 @@
 #ifndef BODYDISPOSAL_H
 #define BODYDISPOSAL_H
 
-#include <boost/ptr_container/ptr_list.hpp>
-
-using namespace std;
-
 #include "Synth/Carcass.h"
+#include "Misc/Notifier.h"
 
 class BodyDisposal
 {
     public:
-        BodyDisposal() { corpses.clear(); }
-        ~BodyDisposal() {}
+        BodyDisposal() : corpses(NULL) { }
+        ~BodyDisposal() { disposeBodies(); }
         void addBody(Carcass *body);
         void disposeBodies(void);
+        bool waitForBodies(int ms) { return arrivals.wait(ms); }
+        void wakeUp(void) { arrivals.post(); }
 
     private:
-        boost::ptr_list<Carcass> corpses;
+        Carcass *corpses; // pushed by any thread, taken all at once
+        Notifier arrivals;
 };
 
 #endif
@@ -20,12 +20,15 @@
 #ifndef CARCASS_H
 #define CARCASS_H
 
+#include <cstddef>
 #include <boost/noncopyable.hpp>
 
 class Carcass : public boost::noncopyable
 {
     public:
+        Carcass() : nextCorpse(NULL) {}
         virtual ~Carcass() {}
+        Carcass *nextCorpse; // only used by BodyDisposal
 };
 
 #endif
@@ -24,12 +24,15 @@
 */
 
 #include <cmath>
+#include <string.h>
+#include <algorithm>
 
 using namespace std;
 
 #include "Effects/Distorsion.h"
 #include "Misc/Config.h"
 #include "Misc/SynthEngine.h"
+#include "Misc/SharedResources.h"
 #include "Synth/OscilGen.h"
 
 //char OscilGen::random_state[256];
@@ -42,6 +45,7 @@ OscilGen::OscilGen(FFTwrapper *fft_, Resonance *res_, SynthEngine *_synth) :
     ADvsPAD(false),
     tmpsmps((float*)fftwf_malloc(_synth->oscilsize * sizeof(float))),
     fft(fft_),
+    baseTable(NULL),
     res(res_),
     randseed(1)
 {
@@ -52,13 +56,15 @@ OscilGen::OscilGen(FFTwrapper *fft_, Resonance *res_, SynthEngine *_synth) :
     else
         memset(tmpsmps, 0, synth->oscilsize * sizeof(float));
     FFTwrapper::newFFTFREQS(&oscilFFTfreqs, synth->halfoscilsize);
-    FFTwrapper::newFFTFREQS(&basefuncFFTfreqs, synth->halfoscilsize);
+    FFTwrapper::newFFTFREQS(&rtFFTfreqs, synth->halfoscilsize);
+    basefuncFFTfreqs.s = basefuncFFTfreqs.c = NULL;
     defaults();
 }
 
 OscilGen::~OscilGen()
 {
-    FFTwrapper::deleteFFTFREQS(&basefuncFFTfreqs);
+    dropbasefunction();
+    FFTwrapper::deleteFFTFREQS(&rtFFTfreqs);
     FFTwrapper::deleteFFTFREQS(&oscilFFTfreqs);
     if (tmpsmps)
     {
@@ -136,8 +142,7 @@ void OscilGen::defaults(void)
 
     memset(oscilFFTfreqs.s, 0, synth->halfoscilsize * sizeof(float));
     memset(oscilFFTfreqs.c, 0, synth->halfoscilsize * sizeof(float));
-    memset(basefuncFFTfreqs.s, 0, synth->halfoscilsize * sizeof(float));
-    memset(basefuncFFTfreqs.c, 0, synth->halfoscilsize * sizeof(float));
+    changebasefunction(true);
 
     oscilprepared = 0;
     oldfilterpars = 0;
@@ -153,9 +158,7 @@ void OscilGen::convert2sine(int magtype)
     FFTFREQS freqs;
     FFTwrapper::newFFTFREQS(&freqs, synth->halfoscilsize);
     get(oscil, -1.0f);
-    FFTwrapper *fft = new FFTwrapper(synth->oscilsize);
     fft->smps2freqs(oscil, &freqs);
-    delete fft;
 
     float max = 0.0f;
 
@@ -666,20 +669,56 @@ void OscilGen::oscilfilter(void)
 }
 
 
-// Change the base function
-void OscilGen::changebasefunction(void)
+// Change the base function. From get() we may be on the audio thread,
+// so the shared tables (a process wide lock, maybe a new table and an FFT)
+// are left alone and it's made in our own, the shared one we hold going
+// at the next change made elsewhere.
+void OscilGen::changebasefunction(bool shareBase)
 {
-    if (Pcurrentbasefunc != 0)
+    if (!shareBase && baseTable && basefuncFFTfreqs.s != rtFFTfreqs.s)
+    {
+        memcpy(rtFFTfreqs.s, basefuncFFTfreqs.s, synth->halfoscilsize * sizeof(float));
+        memcpy(rtFFTfreqs.c, basefuncFFTfreqs.c, synth->halfoscilsize * sizeof(float));
+        basefuncFFTfreqs = rtFFTfreqs;
+    }
+    if (Pcurrentbasefunc == 127)
     {
+        ownbasefunction();
         getbasefunction(tmpsmps);
         fft->smps2freqs(tmpsmps, &basefuncFFTfreqs);
         basefuncFFTfreqs.c[0] = 0.0f;
     }
+    else if (!shareBase && basefuncFFTfreqs.s)
+    {
+        if (Pcurrentbasefunc == 0)
+        {
+            memset(basefuncFFTfreqs.s, 0, synth->halfoscilsize * sizeof(float));
+            memset(basefuncFFTfreqs.c, 0, synth->halfoscilsize * sizeof(float));
+        }
+        else
+            _makebasefunction(this, &basefuncFFTfreqs);
+    }
     else
     {
-        for (int i = 0; i < synth->halfoscilsize; ++i)
-            basefuncFFTfreqs.s[i] = basefuncFFTfreqs.c[i] = 0.0f;
-        //in this case basefuncFFTfreqs_ are not used
+        // everything the table depends on, for the sine case
+        // it's all zeros and isn't used
+        unsigned long long key = synth->oscilsize;
+        key = (key << 8) | Pcurrentbasefunc;
+        if (Pcurrentbasefunc != 0)
+        {
+            key = (key << 8) | Pbasefuncpar;
+            key = (key << 8) | Pbasefuncmodulation;
+            if (Pbasefuncmodulation != 0)
+            {
+                key = (key << 8) | Pbasefuncmodulationpar1;
+                key = (key << 8) | Pbasefuncmodulationpar2;
+                key = (key << 8) | Pbasefuncmodulationpar3;
+            }
+        }
+        const FFTFREQS *table = SharedResources::getBasefunction(key, synth->halfoscilsize, _makebasefunction, this);
+        dropbasefunction(); // after, so the same one isn't thrown away
+        baseTable = table;
+        basefuncFFTfreqs = *table;
     }
     oscilprepared = 0;
     oldbasefunc = Pcurrentbasefunc;
@@ -691,6 +730,45 @@ void OscilGen::changebasefunction(void)
 }
 
 
+void OscilGen::_makebasefunction(void *arg, FFTFREQS *table)
+{
+    OscilGen *oscil = static_cast<OscilGen*>(arg);
+    if (oscil->Pcurrentbasefunc == 0)
+        return;
+    oscil->getbasefunction(oscil->tmpsmps);
+    oscil->fft->smps2freqs(oscil->tmpsmps, table);
+    table->c[0] = 0.0f;
+}
+
+
+// a copy we can change
+void OscilGen::ownbasefunction(void)
+{
+    if (basefuncFFTfreqs.s && (!baseTable || basefuncFFTfreqs.s == rtFFTfreqs.s))
+        return;
+    FFTFREQS own;
+    FFTwrapper::newFFTFREQS(&own, synth->halfoscilsize);
+    if (basefuncFFTfreqs.s)
+    {
+        memcpy(own.s, basefuncFFTfreqs.s, synth->halfoscilsize * sizeof(float));
+        memcpy(own.c, basefuncFFTfreqs.c, synth->halfoscilsize * sizeof(float));
+    }
+    dropbasefunction();
+    basefuncFFTfreqs = own;
+}
+
+
+void OscilGen::dropbasefunction(void)
+{
+    if (baseTable)
+        SharedResources::releaseBasefunction(baseTable);
+    else if (basefuncFFTfreqs.s)
+        FFTwrapper::deleteFFTFREQS(&basefuncFFTfreqs);
+    baseTable = NULL;
+    basefuncFFTfreqs.s = basefuncFFTfreqs.c = NULL;
+}
+
+
 // Waveshape
 void OscilGen::waveshape(void)
 {
@@ -943,7 +1021,7 @@ void OscilGen::shiftharmonics(void)
 
 
 // Prepare the Oscillator
-void OscilGen::prepare(void)
+void OscilGen::prepare(bool shareBase)
 {
     //int i, j, k;
     float a, b, c, d, hmagnew;
@@ -958,7 +1036,7 @@ void OscilGen::prepare(void)
         || oldbasefuncmodulationpar1 != Pbasefuncmodulationpar1
         || oldbasefuncmodulationpar2 != Pbasefuncmodulationpar2
         || oldbasefuncmodulationpar3 != Pbasefuncmodulationpar3)
-        changebasefunction();
+        changebasefunction(shareBase);
 
     for (int i = 0; i < MAX_AD_HARMONICS; ++i)
         hphase[i] = (Phphase[i] - 64.0f) / 64.0f * PI / (i + 1);
@@ -1231,7 +1309,7 @@ int OscilGen::get(float *smps, float freqHz, int resonance)
         oscilprepared = 0;
 
     if (oscilprepared != 1)
-        prepare();
+        prepare(false);
 
     outpos = (int)truncf((numRandom() * 2.0f - 1.0f) * synth->oscilsize_f * (Prand - 64.0f) / 64.0f);
     outpos = (outpos + 2 * synth->oscilsize) % synth->oscilsize;
@@ -1401,9 +1479,92 @@ void OscilGen::getspectrum(int n, float *spc, int what)
 }
 
 
+// Only reads from us, so doesn't need the lock
+void OscilGen::prepareinto(OscilGen *spare)
+{
+    memcpy(spare->Phmag, Phmag, sizeof(Phmag));
+    memcpy(spare->Phphase, Phphase, sizeof(Phphase));
+    spare->Phmagtype = Phmagtype;
+    spare->Pcurrentbasefunc = Pcurrentbasefunc;
+    spare->Pbasefuncpar = Pbasefuncpar;
+    spare->Pbasefuncmodulation = Pbasefuncmodulation;
+    spare->Pbasefuncmodulationpar1 = Pbasefuncmodulationpar1;
+    spare->Pbasefuncmodulationpar2 = Pbasefuncmodulationpar2;
+    spare->Pbasefuncmodulationpar3 = Pbasefuncmodulationpar3;
+    spare->Prand = Prand;
+    spare->Pwaveshaping = Pwaveshaping;
+    spare->Pwaveshapingfunction = Pwaveshapingfunction;
+    spare->Pfiltertype = Pfiltertype;
+    spare->Pfilterpar1 = Pfilterpar1;
+    spare->Pfilterpar2 = Pfilterpar2;
+    spare->Pfilterbeforews = Pfilterbeforews;
+    spare->Psatype = Psatype;
+    spare->Psapar = Psapar;
+    spare->Pamprandpower = Pamprandpower;
+    spare->Pamprandtype = Pamprandtype;
+    spare->Pharmonicshift = Pharmonicshift;
+    spare->Pharmonicshiftfirst = Pharmonicshiftfirst;
+    spare->Padaptiveharmonics = Padaptiveharmonics;
+    spare->Padaptiveharmonicsbasefreq = Padaptiveharmonicsbasefreq;
+    spare->Padaptiveharmonicspower = Padaptiveharmonicspower;
+    spare->Padaptiveharmonicspar = Padaptiveharmonicspar;
+    spare->Pmodulation = Pmodulation;
+    spare->Pmodulationpar1 = Pmodulationpar1;
+    spare->Pmodulationpar2 = Pmodulationpar2;
+    spare->Pmodulationpar3 = Pmodulationpar3;
+    spare->ADvsPAD = ADvsPAD;
+
+    if (Pcurrentbasefunc == 127 && basefuncFFTfreqs.s)
+    {   // user made, so it can't be remade from the parameters
+        spare->ownbasefunction();
+        memcpy(spare->basefuncFFTfreqs.s, basefuncFFTfreqs.s, synth->halfoscilsize * sizeof(float));
+        memcpy(spare->basefuncFFTfreqs.c, basefuncFFTfreqs.c, synth->halfoscilsize * sizeof(float));
+        spare->oldbasefunc = oldbasefunc;
+        spare->oldbasepar = oldbasepar;
+        spare->oldbasefuncmodulation = oldbasefuncmodulation;
+        spare->oldbasefuncmodulationpar1 = oldbasefuncmodulationpar1;
+        spare->oldbasefuncmodulationpar2 = oldbasefuncmodulationpar2;
+        spare->oldbasefuncmodulationpar3 = oldbasefuncmodulationpar3;
+    }
+    spare->prepare();
+}
+
+
+// Only swaps, so is quick enough to do under the lock. If something has
+// prepared us since we were marked, that's newer and is kept.
+void OscilGen::takeprepared(OscilGen *spare)
+{
+    if (oscilprepared)
+        return;
+    swap(oscilFFTfreqs, spare->oscilFFTfreqs);
+    swap(basefuncFFTfreqs, spare->basefuncFFTfreqs);
+    swap(baseTable, spare->baseTable);
+    swap(rtFFTfreqs, spare->rtFFTfreqs); // basefuncFFTfreqs may be using it
+    swap(hmag, spare->hmag);
+    swap(hphase, spare->hphase);
+    swap(oldbasefunc, spare->oldbasefunc);
+    swap(oldbasepar, spare->oldbasepar);
+    swap(oldhmagtype, spare->oldhmagtype);
+    swap(oldwaveshapingfunction, spare->oldwaveshapingfunction);
+    swap(oldwaveshaping, spare->oldwaveshaping);
+    swap(oldbasefuncmodulation, spare->oldbasefuncmodulation);
+    swap(oldbasefuncmodulationpar1, spare->oldbasefuncmodulationpar1);
+    swap(oldbasefuncmodulationpar2, spare->oldbasefuncmodulationpar2);
+    swap(oldbasefuncmodulationpar3, spare->oldbasefuncmodulationpar3);
+    swap(oldharmonicshift, spare->oldharmonicshift);
+    swap(oldmodulation, spare->oldmodulation);
+    swap(oldmodulationpar1, spare->oldmodulationpar1);
+    swap(oldmodulationpar2, spare->oldmodulationpar2);
+    swap(oldmodulationpar3, spare->oldmodulationpar3);
+    oscilprepared = 1;
+    spare->oscilprepared = 0;
+}
+
+
 // Convert the oscillator as base function
 void OscilGen::useasbase(void)
 {
+    ownbasefunction();
     for (int i = 0; i < synth->halfoscilsize; ++i)
     {
         basefuncFFTfreqs.c[i] = oscilFFTfreqs.c[i];
@@ -1566,10 +1727,11 @@ void OscilGen::getfromXML(XMLwrapper *xml)
     }
 
     if (Pcurrentbasefunc != 0)
-        changebasefunction();
+        changebasefunction(true);
 
     if (xml->enterbranch("BASE_FUNCTION"))
     {
+        ownbasefunction();
         for (int i = 1; i < synth->halfoscilsize; ++i)
         {
             if (xml->enterbranch("BF_HARMONIC", i))
@@ -41,7 +41,13 @@ class OscilGen : public Presets, private WaveShapeSamples
         OscilGen(FFTwrapper *fft_,Resonance *res_, SynthEngine *_synth);
         ~OscilGen();
 
-        void prepare();
+        void prepare(bool shareBase = true); // false from get(), see changebasefunction()
+        void unprepare(void) { oscilprepared = 0; } // get() will prepare it
+
+        // for edits away from the audio thread, prepare a spare copy
+        // unlocked, then swap the result in under the lock
+        void prepareinto(OscilGen *spare);
+        void takeprepared(OscilGen *spare);
 
         int get(float *smps, float freqHz);
         // returns where should I start getting samples, used in block type randomness
@@ -129,7 +135,11 @@ class OscilGen : public Presets, private WaveShapeSamples
         FFTwrapper *fft;
 
         // computes the basefunction and make the FFT; newbasefunc<0  = same basefunc
-        void changebasefunction(void);
+        void changebasefunction(bool shareBase);
+        // only user made ones (127) are our own, the rest are shared
+        static void _makebasefunction(void *arg, FFTFREQS *table);
+        void ownbasefunction(void);
+        void dropbasefunction(void);
 
         void waveshape(void); // Waveshaping (no kidding!)
 
@@ -191,6 +201,8 @@ class OscilGen : public Presets, private WaveShapeSamples
             oldmodulationpar3;
 
         FFTFREQS basefuncFFTfreqs; // Base Function Frequencies
+        const FFTFREQS *baseTable; // where they came from if shared
+        FFTFREQS rtFFTfreqs; // our own, for when get() changes the base function
         FFTFREQS oscilFFTfreqs; // Oscillator Frequencies - this is different
                                 // than the hamonics set-up by the user, it may
                                 // contain time-domain data if the antialiasing
@@ -83,6 +83,9 @@ void read_updates(SynthEngine *synth)
     CommandBlock getData;
     size_t commandSize = sizeof(getData);
 
+    // the snapshot first, anything in the ringbuffer is newer
+    while (synth->interchange.guiSnapshot.fetch(&getData))
+        decode_updates(synth, &getData);
     while(jack_ringbuffer_read_space(synth->interchange.toGUI) >= commandSize)
     {
         int toread = commandSize;
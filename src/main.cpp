@@ -182,20 +182,6 @@ static void *mainGuiThread(void *arg)
             MusicClient *_client = it->second;
             _synth->getRuntime().deadObjects->disposeBodies();
 
-            /*
-             * Setting pad parameters can take very many seconds.
-             * This dodge is to force it to diable the part then
-             * make the change take place in a low priority thread.
-             * It needs to be improved!
-             */
-            unsigned int padApply = _synth->getRuntime().padApply;
-            if (padApply < 0xffff)
-            {
-                _synth->interchange.setpadparams(padApply);
-                _synth->getRuntime().padApply = 0xffff;
-            }
-            // end of pad dodge
-
             if (!_synth->getRuntime().runSynth && _synth->getUniqueId() > 0)
             {
                 if (_synth->getRuntime().configChanged)
@@ -251,8 +237,8 @@ static void *mainGuiThread(void *arg)
             }
             GuiThreadMsg::processGuiMessages();
         }
-        else
-            usleep(33333);
+        else // still ticks for signals, but frees dead notes at once
+            firstSynth->getRuntime().deadObjects->waitForBodies(33);
     }
     if (firstSynth->getRuntime().configChanged)
     {